@@ -0,0 +1,45 @@
+#include "pch.h"
+#include "CAliasTable.h"
+
+void CAliasTable::Build (const std::vector<uint32_t>& vWeights)
+{
+	uint64_t nTotal = 0;
+	for (auto n : vWeights)
+		nTotal += n;
+	assert (nTotal > 0 && nTotal <= UINT32_MAX);
+
+	size_t nSize = vWeights.size();
+	_nTotal = static_cast<uint32_t>(nTotal);
+	_vThreshold.assign (nSize, _nTotal);
+	_vAlias.resize (nSize);
+
+	// Each bucket holds _nTotal. A bucket whose (scaled) weight is short of that
+	// is topped up from one with more than enough, which becomes its alias.
+	std::vector<uint64_t> vScaled (nSize);
+	std::vector<uint32_t> vSmall, vLarge;
+	for (size_t i = 0; i < nSize; i++)
+	{
+		vScaled[i] = static_cast<uint64_t>(vWeights[i]) * nSize;
+		_vAlias[i] = static_cast<uint32_t>(i);
+		(vScaled[i] < nTotal ? vSmall : vLarge).push_back (static_cast<uint32_t>(i));
+	}
+
+	while (!vSmall.empty() && !vLarge.empty())
+	{
+		uint32_t nSmall = vSmall.back();
+		vSmall.pop_back();
+		uint32_t nLarge = vLarge.back();
+
+		_vThreshold[nSmall] = static_cast<uint32_t>(vScaled[nSmall]);
+		_vAlias[nSmall] = nLarge;
+
+		vScaled[nLarge] -= nTotal - vScaled[nSmall];
+		if (vScaled[nLarge] < nTotal)
+		{
+			vLarge.pop_back();
+			vSmall.push_back (nLarge);
+		}
+	}
+
+	// (Whatever is left over is exactly full, and is its own alias.)
+}
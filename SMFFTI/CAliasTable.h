@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CRandom.h"
+
+/*
+17/10/26 Walker/Vose alias table. Picks index i (of n) with a chance of exactly
+weight[i] / (sum of the weights), in constant time: a draw for the bucket, and
+one against the bucket's threshold, which decides between the bucket's own
+index and its alias. The weights are whole numbers, so nothing is rounded.
+
+	CAliasTable table ({ 6, 3, 1 });
+	uint32_t i = table.Pick (rng);		// 0 six times in ten, ...
+*/
+
+class CAliasTable
+{
+public:
+	CAliasTable() {}
+	explicit CAliasTable (const std::vector<uint32_t>& vWeights) { Build (vWeights); }
+
+	// The sum of the weights must be more than 0, and less than 2^32.
+	void Build (const std::vector<uint32_t>& vWeights);
+
+	uint32_t Pick (CRandom& rng) const
+	{
+		uint32_t i = rng.Below (static_cast<uint32_t>(_vThreshold.size()));
+		return rng.Below (_nTotal) < _vThreshold[i] ? i : _vAlias[i];
+	}
+
+	size_t GetSize() const { return _vThreshold.size(); }
+
+protected:
+	uint32_t _nTotal = 0;					// Sum of the weights.
+	std::vector<uint32_t> _vThreshold;		// Out of _nTotal.
+	std::vector<uint32_t> _vAlias;
+};
@@ -1,10 +1,9 @@
 #include "pch.h"
 #include "CAutoRhythm.h"
 
-CAutoRhythm::CAutoRhythm (uint32_t nShortNotePrefPercent)
+CAutoRhythm::CAutoRhythm (uint32_t nShortNotePrefPercent, CRandom& rng)
+	: _rng (rng)
 {
-	_eng.seed (_rdev());
-
 	/*
 	Note lengths of 16 (32nds) and less are considered *short* notes, while longer
 	ones are considered *long* notes. nShortNotePrefPercent specifies the level of
@@ -48,13 +47,13 @@ CAutoRhythm::CAutoRhythm (uint32_t nShortNotePrefPercent)
 	vLongerNotes.push_back (31);
 	vLongerNotes.push_back (32);
 
-	std::uniform_int_distribution<uint32_t> randShortNoteLen (0, vShorterNotes.size() - 1);
-	std::uniform_int_distribution<uint32_t> randLongNoteLen (0, vLongerNotes.size() - 1);
+	uint32_t nNumShorterNotes = static_cast<uint32_t>(vShorterNotes.size());
+	uint32_t nNumLongerNotes = static_cast<uint32_t>(vLongerNotes.size());
 
 	// Add short note lengths.
 	for (uint32_t j = 0; j < nShortNotePrefPercent; j++)
 	{
-		uint32_t nLen = vShorterNotes[randShortNoteLen (_eng)];
+		uint32_t nLen = vShorterNotes[_rng.Below (nNumShorterNotes)];
 		_vNoteLens.push_back (nLen);
 	}
 
@@ -62,7 +61,7 @@ CAutoRhythm::CAutoRhythm (uint32_t nShortNotePrefPercent)
 	uint32_t nLongNotePrefPercent = 100 - nShortNotePrefPercent;
 	for (uint32_t j = 0; j < nLongNotePrefPercent; j++)
 	{
-		uint32_t nLen = vLongerNotes[randLongNoteLen (_eng)];
+		uint32_t nLen = vLongerNotes[_rng.Below (nNumLongerNotes)];
 		_vNoteLens.push_back (nLen);
 	}
 }
@@ -71,7 +70,7 @@ std::string CAutoRhythm::GetPattern (uint32_t& nNumNotes, uint32_t nPatternLen)
 {
 	std::string sPattern (nPatternLen, ' ');
 
-	std::uniform_int_distribution<uint32_t> randNoteLen (0, _vNoteLens.size() - 1);
+	uint32_t nNumNoteLens = static_cast<uint32_t>(_vNoteLens.size());
 
 	// Init index of sPattern.
 	uint32_t i = 0;
@@ -84,7 +83,7 @@ std::string CAutoRhythm::GetPattern (uint32_t& nNumNotes, uint32_t nPatternLen)
 	while (i < sPattern.size())
 	{
 		// Get random note length.
-		uint32_t nLen = _vNoteLens[randNoteLen (_eng)];
+		uint32_t nLen = _vNoteLens[_rng.Below (nNumNoteLens)];
 
 		if (nLen > nCharsLeft)
 			nLen = nCharsLeft;
@@ -109,8 +108,7 @@ std::string CAutoRhythm::GetPattern (uint32_t& nNumNotes, uint32_t nPatternLen)
 		vNoteAlign.push_back (8);	// 1/4 notes
 		vNoteAlign.push_back (8);	// 1/4 notes
 		vNoteAlign.push_back (16);	// 1/2 notes
-		std::uniform_int_distribution<uint32_t> randNoteAlign (0, vNoteAlign.size() - 1);
-		uint32_t noteAlign = vNoteAlign[randNoteAlign (_eng)];
+		uint32_t noteAlign = vNoteAlign[_rng.Below (static_cast<uint32_t>(vNoteAlign.size()))];
 		uint32_t j = i % noteAlign;
 		if (j != 0)
 			i = i - j + noteAlign;	// Advance to next note alignment.
@@ -122,6 +120,3 @@ std::string CAutoRhythm::GetPattern (uint32_t& nNumNotes, uint32_t nPatternLen)
 
 	return sPattern;
 }
-
-// Randomizer static variable declaration
-std::default_random_engine CAutoRhythm::_eng;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "CRandom.h"
+
 /*
 18/3/23 Handles rhythm processing for Auto-chord.
 */
@@ -7,7 +9,8 @@
 class CAutoRhythm
 {
 public:
-	CAutoRhythm (uint32_t nShortNotePrefPercent);
+	// Patterns are made with rng, which must outlive the CAutoRhythm.
+	CAutoRhythm (uint32_t nShortNotePrefPercent, CRandom& rng);
 
 	std::string GetPattern (uint32_t& nNumNotes, uint32_t nPatternLen);
 
@@ -15,7 +18,7 @@ protected:
 	std::vector<uint8_t> _vNoteLens;
 
 	// Randomizer
-	std::random_device _rdev;
+	CRandom& _rng;
 
 	//------------------------------------------------------------------------------------------
 	// Static class members
@@ -24,7 +27,5 @@ protected:
 	static struct ClassMemberInit { ClassMemberInit(); } cmi;
 
 	static std::vector<std::string> _vChromaticScale;
-
-	static std::default_random_engine _eng;
 };
 
@@ -0,0 +1,229 @@
+#include "pch.h"
+#include "CBatchRender.h"
+#include "Common.h"
+
+namespace {
+
+// Split a manifest line into whitespace-separated tokens; double quotes
+// group a token containing spaces.
+bool Tokenize (const std::string& sLine, std::vector<std::string>& vTokens)
+{
+	vTokens.clear();
+
+	size_t i = 0;
+	while (i < sLine.size())
+	{
+		if (std::isspace (static_cast<unsigned char>(sLine[i])))
+		{
+			i++;
+			continue;
+		}
+
+		std::string sToken;
+		if (sLine[i] == '"')
+		{
+			size_t nEnd = sLine.find ('"', i + 1);
+			if (nEnd == std::string::npos)
+				return false;
+			sToken = sLine.substr (i + 1, nEnd - i - 1);
+			i = nEnd + 1;
+		}
+		else
+		{
+			while (i < sLine.size() && !std::isspace (static_cast<unsigned char>(sLine[i])))
+				sToken += sLine[i++];
+		}
+
+		vTokens.push_back (sToken);
+	}
+
+	return true;
+}
+
+}
+
+CBatchRender::CBatchRender (uint32_t nThreads)
+	: _nThreads (nThreads)
+{
+	if (_nThreads == 0)
+		_nThreads = (std::max) (1u, std::thread::hardware_concurrency());
+}
+
+CMIDIHandler::StatusCode CBatchRender::LoadManifest (const std::string& sManifestFile, bool bOverwriteOutFile)
+{
+	if (!akl::MyFileExists (sManifestFile))
+	{
+		_sStatusMessage = "Unable to open batch manifest file.";
+		return CMIDIHandler::StatusCode::InvalidBatchManifest;
+	}
+
+	std::vector<std::string> vFile;
+	akl::LoadTextFileIntoVector (sManifestFile, vFile);
+
+	// Entries are rendered in parallel, so no two may write the same file, and
+	// none may read a file that another writes. Paths are compared in their
+	// canonical form; values are manifest line numbers.
+	std::map<std::string, size_t> mInFiles;
+	std::map<std::string, size_t> mOutFiles;
+	auto Canonical = [](const std::string& sFile)
+	{
+		std::error_code ec;
+		std::filesystem::path path = std::filesystem::absolute (sFile, ec);
+		if (!ec)
+			path = std::filesystem::weakly_canonical (path, ec);
+		return ec ? sFile : path.string();
+	};
+
+	std::vector<std::string> vTokens;
+	for (size_t nLine = 0; nLine < vFile.size(); nLine++)
+	{
+		std::string sLine = vFile[nLine];
+		if (!sLine.empty() && sLine.back() == '\r')
+			sLine.pop_back();
+
+		std::string sTrimmed = akl::RemoveWhitespace (sLine, 1);
+		if (sTrimmed.empty() || sTrimmed[0] == '#')
+			continue;
+
+		bool bValid = Tokenize (sLine, vTokens) && (vTokens.size() == 2 || vTokens.size() == 3);
+		bool bOverwrite = bOverwriteOutFile;
+		if (bValid && vTokens.size() == 3)
+		{
+			bValid = (vTokens[2] == "-o");
+			bOverwrite = true;
+		}
+
+		if (!bValid)
+		{
+			std::ostringstream ss;
+			ss << "Invalid batch manifest entry at line " << nLine + 1 << ":\n\n"
+				<< "    " << sLine << "\n\n"
+				<< "Each entry should be something like:\n\n"
+				<< "    mymidi.txt mymidi.mid -o\n";
+			_sStatusMessage = ss.str();
+			return CMIDIHandler::StatusCode::InvalidBatchManifest;
+		}
+
+		std::string sInFile = Canonical (vTokens[0]);
+		std::string sOutFile = Canonical (vTokens[1]);
+		if (sInFile == sOutFile)
+		{
+			std::ostringstream ss;
+			ss << "Input and output filenames must not be the same (batch manifest line "
+				<< nLine + 1 << ").";
+			_sStatusMessage = ss.str();
+			return CMIDIHandler::StatusCode::InvalidBatchManifest;
+		}
+
+		auto itOut = mOutFiles.find (sOutFile);
+		if (itOut != mOutFiles.end())
+		{
+			std::ostringstream ss;
+			ss << "Output file " << vTokens[1] << " is also the output of batch manifest line "
+				<< itOut->second << " (line " << nLine + 1 << ").";
+			_sStatusMessage = ss.str();
+			return CMIDIHandler::StatusCode::InvalidBatchManifest;
+		}
+
+		auto itIn = mInFiles.find (sOutFile);
+		if (itIn != mInFiles.end())
+		{
+			std::ostringstream ss;
+			ss << "Output file " << vTokens[1] << " is the input of batch manifest line "
+				<< itIn->second << " (line " << nLine + 1 << ").";
+			_sStatusMessage = ss.str();
+			return CMIDIHandler::StatusCode::InvalidBatchManifest;
+		}
+
+		itOut = mOutFiles.find (sInFile);
+		if (itOut != mOutFiles.end())
+		{
+			std::ostringstream ss;
+			ss << "Input file " << vTokens[0] << " is the output of batch manifest line "
+				<< itOut->second << " (line " << nLine + 1 << ").";
+			_sStatusMessage = ss.str();
+			return CMIDIHandler::StatusCode::InvalidBatchManifest;
+		}
+
+		mInFiles.emplace (sInFile, nLine + 1);
+		mOutFiles.emplace (sOutFile, nLine + 1);
+
+		AddEntry (vTokens[0], vTokens[1], bOverwrite);
+	}
+
+	return CMIDIHandler::StatusCode::Success;
+}
+
+void CBatchRender::AddEntry (const std::string& sInFile, const std::string& sOutFile, bool bOverwriteOutFile)
+{
+	Entry entry;
+	entry.sInFile = sInFile;
+	entry.sOutFile = sOutFile;
+	entry.bOverwriteOutFile = bOverwriteOutFile;
+	_vEntries.push_back (entry);
+}
+
+void CBatchRender::Run()
+{
+	auto tStart = std::chrono::steady_clock::now();
+
+	// Workers pull the next entry index until the manifest is exhausted.
+	std::atomic<size_t> nNext (0);
+	auto Worker = [this, &nNext]()
+	{
+		for (size_t i = nNext++; i < _vEntries.size(); i = nNext++)
+			RenderEntry (_vEntries[i]);
+	};
+
+	uint32_t nWorkers = static_cast<uint32_t>((std::min<size_t>) (_nThreads, _vEntries.size()));
+	std::vector<std::thread> vThreads;
+	for (uint32_t i = 1; i < nWorkers; i++)
+		vThreads.emplace_back (Worker);
+
+	Worker();
+
+	for (auto& t : vThreads)
+		t.join();
+
+	_dElapsedSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - tStart).count();
+}
+
+void CBatchRender::RenderEntry (Entry& entry)
+{
+	auto tStart = std::chrono::steady_clock::now();
+
+	// Each render has its own CMIDIHandler, so no locking is needed (the
+	// cache locks for itself).
+	if (_pCache)
+		entry.nStatus = _pCache->Render (entry.sInFile, entry.sOutFile,
+			entry.bOverwriteOutFile, entry.sStatusMessage);
+	else
+		entry.nStatus = CMIDIHandler::Render (entry.sInFile, entry.sOutFile,
+			entry.bOverwriteOutFile, entry.sStatusMessage);
+
+	entry.dSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - tStart).count();
+}
+
+uint32_t CBatchRender::GetSuccessCount() const
+{
+	uint32_t nCount = 0;
+	for (const auto& entry : _vEntries)
+	{
+		if (entry.nStatus == CMIDIHandler::StatusCode::Success)
+			nCount++;
+	}
+	return nCount;
+}
+
+std::string CBatchRender::GetSummary() const
+{
+	std::ostringstream ss;
+	ss << GetSuccessCount() << " of " << _vEntries.size() << " files rendered in "
+		<< _dElapsedSeconds << " s using " << _nThreads << " thread(s)";
+	if (_dElapsedSeconds > 0.0)
+		ss << " (" << _vEntries.size() / _dElapsedSeconds << " files/sec)";
+	if (_pCache)
+		ss << ", " << _pCache->GetHitCount() << " from the cache";
+	ss << ".";
+	return ss.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CMIDIHandler.h"
+#include "CRenderCache.h"
+
+/*
+17/10/26 Batch rendering (-b mode). Renders all the entries of a manifest in
+one process, across a number of worker threads, so the static tables are built
+once, rather than once per file.
+
+Manifest format: one entry per line,
+
+    <infile> <outfile> [-o]
+
+where -o allows <outfile> to be overwritten. Paths containing spaces must be
+enclosed in double quotes. Blank lines and lines starting with # are ignored.
+No two entries may have the same <outfile>, and an entry's <outfile> must not
+be the <infile> of any entry.
+*/
+
+class CBatchRender
+{
+public:
+	struct Entry
+	{
+		std::string sInFile;
+		std::string sOutFile;
+		bool bOverwriteOutFile = false;
+
+		// Set by Run().
+		CMIDIHandler::StatusCode nStatus = CMIDIHandler::StatusCode::Success;
+		std::string sStatusMessage;
+		double dSeconds = 0.0;
+	};
+
+	// nThreads = 0: one worker per hardware thread.
+	CBatchRender (uint32_t nThreads = 0);
+
+	// Add the manifest's entries. bOverwriteOutFile applies to every entry,
+	// in addition to any -o given on the entry's own line.
+	CMIDIHandler::StatusCode LoadManifest (const std::string& sManifestFile, bool bOverwriteOutFile);
+
+	void AddEntry (const std::string& sInFile, const std::string& sOutFile, bool bOverwriteOutFile);
+
+	// Render through pCache (owned by the caller), if not null.
+	void SetRenderCache (CRenderCache* pCache) { _pCache = pCache; }
+
+	// Render every entry. Per-entry results are stored in the entries.
+	void Run();
+
+	const std::vector<Entry>& GetEntries() const { return _vEntries; }
+	uint32_t GetThreadCount() const { return _nThreads; }
+	uint32_t GetSuccessCount() const;
+	double GetElapsedSeconds() const { return _dElapsedSeconds; }
+	std::string GetSummary() const;
+	std::string GetStatusMessage() const { return _sStatusMessage; }
+
+protected:
+	void RenderEntry (Entry& entry);
+
+	std::vector<Entry> _vEntries;
+	uint32_t _nThreads = 1;
+	CRenderCache* _pCache = nullptr;
+	double _dElapsedSeconds = 0.0;
+	std::string _sStatusMessage;
+};
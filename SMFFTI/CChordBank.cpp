@@ -3,17 +3,58 @@
 #include "CMIDIHandler.h"
 
 // Constructor that builds everything.
-CChordBank::CChordBank (const std::string& sNote, const std::vector<uint32_t>& ctv)
-: _sKey (sNote)
+CChordBank::CChordBank (const std::string& sNote, const std::vector<uint32_t>& ctv, CRandom& rng)
+: _sKey (sNote), _rng (rng)
 {
-	_eng.seed (_rdev());
-
 	auto it = std::find (_vChromaticScale.begin(), _vChromaticScale.end(), _sKey);
 	_iChord = std::distance (_vChromaticScale.begin(), it);
 
-	BuildMajorChordVariations (ctv);
-	BuildMinorChordVariations (ctv);
-	BuildDimChordVariations (ctv);
+	// The variations of each chord type whose factor isn't zero, weighted by their
+	// factors. If none, the basic chord type.
+	auto BuildVariations = [&](ChordType chordType, const std::vector<std::pair<ChordTypeVariation, std::string>>& vTypes)
+	{
+		Variations& vars = _aVariations[static_cast<uint8_t>(chordType)];
+		for (const auto& t : vTypes)
+		{
+			uint32_t n = ctv[static_cast<uint32_t>(t.first)];
+			if (n == 0)
+				continue;
+
+			vars.vNames.push_back (t.second);
+			vars.vWeights.push_back (n);
+		}
+
+		if (vars.vNames.empty())
+		{
+			vars.vNames.push_back (vTypes[0].second);
+			vars.vWeights.push_back (1);
+		}
+
+		vars.table.Build (vars.vWeights);
+	};
+
+	BuildVariations (ChordType::Major, {
+		{ ChordTypeVariation::Major,		"" },
+		{ ChordTypeVariation::Dominant_7th,	"7" },
+		{ ChordTypeVariation::Major_7th,	"maj7" },
+		{ ChordTypeVariation::Dominant_9th,	"9" },
+		{ ChordTypeVariation::Major_9th,	"maj9" },
+		{ ChordTypeVariation::Add_9,		"add9" },
+		{ ChordTypeVariation::Sus_2,		"sus2" },
+		{ ChordTypeVariation::_7_Sus_2,		"7sus2" },
+		{ ChordTypeVariation::Sus_4,		"sus4" },
+		{ ChordTypeVariation::_7_Sus_4,		"7sus4" } });
+
+	BuildVariations (ChordType::Minor, {
+		{ ChordTypeVariation::Minor,		"m" },
+		{ ChordTypeVariation::Minor_7th,	"m7" },
+		{ ChordTypeVariation::Minor_9th,	"m9" },
+		{ ChordTypeVariation::Minor_Add_9,	"madd9" } });
+
+	BuildVariations (ChordType::Diminished, {
+		{ ChordTypeVariation::Dim,			"dim" },
+		{ ChordTypeVariation::Dim_7th,		"dim7" },
+		{ ChordTypeVariation::HalfDim,		"m7b5" } });
 }
 
 void CChordBank::BuildMinor (uint8_t nRootPercent, uint8_t nOtherMinorPercent, uint8_t nMajorPercent)
@@ -22,289 +63,106 @@ void CChordBank::BuildMinor (uint8_t nRootPercent, uint8_t nOtherMinorPercent, u
 	//
 	// So what we do is build the list according to the percentages specified.
 	// If the total percentage is less than 100, the remaining percentage is alloted to the dim chord.
-	// If the total percentage is greater than 100, an error value is returned.
-
-	uint8_t iChordCount = 0;
+	int32_t nDimPercent = (std::max) (0, 100 - nRootPercent - nOtherMinorPercent - nMajorPercent);
 
-	// Root chord
-	for (uint32_t i = 0; i < nRootPercent; i++)
-	{
-		_vChords.push_back (Chord (_vChromaticScale[_iChord], ChordType::Minor));
-		iChordCount++;
-		_nMinorKey_RootChord_Multiplier = 1;
-	}
+	AddChord (0, ChordType::Minor, nRootPercent * 6);
 
 	// Other minor chords
-	for (uint32_t i = 0; i < nOtherMinorPercent; i++)
-	{
-		if (i % 2 == 0)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 5], ChordType::Minor));
-		else
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 7], ChordType::Minor));
-
-		iChordCount++;
-		_nMinorKey_TwoOtherMinorChords_Multiplier = 2;
-	}
+	AddChord (5, ChordType::Minor, nOtherMinorPercent * 3);
+	AddChord (7, ChordType::Minor, nOtherMinorPercent * 3);
 
 	// Major chords
-	for (uint32_t i = 0; i < nMajorPercent; i++)
-	{
-		if (i % 3 == 0)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 3], ChordType::Major));
-		else if (i % 3 == 1)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 8], ChordType::Major));
-		else if (i % 3 == 2)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 10], ChordType::Major));
-
-		iChordCount++;
-		_nMinorKey_ThreeMajorChords_Multiplier = 3;
-	}
-
-	// Diminished chords
-	while (iChordCount < 100)
-	{
-		_vChords.push_back (Chord (_vChromaticScale[_iChord + 2], ChordType::Diminished));
-		iChordCount++;
-		_nMinorKey_DimChord_Multiplier = 1;
-	}
+	AddChord (3, ChordType::Major, nMajorPercent * 2);
+	AddChord (8, ChordType::Major, nMajorPercent * 2);
+	AddChord (10, ChordType::Major, nMajorPercent * 2);
 
-	_nMinorKey_TotalChordsAvailable = 
-		(_nMinorKey_RootChord_Multiplier * _nNumMinChordVars) +
-		(_nMinorKey_TwoOtherMinorChords_Multiplier * _nNumMinChordVars) +
-		(_nMinorKey_ThreeMajorChords_Multiplier * _nNumMajChordVars) +
-		(_nMinorKey_DimChord_Multiplier * _nNumDimChordVars);
+	// Diminished chord
+	AddChord (2, ChordType::Diminished, nDimPercent * 6);
 
-	ASSERT (_vChords.size() == 100);
+	_chordTable.Build (_vChordWeights);
+	_nMinorKey_TotalChordsAvailable = CountChordsAvailable();
 }
 
 void CChordBank::BuildMajor (uint8_t nRootPercent, uint8_t nOtherMajorPercent, uint8_t nMinorPercent)
 {
 	// Major key intervals: T, T, S, T, T, T, S
+	int32_t nDimPercent = (std::max) (0, 100 - nRootPercent - nOtherMajorPercent - nMinorPercent);
 
-	uint8_t iChordCount = 0;
-
-	// Root chord
-	for (uint32_t i = 0; i < nRootPercent; i++)
-	{
-		_vChords.push_back (Chord (_vChromaticScale[_iChord], ChordType::Major));
-		iChordCount++;
-		_nMajorKey_RootChord_Multiplier = 1;
-	}
+	AddChord (0, ChordType::Major, nRootPercent * 6);
 
 	// Other major chords
-	for (uint32_t i = 0; i < nOtherMajorPercent; i++)
-	{
-		if (i % 2 == 0)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 5], ChordType::Major));
-		else
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 7], ChordType::Major));
-
-		iChordCount++;
-		_nMajorKey_TwoOtherMajorChords_Multiplier = 2;
-	}
+	AddChord (5, ChordType::Major, nOtherMajorPercent * 3);
+	AddChord (7, ChordType::Major, nOtherMajorPercent * 3);
 
 	// Minor chords
-	for (uint32_t i = 0; i < nMinorPercent; i++)
-	{
-		if (i % 3 == 0)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 2], ChordType::Minor));
-		else if (i % 3 == 1)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 4], ChordType::Minor));
-		else if (i % 3 == 2)
-			_vChords.push_back (Chord (_vChromaticScale[_iChord + 9], ChordType::Minor));
-
-		iChordCount++;
-		_nMajorKey_ThreeMinorChords_Multiplier = 3;
-	}
-
-	// Diminished chords
-	while (iChordCount < 100)
-	{
-		_vChords.push_back (Chord (_vChromaticScale[_iChord + 11], ChordType::Diminished));
-		iChordCount++;
-		_nMajorKey_DimChord_Multiplier = 1;
-	}
+	AddChord (2, ChordType::Minor, nMinorPercent * 2);
+	AddChord (4, ChordType::Minor, nMinorPercent * 2);
+	AddChord (9, ChordType::Minor, nMinorPercent * 2);
 
-	_nMajorKey_TotalChordsAvailable = 
-		(_nMajorKey_RootChord_Multiplier * _nNumMajChordVars) +
-		(_nMajorKey_TwoOtherMajorChords_Multiplier * _nNumMajChordVars) +
-		(_nMajorKey_ThreeMinorChords_Multiplier * _nNumMinChordVars) +
-		(_nMajorKey_DimChord_Multiplier * _nNumDimChordVars);
+	// Diminished chord
+	AddChord (11, ChordType::Diminished, nDimPercent * 6);
 
-	ASSERT (_vChords.size() == 100);
+	_chordTable.Build (_vChordWeights);
+	_nMajorKey_TotalChordsAvailable = CountChordsAvailable();
 }
 
-void CChordBank::SetRandomChord()
+void CChordBank::AddChord (uint8_t nInterval, ChordType chordType, uint32_t nWeight)
 {
-	// Init randomizer for choosing chords.
-	std::uniform_int_distribution<uint32_t> randChord (0, _vChords.size() - 1);
-
-	_iRandChord = randChord (_eng);
-	Chord chord = _vChords[_iRandChord];
-
-	// Save the crucial items
-	_chord = chord.sNote;
-	_chordType = chord.iChordType;
-
-	std::vector<std::string>* pv = &_vMajorChordVariations;
-
-	// Init randomizer for chord variations.
-	switch (_chordType)
-	{
-	case ChordType::Major:
-		pv = &_vMajorChordVariations;
-		break;
-	case ChordType::Minor:
-		pv = &_vMinorChordVariations;
-		break;
-	case ChordType::Diminished:
-		pv = &_vDimChordVariations;
-		break;
-	default:
-		// Won't reach this
-		ASSERT (1==0);
-		break;
-	}
-
- 	std::uniform_int_distribution<uint32_t> randChordVariation (0, pv->size() - 1);
-	uint32_t iChordVar = randChordVariation (_eng);
-	_chordVariation = (*pv)[iChordVar];
+	_vChords.push_back (Chord (_vChromaticScale[_iChord + nInterval], chordType));
+	_vChordWeights.push_back (nWeight);
 }
 
-int32_t CChordBank::BuildMajorChordVariations (const std::vector<uint32_t>& ctv)
+uint32_t CChordBank::CountChordsAvailable() const
 {
-	int result = 0;
-	uint32_t n;
-
-	std::vector<std::string>& v = _vMajorChordVariations;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Major)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Dominant_7th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("7");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Major_7th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("maj7");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Dominant_9th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("9");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Major_9th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("maj9");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Add_9)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("add9");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Sus_2)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("sus2");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::_7_Sus_2)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("7sus2");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Sus_4)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("sus4");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::_7_Sus_4)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("7sus4");
-	_nNumMajChordVars += n ? 1 : 0;
-
-	// If nothing specified, ensure at least one entry (basic major type)
-	if (v.size() == 0)
+	uint32_t nCount = 0;
+	for (size_t i = 0; i < _vChords.size(); i++)
 	{
-		v.push_back ("");
-		_nNumMajChordVars = 1;
+		if (_vChordWeights[i] > 0)
+			nCount += static_cast<uint32_t>(_aVariations[static_cast<uint8_t>(_vChords[i].iChordType)].vNames.size());
 	}
-
-	return result;
+	return nCount;
 }
 
-int32_t CChordBank::BuildMinorChordVariations (const std::vector<uint32_t>& ctv)
+CChordBank::ChordId CChordBank::PickChord()
 {
-	int result = 0;
-	uint32_t n;
-
-	std::vector<std::string>& v = _vMinorChordVariations;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Minor)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("m");
-	_nNumMinChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Minor_7th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("m7");
-	_nNumMinChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Minor_9th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("m9");
-	_nNumMinChordVars += n ? 1 : 0;
+	ChordId id;
+	id.nChord = static_cast<uint8_t>(_chordTable.Pick (_rng));
 
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Minor_Add_9)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("madd9");
-	_nNumMinChordVars += n ? 1 : 0;
-
-	// If nothing specified, ensure at least one entry (basic minor type)
-	if (v.size() == 0)
-	{
-		v.push_back ("m");
-		_nNumMinChordVars = 1;
-	}
-
-	return result;
+	const Variations& vars = _aVariations[static_cast<uint8_t>(_vChords[id.nChord].iChordType)];
+	id.nVariation = static_cast<uint8_t>(vars.table.Pick (_rng));
+	return id;
 }
 
-int32_t CChordBank::BuildDimChordVariations (const std::vector<uint32_t>& ctv)
+std::string CChordBank::GetChordName (ChordId id) const
 {
-	int result = 0;
-	uint32_t n;
-
-	std::vector<std::string>& v = _vDimChordVariations;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Dim)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("dim");
-	_nNumDimChordVars += n ? 1 : 0;
-
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::Dim_7th)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("dim7");
-	_nNumDimChordVars += n ? 1 : 0;
+	const Chord& chord = _vChords[id.nChord];
+	return chord.sNote + _aVariations[static_cast<uint8_t>(chord.iChordType)].vNames[id.nVariation];
+}
 
-	n = ctv[static_cast<uint32_t> (ChordTypeVariation::HalfDim)];
-	for (uint32_t i = 0; i < n; i++)
-		v.push_back ("m7b5");
-	_nNumDimChordVars += n ? 1 : 0;
+void CChordBank::GetChordChances (std::vector<ChordChance>& v) const
+{
+	uint64_t nChordTotal = 0;
+	for (auto n : _vChordWeights)
+		nChordTotal += n;
 
-	// If nothing specified, ensure at least one entry (basic dim)
-	if (v.size() == 0)
+	ChordId id;
+	for (id.nChord = 0; id.nChord < _vChords.size(); id.nChord++)
 	{
-		v.push_back ("dim");
-		_nNumDimChordVars = 1;
+		if (_vChordWeights[id.nChord] == 0)
+			continue;
+
+		const Variations& vars = _aVariations[static_cast<uint8_t>(_vChords[id.nChord].iChordType)];
+		uint64_t nVarTotal = 0;
+		for (auto n : vars.vWeights)
+			nVarTotal += n;
+
+		for (id.nVariation = 0; id.nVariation < vars.vNames.size(); id.nVariation++)
+		{
+			double dChance = static_cast<double>(_vChordWeights[id.nChord]) / nChordTotal
+				* vars.vWeights[id.nVariation] / nVarTotal;
+			v.push_back ({ GetChordName (id), dChance });
+		}
 	}
-
-	return result;
 }
 
 //-----------------------------------------------------------------------------
@@ -341,6 +199,3 @@ CChordBank::ClassMemberInit::ClassMemberInit ()
 	_vChromaticScale.push_back ("Bb");
 	_vChromaticScale.push_back ("B");
 }
-
-// Randomizer static variable declaration
-std::default_random_engine CChordBank::_eng;
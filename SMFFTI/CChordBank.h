@@ -1,5 +1,8 @@
 #pragma once
 
+#include "CRandom.h"
+#include "CAliasTable.h"
+
 /*
 17/3/23 Encapsulates functionality relating to chord selection. You tell it which key
 you are using and it build a list of major, minor and diminished chords that can be used
@@ -15,7 +18,8 @@ class CChordBank
 {
 public:
 
-	CChordBank (const std::string& sNote, const std::vector<uint32_t>& ctv);
+	// Chords are chosen with rng, which must outlive the chord bank.
+	CChordBank (const std::string& sNote, const std::vector<uint32_t>& ctv, CRandom& rng);
 
 	// Construct list (vector) of major, minor and diminished chords for the key.
 	// These lists constitute the pool of chords from which progressions are randomly
@@ -24,14 +28,34 @@ public:
 	void BuildMinor (uint8_t nRootPercent, uint8_t nOtherMinorPercent, uint8_t nMajorPercent);
 	void BuildMajor (uint8_t nRootPercent, uint8_t nOtherMajorPercent, uint8_t nMinorPercent);
 
-	// Random chord selector.
-	void SetRandomChord();
+	// A chord of the key, and a variation of its chord type.
+	struct ChordId
+	{
+		uint8_t nChord;
+		uint8_t nVariation;
+	};
 
-	std::string GetChordName() { return _chord; }
-	ChordType GetChordType() { return _chordType; }
+	// Random chord selector: a chord, then a variation, each from an alias table.
+	ChordId PickChord();
 
-	std::string GetChordVariation() { return _chordVariation; }
+	// eg. "Fm7"
+	std::string GetChordName (ChordId id) const;
 
+	// Every chord (name and variation, eg. "Fm7") that PickChord can choose,
+	// with the chance of it being chosen.
+	struct ChordChance
+	{
+		std::string sChord;
+		double dChance;
+	};
+	void GetChordChances (std::vector<ChordChance>& v) const;
+
+	// The number of chords (and variations) that can be chosen. RCR uses this
+	// to know when its history is 'full', ie. there are no more chords that can
+	// be chosen (since the user has rejected them all by invoking RCR multiple
+	// times). For example, for Gm with all 7 chords and all 17 variations:
+	// 4 variations of Gm, 3 of Adim, 10 of Bb, 4 of Cm, 4 of Dm, 10 of Eb and
+	// 10 of F, ie. 45.
 	const uint32_t GetTotalChordsAvailableForMinorKey()
 	{
 		return _nMinorKey_TotalChordsAvailable;
@@ -44,7 +68,6 @@ public:
 protected:
 
 	std::string _sKey;
-	bool _bMinorKey;
 	uint8_t _iChord;
 
 	struct Chord
@@ -55,78 +78,32 @@ protected:
 		Chord (std::string n, ChordType ct) : sNote (n), iChordType (ct) {}
 	};
 
+	// The chords of the key, and their weights (sixths of a percent, so that a
+	// group's percentage divides exactly between its two or three chords).
 	std::vector<Chord> _vChords;
+	std::vector<uint32_t> _vChordWeights;
+	CAliasTable _chordTable;
 
-	std::vector<std::string> _vMajorChordVariations;
-	std::vector<std::string> _vMinorChordVariations;
-	std::vector<std::string> _vDimChordVariations;
+	// Per chord type (Major, Minor, Diminished): the variations (eg. "m7") with
+	// a non-zero Chord Type Variation factor, weighted by it.
+	struct Variations
+	{
+		std::vector<std::string> vNames;
+		std::vector<uint32_t> vWeights;
+		CAliasTable table;
+	};
+	Variations _aVariations[3];
 
 	// Randomizer
-	std::random_device _rdev;
-
-	uint8_t _iRandChord = 127;
-	std::string _chord;
-	ChordType _chordType;
-	std::string _chordVariation;
-
-	int32_t BuildMajorChordVariations (const std::vector<uint32_t>& ctv);
-	int32_t BuildMinorChordVariations (const std::vector<uint32_t>& ctv);
-	int32_t BuildDimChordVariations (const std::vector<uint32_t>& ctv);
-	
-	// These variables all pertain specificially to RCR.
-	// Don't know how to describe these. They are used to
-	// determine the total number of chords that can be
-	// randomly selected using RCR.
-	uint32_t _nMinorKey_RootChord_Multiplier = 0;				// 0 or 1 (there is only 1 root chord)
-	uint32_t _nMinorKey_TwoOtherMinorChords_Multiplier = 0;		// 0 or 2
-	uint32_t _nMinorKey_ThreeMajorChords_Multiplier = 0;		// 0 or 3
-	uint32_t _nMinorKey_DimChord_Multiplier = 0;				// 0 or 1
-	//
-	uint32_t _nMajorKey_RootChord_Multiplier = 0;				// 0 or 1
-	uint32_t _nMajorKey_TwoOtherMajorChords_Multiplier = 0;		// 0 or 2
-	uint32_t _nMajorKey_ThreeMinorChords_Multiplier = 0;		// 0 or 3
-	uint32_t _nMajorKey_DimChord_Multiplier = 0;				// 0 or 1
-	//
-	//
-	// The above values are used to multiply their
-	// respective values below. These values are then summed
-	// to give a total. For example, if we are using Gm as
-	// our key, and we are permitting all 7 of its chords
-	// to be used, and we are allowing *all* 17 of the chord
-	// variations, this means:
-	//
-	//		 4 variations of Gm
-	//		 3     "      "  Adim
-	//		10     "      "  Bb
-	//		 4     "      "  Cm
-	//		 4     "      "  Dm
-	//		10     "      "  Eb
-	//		10     "      "  F
-	//     ---
-	//      45
-	//
-	// This give us a total of 45 possible chords that RCR can choose from.
-	// Of course, Auto-chords can also use any of these, but regarding RCR
-	// we need to know this number for our processing that prevents a chord
-	// from being chosen if it is already in the RCR 'history' list. Specifically,
-	// we need to know when the history is 'full', ie. there are no more chords
-	// that can be chosen (since the user has rejected them all by invoking RCR
-	// multiple times).
-	//
-	// Number of Major Chord Variations (can be 1 - 10)
-	uint32_t _nNumMajChordVars = 0;
-	//
-	// Number of Minor Chord Variations (can be 1 - 4)
-	uint32_t _nNumMinChordVars = 0;
-	//
-	// Number of Diminished Chord Variations (can be 1 - 3)
-	uint32_t _nNumDimChordVars = 0;
-	//
+	CRandom& _rng;
+
+	void AddChord (uint8_t nInterval, ChordType chordType, uint32_t nWeight);
+	uint32_t CountChordsAvailable() const;
+
 	// The totals of the number of chords that are available for
 	// selection by Auto-chords and RCR.
 	uint32_t _nMinorKey_TotalChordsAvailable = 0;
 	uint32_t _nMajorKey_TotalChordsAvailable = 0;
-	//
 
 	//------------------------------------------------------------------------------------------
 	// Static class members
@@ -135,7 +112,4 @@ protected:
 	static struct ClassMemberInit { ClassMemberInit(); } cmi;
 
 	static std::vector<std::string> _vChromaticScale;
-
-	static std::default_random_engine _eng;
 };
-
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "CMIDIHandler.h"
 #include "CAutoRhythm.h"
+#include "CSMFReader.h"
 #include "Common.h"
 
 CMIDIHandler::CMIDIHandler (std::string sInputFile) : _sInputFile (sInputFile)
@@ -35,7 +36,7 @@ CMIDIHandler::CMIDIHandler (std::string sInputFile) : _sInputFile (sInputFile)
 	_vChordTypeVariationFactors[static_cast<int>(ChordTypeVariation::Dim_7th)]		= 1;
 	_vChordTypeVariationFactors[static_cast<int>(ChordTypeVariation::HalfDim)]		= 1;
 
-	_eng.seed (_rdev());
+	_rng.Seed (CRandom::RandomSeed());
 
 	_vParamsUsed.resize (static_cast<uint16_t>(ParamCode::SYS_ParameterCount));
 }
@@ -44,10 +45,6 @@ CMIDIHandler::StatusCode CMIDIHandler::CreateRandomFunkGrooveMIDICommandFile (st
 {
 	StatusCode result = StatusCode::Success;
 
-	bool bRandomGroove = true;	// dummy value - not used
-
-	_vBarCount.push_back (1);
-
 	if (!bOverwriteOutFile && akl::MyFileExists (sOutFile))
 	{
 		std::ostringstream ss;
@@ -57,99 +54,196 @@ CMIDIHandler::StatusCode CMIDIHandler::CreateRandomFunkGrooveMIDICommandFile (st
 		return StatusCode::OutputFileAlreadyExists;
 	}
 
-	std::uniform_int_distribution<size_t> randChord (0, _vRFGChords.size() - 1);
+	std::vector<std::string> vLines;
+	MakeRandomFunkGroove (sOutFile, vLines);
 
-	std::vector<std::string> vChords;
-	std::vector<std::string> vNotePositions;
-	std::string sChord, sPrevChord;
-	for (size_t i = 0; i < 8; i++)
+	std::ofstream ofs (sOutFile, std::ios::out);
+	for (const auto& sLine : vLines)
+		ofs << sLine << "\n";
+	ofs.close();
+
+	return result;
+}
+
+CMIDIHandler::StatusCode CMIDIHandler::CreateRandomFunkGrooves (const std::string& sOutFile, bool bOverwriteOutFile,
+	const RandomFunkGrooveOptions& options)
+{
+	if (options.nGrooves == 0)
 	{
-		std::string sGroove = GetRandomGroove (bRandomGroove);
-		vNotePositions.push_back (sGroove);
+		_sStatusMessage = "Invalid random funk groove options.";
+		return StatusCode::InvalidRandFunkGrooveOptions;
+	}
 
-		// Randomize chord selection and validate.
-		// (Except 1st chord must be Em7.)
-		if (i == 0)
-			sChord = "Em7";
-		else
-			sChord = _vRFGChords[randChord (_eng)];
+	if (!bOverwriteOutFile)
+	{
+		for (uint32_t i = 0; i < options.nGrooves; i++)
+		{
+			if (akl::MyFileExists (akl::NumberedFileName (sOutFile, i + 1))
+				|| (options.bRenderMIDI && akl::MyFileExists (akl::NumberedFileName (sOutFile, i + 1, ".mid"))))
+			{
+				std::ostringstream ss;
+				ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
+					<< "SMFFTI.exe -rfg groove.txt -count 100 -o";
+				_sStatusMessage = ss.str();
+				return StatusCode::OutputFileAlreadyExists;
+			}
+		}
+	}
+
+	// Each groove is made by its own CMIDIHandler, from its own stream, so the
+	// grooves are the same for a given seed whatever the number of threads.
+	const uint64_t nSeed = _rng.GetSeed();
+	std::vector<StatusCode> vResults (options.nGrooves, StatusCode::Success);
+	std::vector<std::string> vMessages (options.nGrooves);
+
+	auto MakeGroove = [&](uint32_t i)
+	{
+		std::string sFile = akl::NumberedFileName (sOutFile, i + 1);
+
+		CMIDIHandler midiH ("");
+		midiH._rng.Seed (nSeed, _nFirstLineStream + i);
+
+		std::vector<std::string> vLines;
+		midiH.MakeRandomFunkGroove (sFile, vLines);
+
+		std::ostringstream ss;
+		for (const auto& sLine : vLines)
+			ss << sLine << "\n";
+		std::string sText = ss.str();
 
-		bool bErr = false;
-		while (1)
+		std::ofstream ofs (sFile, std::ios::out);
+		ofs.write (sText.data(), sText.size());
+		ofs.close();
+		if (ofs.fail())
 		{
-			// Last chord NOT Em7
-			if (!bErr && i == 7 && sChord == "Em7")
-				bErr = true;
+			vResults[i] = StatusCode::UnableToWriteOutputFile;
+			vMessages[i] = "Unable to write output file " + sFile + ".";
+			return;
+		}
 
-			// No same chord consecutively.
-			if (!bErr && sChord == sPrevChord)
-				bErr = true;
+		if (!options.bRenderMIDI)
+			return;
 
-			// No sus chords unless the last one.
-			if (!bErr)
-			{
-				size_t pos = sChord.find ("sus");
-				if (pos != std::string::npos)
-					if (i != 7)
-						bErr = true;
-			}
+		// Rendered from the lines just made, rather than reading the file back.
+		CMIDIHandler render ("");
+		if (_bSeeded)
+			render.SetSeed (nSeed);
 
-			if (!bErr)
-				break;
-			bErr = false;
+		std::vector<uint8_t> vMIDI;
+		vResults[i] = render.VerifyMemFile (vLines);
+		if (vResults[i] == StatusCode::Success)
+			vResults[i] = render.CreateMIDIBuffer (vMIDI);
+		if (vResults[i] != StatusCode::Success)
+		{
+			vMessages[i] = sFile + ": " + render.GetStatusMessage();
+			return;
+		}
 
-			sChord = _vRFGChords[randChord (_eng)];
+		std::string sMIDIFile = akl::NumberedFileName (sOutFile, i + 1, ".mid");
+		std::ofstream ofsMIDI (sMIDIFile, std::ios::out | std::ios::binary);
+		ofsMIDI.write (reinterpret_cast<const char*>(vMIDI.data()), vMIDI.size());
+		ofsMIDI.close();
+		if (ofsMIDI.fail())
+		{
+			vResults[i] = StatusCode::UnableToWriteOutputFile;
+			vMessages[i] = "Unable to write output file " + sMIDIFile + ".";
 		}
+	};
 
-		sPrevChord = sChord;
+	uint32_t nWorkers = options.nThreads ? options.nThreads : (std::max) (1u, std::thread::hardware_concurrency());
+	nWorkers = (std::min) (nWorkers, options.nGrooves);
 
-		size_t n = std::count (sGroove.begin(), sGroove.end(), '+');
-		std::ostringstream ss;
-		ss << sChord << "(" << n << ")";
-		vChords.push_back (ss.str());
-	}
+	std::atomic<uint32_t> nNext (0);
+	auto Worker = [&]()
+	{
+		for (uint32_t i = nNext++; i < options.nGrooves; i = nNext++)
+			MakeGroove (i);
+	};
 
-	std::ofstream ofs (sOutFile, std::ios::out);
+	std::vector<std::thread> vThreads;
+	for (uint32_t i = 1; i < nWorkers; i++)
+		vThreads.emplace_back (Worker);
 
-	std::ostringstream ss;
+	Worker();
 
-	ss <<
+	for (auto& t : vThreads)
+		t.join();
 
-		"+TrackName=Random Funk Groove (" << sOutFile << ")\n"
-		"+BassNote=0\n"
-		"+Velocity=80\n"
-		"+RandVelVariation=0\n"
-		"+RandNoteStartOffset=0\n"
-		"+RandNoteEndOffset=0\n"
-		"+RandNoteOffsetTrim=1\n"
-		"+NoteStagger=0\n"
-		"+OctaveRegister=3\n"
-		"+TransposeThreshold=11\n"
-		"+Arpeggiator=0\n"
-		"+ArpTime=16\n"
-		"+ArpGatePercent=100\n"
-		"+ArpOctaveSteps=1\n\n"
+	for (uint32_t i = 0; i < options.nGrooves; i++)
+	{
+		if (vResults[i] != StatusCode::Success)
+		{
+			_sStatusMessage = vMessages[i];
+			return vResults[i];
+		}
+	}
+
+	return StatusCode::Success;
+}
+
+void CMIDIHandler::MakeRandomFunkGroove (const std::string& sTrackName, std::vector<std::string>& vLines)
+{
+	bool bRandomGroove = true;	// dummy value - not used
+
+	_vBarCount.assign (1, 1);
 
-		"+FunkStrum=2\n"
-		"+FunkStrumUpStrokeAttenuation=0.5\n"
-		"+FunkStrumVelDeclineIncrement=8\n\n"
+	// The first chord is Em7. The others are drawn from the chords allowed after
+	// the previous one (see _vRFGCandidates): not the same chord twice in a row,
+	// the last chord not Em7, and no sus chords unless the last one.
+	const uint32_t nNumRFGChords = static_cast<uint32_t>(_vRFGChordNames.size());
+	uint8_t nChord = static_cast<uint8_t>(std::find (_vRFGChordNames.begin(), _vRFGChordNames.end(), "Em7")
+		- _vRFGChordNames.begin());
 
-		;
+	std::vector<std::string> vChords;
+	std::vector<std::string> vNotePositions;
+	for (size_t i = 0; i < 8; i++)
+	{
+		std::string sGroove = GetRandomGroove (bRandomGroove);
+		vNotePositions.push_back (sGroove);
 
-		for (size_t i = 0; i < vChords.size(); i++)
+		if (i > 0)
 		{
-			ss <<
-				sRuler << "\n"
-				<< vNotePositions[i] << "\n"
-				<< vChords[i] << "\n\n"
-				;
+			const auto& vCandidates = _vRFGCandidates[(i == 7 ? nNumRFGChords : 0) + nChord];
+			nChord = vCandidates[_rng.Below (static_cast<uint32_t>(vCandidates.size()))];
 		}
 
-	ofs << ss.str();
+		size_t n = std::count (sGroove.begin(), sGroove.end(), '+');
+		std::ostringstream ss;
+		ss << _vRFGChordNames[nChord] << "(" << n << ")";
+		vChords.push_back (ss.str());
+	}
 
-	ofs.close();
+	vLines =
+	{
+		"+TrackName=Random Funk Groove (" + sTrackName + ")",
+		"+BassNote=0",
+		"+Velocity=80",
+		"+RandVelVariation=0",
+		"+RandNoteStartOffset=0",
+		"+RandNoteEndOffset=0",
+		"+RandNoteOffsetTrim=1",
+		"+NoteStagger=0",
+		"+OctaveRegister=3",
+		"+TransposeThreshold=11",
+		"+Arpeggiator=0",
+		"+ArpTime=16",
+		"+ArpGatePercent=100",
+		"+ArpOctaveSteps=1",
+		"",
+
+		"+FunkStrum=2",
+		"+FunkStrumUpStrokeAttenuation=0.5",
+		"+FunkStrumVelDeclineIncrement=8",
+		""
+	};
 
-	return result;
+	for (size_t i = 0; i < vChords.size(); i++)
+	{
+		vLines.push_back (sRuler);
+		vLines.push_back (vNotePositions[i]);
+		vLines.push_back (vChords[i]);
+		vLines.push_back ("");
+	}
 }
 
 CMIDIHandler::StatusCode CMIDIHandler::VerifyFile()
@@ -177,7 +271,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 	StatusCode result = StatusCode::Success;
 
 	uint8_t nDataLines = 0;
-	uint16_t nNumberOfNotes = 0;
+	uint32_t nNumberOfNotes = 0;
 	int32_t nVal = 0;
 	double ndVal = 0.0;
 	uint32_t nLineNum = 0;
@@ -185,6 +279,9 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 	bool bCommentBlock = false;
 	bool bRandomGroove = false;
 
+	// RCR history chord names already resolved.
+	std::unordered_set<std::string> setValidRCRHistoryChords;
+
 	// Initialise necessary Auto-chords defaults.
 	std::vector<std::string> v = akl::Explode (_sAutoChordsMinorChordBias, ",");
 	int num = 0;
@@ -194,7 +291,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 		_vAutoChordsMinorChordBias.push_back (n);
 		num += n;
 	}
-	ASSERT (num <= 100);	// Ensure your code defaults are okay.
+	assert (num <= 100);	// Ensure your code defaults are okay.
 	v = akl::Explode (_sAutoChordsMajorChordBias, ",");
 	num = 0;
 	for (int i = 0; i < 3; i++) 
@@ -203,7 +300,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 		_vAutoChordsMajorChordBias.push_back (n);
 		num += n;
 	}
-	ASSERT (num <= 100);	// Ensure your code defaults are okay.
+	assert (num <= 100);	// Ensure your code defaults are okay.
 
 	// RCR For remembering line positions when saving the previous
 	// chord progression back to the original file.
@@ -214,7 +311,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 	_vParamsUsed.assign (_vParamsUsed.size(), 0);
 
 	bool bFirstRuler = false;
-	for each (auto sLine in vFile)
+	for (auto sLine : vFile)
 	{
 		_vInputCopy.push_back (sLine);
 
@@ -320,7 +417,26 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 			_vNotePositions.push_back (sNotePositions);
 			_vNotePosLineInFile.push_back (nLineNum);
 
-			_vMelodyNotes.push_back ("");
+			// Compile the line into its notes. (Their chords are filled in once
+			// all the chords have been read.)
+			std::vector<NoteSpan>& vSpans = _vLineSpans.emplace_back();
+			bool bNoteOn = false;
+			for (uint32_t i = 0; i < sNotePositions.size(); i++)
+			{
+				char c = sNotePositions[i];
+				if (c == '+' || (c == '#' && !bNoteOn))
+				{
+					NoteSpan& span = vSpans.emplace_back();
+					span.nStart = i;
+					span.bRepeat = c == '#';
+					bNoteOn = true;
+				}
+				else if (c == ' ')
+					bNoteOn = false;
+
+				if (bNoteOn)
+					vSpans.back().nLength++;
+			}
 
 			nNumberOfNotes += std::count (sNotePositions.begin(), sNotePositions.end(), '+');
 			nDataLines++;
@@ -358,9 +474,10 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 			std::string comma = "";
 			uint32_t nReplaceCount = 0;
 
-			// T2015A
-			std::uniform_int_distribution<uint16_t> randModInt (0, 99);
-			std::vector<std::string> vCPHistory;	// chord prog history
+			// T2015A Chord prog history: for each chord of the line, the chords that
+			// have been tried (and rejected) there before.
+			std::vector<std::unordered_set<std::string>> vCPHistory;
+			uint32_t nCPHistoryCount = 0;
 			if (_bRCR)
 			{
 				InitChordBank (_sRCRKey);
@@ -398,35 +515,49 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 
 					std::string s = vFile[iLine++];
 
-					if (s.substr(0, 32) == sRulerOld || s.substr(0, 31) == sRulerNew.substr(0, 31))
+					if (IsRulerLine (s))
 						break;
 
 					if (s[0] != '#')
 						continue;
 
 					// try to verify that this is indeed a chord list
+					// (Each chord name is only resolved the first time it's seen.)
 					std::vector<std::string> v = akl::Explode (s, ",");
+					std::vector<std::string> vReplaced (v.size());
 					bool bValid = true;
-					for (auto c : v)
+					for (size_t j = 0; j < v.size(); j++)
 					{
-						std::string sChordName = c.substr (1, c.size());	// strip leading #
+						std::string sChordName = v[j].substr (1, v[j].size());	// strip leading #
 						if (sChordName[0] == '?')
+						{
 							sChordName = sChordName.substr (1, sChordName.size());
+							vReplaced[j] = akl::RemoveWhitespace (sChordName, 4);
+						}
+
+						if (setValidRCRHistoryChords.count (sChordName))
+							continue;
 
-						std::vector<std::string> vChordIntervals;
-						uint8_t nRoot = 0;
-						std::string sChordType;
-						if (!GetChordIntervals (sChordName, nRoot, vChordIntervals, sChordType))
+						ChordSpec chord;
+						if (!ResolveChord (sChordName, chord))
 						{
 							bValid = false;
 							break;
 						}
-
+						setValidRCRHistoryChords.insert (sChordName);
 					}
 
 					if (bValid)
 					{
-						vCPHistory.push_back (s);
+						if (vCPHistory.size() < vReplaced.size())
+							vCPHistory.resize (vReplaced.size());
+						for (size_t j = 0; j < vReplaced.size(); j++)
+						{
+							if (!vReplaced[j].empty())
+								vCPHistory[j].insert (vReplaced[j]);
+						}
+
+						nCPHistoryCount++;
 						nRCRHistoryRecordsToBeChecked++;
 					}
 				}
@@ -434,16 +565,13 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 
 			// Ensure the history count is correct (if, say, some of the history
 			// was deleted by the user).
-			_nRCRHistoryCount = vCPHistory.size();
+			_nRCRHistoryCount = nCPHistoryCount;
 
 			uint32_t nChord = 0;
-			for each (auto c in v)
+			for (auto c : v)
 			{
 				nChord++;
 
-				std::vector<std::string> vChordIntervals;
-				uint8_t nRoot = 0;
-
 				// Lambda func to check for chord repeater, ie. chord names suffixed with a number
 				// in parentheses, eg. Cm(3). Where found, the number value is given back.
 				// (Max 16 repeats allowed.)
@@ -482,39 +610,42 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					{
 						std::string sCurChord = sChordName.substr (1, sChordName.size());
 
-						auto IsDuplicateChord = [&]()
+						auto IsInHistory = [&](const std::string& sNewChord)
 						{
-							bool bResult = false;
-
-							if (sChordName == sCurChord)
-								return true;
+							return nChord <= vCPHistory.size() && vCPHistory[nChord - 1].count (sNewChord) > 0;
+						};
 
-							for (auto sChordList : vCPHistory)
+						// Pick a new chord, from those that are neither the same chord nor
+						// in the history. (If the history has every other chord, it's
+						// ignored; if there are no other chords at all, the chord stays.)
+						std::vector<uint8_t> vAllowed (_vRCRChoices.size());
+						double dTotal = 0.0;
+						for (bool bHistory : { true, false })
+						{
+							for (size_t i = 0; i < _vRCRChoices.size(); i++)
 							{
-								sChordList = sChordList.substr (1, sChordList.size());
-								std::vector<std::string> v = akl::Explode (sChordList, ",");
-								if (v.size() == 0)
-									continue;
-
-								std::string sOldChord = v[nChord - 1];
-								sOldChord = akl::RemoveWhitespace (sOldChord, 4);
-								if (sChordName == sOldChord.substr (1, sOldChord.size()))
-									return true;
+								const std::string& sNewChord = _vRCRChoices[i].sChord;
+								vAllowed[i] = sNewChord != sCurChord && !(bHistory && IsInHistory (sNewChord));
+								dTotal += vAllowed[i] ? _vRCRChoices[i].dChance : 0.0;
 							}
 
-							return bResult;
-						};
+							if (dTotal > 0.0)
+								break;
+						}
 
-						// Pick a new chord, but reject if it chooses the same chord.
-						do 
+						sChordName = sCurChord;
+						double dPick = _rng.Uniform() * dTotal;
+						for (size_t i = 0; i < _vRCRChoices.size(); i++)
 						{
-							// T2015A Which chord bank to use - the main one or the Modal Interchange one.
-							uint16_t iRandModInt = randModInt (_eng);
-							uint8_t iCB = _vChordBankChoice[iRandModInt];
-
-							_vChordBank[iCB]->SetRandomChord();
-							sChordName = _vChordBank[iCB]->GetChordName() + _vChordBank[iCB]->GetChordVariation();
-						} while (IsDuplicateChord());
+							if (!vAllowed[i])
+								continue;
+
+							// (The last allowed chord is taken if rounding leaves dPick over.)
+							sChordName = _vRCRChoices[i].sChord;
+							dPick -= _vRCRChoices[i].dChance;
+							if (dPick < 0.0)
+								break;
+						}
 
 						nReplaceCount++;
 						if (nReplaceCount == 1)
@@ -527,17 +658,32 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					}
 				}
 
-				std::string sChordType;
-				if (!GetChordIntervals (sChordName, nRoot, vChordIntervals, sChordType))
+				// Chord names already in the table were resolved when first seen.
+				uint16_t nChordId = 0;
+				auto itChord = _mChordSymbolIds.find (sChordName);
+				if (itChord != _mChordSymbolIds.end())
+					nChordId = itChord->second;
+				else
 				{
-					std::ostringstream ss;
-					ss << "Line " << nLineNum << ": Invalid/blank chord name: " << sChordName;
-					_sStatusMessage = ss.str();
-					return StatusCode::InvalidOrBlankChordName;
+					ChordSpec chord;
+					if (!ResolveChord (sChordName, chord))
+					{
+						std::ostringstream ss;
+						ss << "Line " << nLineNum << ": Invalid/blank chord name: " << sChordName;
+						_sStatusMessage = ss.str();
+						return StatusCode::InvalidOrBlankChordName;
+					}
+
+					if (!InternChord (sChordName, chord, nChordId))
+					{
+						std::ostringstream ss;
+						ss << "Line " << nLineNum << ": Too many different chords (maximum " << UINT16_MAX + 1 << ")";
+						_sStatusMessage = ss.str();
+						return StatusCode::TooManyChordSymbols;
+					}
 				}
 
-				for (uint8_t i = 0; i < nNumInstances; i++)
-					_vChordNames.push_back (sChordName);
+				_vChordIds.insert (_vChordIds.end(), nNumInstances, nChordId);
 
 				// RCR: Building new chord progression string
 				sChordList += comma + qm + sChordName;
@@ -573,7 +719,29 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 
 			if (sTemp.substr (0, 2) == "M:")
 			{
-				_vMelodyNotes.back() = sTemp;
+				// A melody note (semitones above the root) for each note.
+				std::vector<std::string> vMN = akl::Explode (sTemp.substr (2), ",");
+				std::vector<NoteSpan>& vSpans = _vLineSpans.back();
+				if (vMN.size() < vSpans.size())
+				{
+					std::ostringstream ss;
+					ss << "Line " << nLineNum << ": Melody line has fewer notes than the note positions line.";
+					_sStatusMessage = ss.str();
+					return StatusCode::InvalidMelodyLine;
+				}
+
+				for (size_t i = 0; i < vSpans.size(); i++)
+				{
+					int32_t nVal = 0;
+					if (!akl::VerifyTextInteger (akl::RemoveWhitespace (vMN[i], 4), nVal, 0, 127))
+					{
+						std::ostringstream ss;
+						ss << "Line " << nLineNum << ": Invalid melody note: " << vMN[i];
+						_sStatusMessage = ss.str();
+						return StatusCode::InvalidMelodyLine;
+					}
+					vSpans[i].nMelodyNote = (int8_t)nVal;
+				}
 				continue;
 			}
 		}
@@ -628,7 +796,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				return false;
 			};
 
-			if (sParam == _mParamCodes[ParamCode::BassNote])
+			if (sParam == _mParamCodes.at (ParamCode::BassNote))
 			{
 				if (IsParamAlreadySpecified (ParamCode::BassNote))
 					return StatusCode::ParamAlreadySpecified;
@@ -641,7 +809,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_bAddBassNote = nVal == 1;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RootNoteOnly])
+			else if (sParam == _mParamCodes.at (ParamCode::RootNoteOnly))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RootNoteOnly))
 					return StatusCode::ParamAlreadySpecified;
@@ -654,7 +822,25 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_bRootNoteOnly = nVal == 1;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::Velocity])
+			else if (sParam == _mParamCodes.at (ParamCode::Seed))
+			{
+				if (IsParamAlreadySpecified (ParamCode::Seed))
+					return StatusCode::ParamAlreadySpecified;
+
+				uint64_t nSeed;
+				if (!ParseSeed (vKeyValue[1], nSeed))
+				{
+					_sStatusMessage = "Invalid +Seed value (a whole number, 0 or more).";
+					return StatusCode::InvalidSeedValue;
+				}
+
+				// (A seed given by SetSeed, eg. with -seed, takes precedence.)
+				if (!_bSeedSet)
+					_rng.Seed (nSeed);
+				_bSeeded = true;
+				continue;
+			}
+			else if (sParam == _mParamCodes.at (ParamCode::Velocity))
 			{
 				if (IsParamAlreadySpecified (ParamCode::Velocity))
 					return StatusCode::ParamAlreadySpecified;
@@ -666,7 +852,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nVelocity = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RandVelVariation])
+			else if (sParam == _mParamCodes.at (ParamCode::RandVelVariation))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RandVelVariation))
 					return StatusCode::ParamAlreadySpecified;
@@ -678,7 +864,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nRandVelVariation = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RandNoteStartOffset])
+			else if (sParam == _mParamCodes.at (ParamCode::RandNoteStartOffset))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RandNoteStartOffset))
 					return StatusCode::ParamAlreadySpecified;
@@ -692,7 +878,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				if (_nRandNoteStartOffset > 0)
 					_bRandNoteStart = true;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RandNoteEndOffset])
+			else if (sParam == _mParamCodes.at (ParamCode::RandNoteEndOffset))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RandNoteEndOffset))
 					return StatusCode::ParamAlreadySpecified;
@@ -706,7 +892,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				if (_nRandNoteEndOffset > 0)
 					_bRandNoteEnd = true;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RandNoteOffsetTrim])
+			else if (sParam == _mParamCodes.at (ParamCode::RandNoteOffsetTrim))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RandNoteOffsetTrim))
 					return StatusCode::ParamAlreadySpecified;
@@ -718,7 +904,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_bRandNoteOffsetTrim = nVal == 1;
 			}
-			else if (sParam == _mParamCodes[ParamCode::NoteStagger])
+			else if (sParam == _mParamCodes.at (ParamCode::NoteStagger))
 			{
 				if (IsParamAlreadySpecified (ParamCode::NoteStagger))
 					return StatusCode::ParamAlreadySpecified;
@@ -730,7 +916,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nNoteStagger = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::OctaveRegister])
+			else if (sParam == _mParamCodes.at (ParamCode::OctaveRegister))
 			{
 				if (IsParamAlreadySpecified (ParamCode::OctaveRegister))
 					return StatusCode::ParamAlreadySpecified;
@@ -742,7 +928,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_sOctaveRegister = vKeyValue[1];
 			}
-			else if (sParam == _mParamCodes[ParamCode::TransposeThreshold])
+			else if (sParam == _mParamCodes.at (ParamCode::TransposeThreshold))
 			{
 				if (IsParamAlreadySpecified (ParamCode::TransposeThreshold))
 					return StatusCode::ParamAlreadySpecified;
@@ -754,7 +940,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nTransposeThreshold = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::Arpeggiator])
+			else if (sParam == _mParamCodes.at (ParamCode::Arpeggiator))
 			{
 				if (IsParamAlreadySpecified (ParamCode::Arpeggiator))
 					return StatusCode::ParamAlreadySpecified;
@@ -766,7 +952,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nArpeggiator = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::ArpTime])
+			else if (sParam == _mParamCodes.at (ParamCode::ArpTime))
 			{
 				if (IsParamAlreadySpecified (ParamCode::ArpTime))
 					return StatusCode::ParamAlreadySpecified;
@@ -782,7 +968,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_nArpTime = nVal;
 				_nArpNoteTicks = _ticksPerBar / _nArpTime;
 			}
-			else if (sParam == _mParamCodes[ParamCode::ArpGatePercent])
+			else if (sParam == _mParamCodes.at (ParamCode::ArpGatePercent))
 			{
 				if (IsParamAlreadySpecified (ParamCode::ArpGatePercent))
 					return StatusCode::ParamAlreadySpecified;
@@ -794,7 +980,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nArpGatePercent = nVal / 100.0f;
 			}
-			else if (sParam == _mParamCodes[ParamCode::ArpOctaveSteps])
+			else if (sParam == _mParamCodes.at (ParamCode::ArpOctaveSteps))
 			{
 				if (IsParamAlreadySpecified (ParamCode::ArpOctaveSteps))
 					return StatusCode::ParamAlreadySpecified;
@@ -806,14 +992,79 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nArpOctaveSteps = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::TrackName])
+			else if (sParam == _mParamCodes.at (ParamCode::TrackName))
 			{
 				if (IsParamAlreadySpecified (ParamCode::TrackName))
 					return StatusCode::ParamAlreadySpecified;
 
 				_sTrackName = akl::RemoveWhitespace (vKV2[1], 11);
 			}
-			else if (sParam == _mParamCodes[ParamCode::FunkStrum])
+			else if (sParam == _mParamCodes.at (ParamCode::Parts))
+			{
+				if (IsParamAlreadySpecified (ParamCode::Parts))
+					return StatusCode::ParamAlreadySpecified;
+
+				// eg. "Chords, Bass, Melody": a track for each, in that order.
+				_vParts.clear();
+				bool bValid = true;
+				for (auto sPart : akl::Explode (vKeyValue[1], ","))
+				{
+					std::transform (sPart.begin(), sPart.end(), sPart.begin(), ::tolower);
+
+					Part part;
+					if (sPart == "chords")
+						part.nType = PartType::Chords;
+					else if (sPart == "bass")
+						part.nType = PartType::Bass;
+					else if (sPart == "melody")
+						part.nType = PartType::Melody;
+					else
+						bValid = false;
+
+					for (const auto& p : _vParts)
+					{
+						if (p.nType == part.nType)
+							bValid = false;
+					}
+
+					if (bValid)
+						sPart[0] = ::toupper (sPart[0]);
+					part.sTrackName = sPart;
+					_vParts.push_back (part);
+				}
+
+				if (!bValid || _vParts.empty())
+				{
+					_sStatusMessage = "Invalid +Parts value (any of Chords, Bass, Melody, eg. \"+Parts = Chords, Bass\").";
+					return StatusCode::InvalidPartsValue;
+				}
+			}
+			else if (sParam == _mParamCodes.at (ParamCode::PartChannels))
+			{
+				if (IsParamAlreadySpecified (ParamCode::PartChannels))
+					return StatusCode::ParamAlreadySpecified;
+
+				_vPartChannels.clear();
+				for (const auto& sChannel : akl::Explode (vKeyValue[1], ","))
+				{
+					if (!akl::VerifyTextInteger (sChannel, nVal, 1, 16))
+					{
+						_sStatusMessage = "Invalid +PartChannels value (MIDI channels 1-16, one per part, eg. \"+PartChannels = 1, 2\").";
+						return StatusCode::InvalidPartChannelsValue;
+					}
+					_vPartChannels.push_back (static_cast<uint8_t>(nVal - 1));
+				}
+			}
+			else if (sParam == _mParamCodes.at (ParamCode::PartTrackNames))
+			{
+				if (IsParamAlreadySpecified (ParamCode::PartTrackNames))
+					return StatusCode::ParamAlreadySpecified;
+
+				_vPartTrackNames.clear();
+				for (const auto& sName : akl::Explode (vKV2[1], ","))
+					_vPartTrackNames.push_back (akl::RemoveWhitespace (sName, 11));
+			}
+			else if (sParam == _mParamCodes.at (ParamCode::FunkStrum))
 			{
 				if (IsParamAlreadySpecified (ParamCode::FunkStrum))
 					return StatusCode::ParamAlreadySpecified;
@@ -828,7 +1079,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					_nNoteStagger = nVal;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::FunkStrumUpStrokeAttenuation])
+			else if (sParam == _mParamCodes.at (ParamCode::FunkStrumUpStrokeAttenuation))
 			{
 				if (IsParamAlreadySpecified (ParamCode::FunkStrumUpStrokeAttenuation))
 					return StatusCode::ParamAlreadySpecified;
@@ -841,7 +1092,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_nFunkStrumUpStrokeAttenuation = ndVal;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::FunkStrumVelDeclineIncrement])
+			else if (sParam == _mParamCodes.at (ParamCode::FunkStrumVelDeclineIncrement))
 			{
 				if (IsParamAlreadySpecified (ParamCode::FunkStrumVelDeclineIncrement))
 					return StatusCode::ParamAlreadySpecified;
@@ -854,7 +1105,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_nFunkStrumVelDeclineIncrement = nVal;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoMelody])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoMelody))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoMelody))
 					return StatusCode::ParamAlreadySpecified;
@@ -868,7 +1119,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				_autoMelodyLineNum = nLineNum;
 				continue;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoRhythmNoteLenBias])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoRhythmNoteLenBias))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoRhythmNoteLenBias))
 					return StatusCode::ParamAlreadySpecified;
@@ -880,7 +1131,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					return StatusCode::InvalidAutoRhythmNoteLenBias;
 				}
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoRhythmGapLenBias])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoRhythmGapLenBias))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoRhythmGapLenBias))
 					return StatusCode::ParamAlreadySpecified;
@@ -892,7 +1143,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					return StatusCode::InvalidAutoRhythmGapLenBias;
 				}
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoRhythmConsecutiveNoteChancePercentage])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoRhythmConsecutiveNoteChancePercentage))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoRhythmConsecutiveNoteChancePercentage))
 					return StatusCode::ParamAlreadySpecified;
@@ -904,7 +1155,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nAutoRhythmConsecutiveNoteChancePercentage = std::stoi (vKeyValue[1]);
 			}
-			else if (sParam == _mParamCodes[ParamCode::AllMelodyNotes])
+			else if (sParam == _mParamCodes.at (ParamCode::AllMelodyNotes))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AllMelodyNotes))
 					return StatusCode::ParamAlreadySpecified;
@@ -916,7 +1167,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_bAllMelodyNotes = nVal == 1;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChordsNumBars])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChordsNumBars))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChordsNumBars))
 					return StatusCode::ParamAlreadySpecified;
@@ -939,7 +1190,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nAutoChordsNumBars = num;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChordsMinorChordBias])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChordsMinorChordBias))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChordsMinorChordBias))
 					return StatusCode::ParamAlreadySpecified;
@@ -969,7 +1220,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					}
 				}
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChordsMajorChordBias])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChordsMajorChordBias))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChordsMajorChordBias))
 					return StatusCode::ParamAlreadySpecified;
@@ -999,7 +1250,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					}
 				}
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChordsShortNoteBiasPercent])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChordsShortNoteBiasPercent))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChordsShortNoteBiasPercent))
 					return StatusCode::ParamAlreadySpecified;
@@ -1011,7 +1262,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nAutoChordsShortNoteBiasPercent = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_maj])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_maj))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_maj))
 					return StatusCode::ParamAlreadySpecified;
@@ -1024,7 +1275,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Major);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_7])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_7))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_7))
 					return StatusCode::ParamAlreadySpecified;
@@ -1037,7 +1288,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Dominant_7th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_maj7])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_maj7))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_maj7))
 					return StatusCode::ParamAlreadySpecified;
@@ -1050,7 +1301,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Major_7th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_9])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_9))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_9))
 					return StatusCode::ParamAlreadySpecified;
@@ -1063,7 +1314,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Dominant_9th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_maj9])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_maj9))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_maj9))
 					return StatusCode::ParamAlreadySpecified;
@@ -1076,7 +1327,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Major_9th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_add9])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_add9))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_add9))
 					return StatusCode::ParamAlreadySpecified;
@@ -1089,7 +1340,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Add_9);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_sus2])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_sus2))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_sus2))
 					return StatusCode::ParamAlreadySpecified;
@@ -1102,7 +1353,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Sus_2);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_7sus2])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_7sus2))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_7sus2))
 					return StatusCode::ParamAlreadySpecified;
@@ -1115,7 +1366,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::_7_Sus_2);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_sus4])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_sus4))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_sus4))
 					return StatusCode::ParamAlreadySpecified;
@@ -1128,7 +1379,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Sus_4);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_7sus4])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_7sus4))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_7sus4))
 					return StatusCode::ParamAlreadySpecified;
@@ -1141,7 +1392,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::_7_Sus_4);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_min])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_min))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_min))
 					return StatusCode::ParamAlreadySpecified;
@@ -1154,7 +1405,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Minor);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_m7])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_m7))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_m7))
 					return StatusCode::ParamAlreadySpecified;
@@ -1167,7 +1418,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Minor_7th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_m9])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_m9))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_m9))
 					return StatusCode::ParamAlreadySpecified;
@@ -1180,7 +1431,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Minor_9th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_madd9])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_madd9))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_madd9))
 					return StatusCode::ParamAlreadySpecified;
@@ -1193,7 +1444,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Minor_Add_9);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_dim7])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_dim7))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_dim7))
 					return StatusCode::ParamAlreadySpecified;
@@ -1206,7 +1457,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Dim_7th);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_dim])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_dim))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_dim))
 					return StatusCode::ParamAlreadySpecified;
@@ -1219,7 +1470,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::Dim);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoChords_CTV_m7b5])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoChords_CTV_m7b5))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoChords_CTV_m7b5))
 					return StatusCode::ParamAlreadySpecified;
@@ -1232,7 +1483,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				uint32_t i = static_cast<uint32_t>(ChordTypeVariation::HalfDim);
 				_vChordTypeVariationFactors[i] = nVal;
 			}
-			else if (sParam == _mParamCodes[ParamCode::WriteOldRuler])
+			else if (sParam == _mParamCodes.at (ParamCode::WriteOldRuler))
 			{
 				if (IsParamAlreadySpecified (ParamCode::WriteOldRuler))
 					return StatusCode::ParamAlreadySpecified;
@@ -1246,7 +1497,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				if (_bWriteOldRuler)
 					sRuler = sRulerOld;
 			}
-			else if (sParam == _mParamCodes[ParamCode::RandomChordReplacementKey])
+			else if (sParam == _mParamCodes.at (ParamCode::RandomChordReplacementKey))
 			{
 				if (IsParamAlreadySpecified (ParamCode::RandomChordReplacementKey))
 					return StatusCode::ParamAlreadySpecified;
@@ -1257,7 +1508,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 					_bRCR = true;
 				}
 			}
-			else if (sParam == _mParamCodes[ParamCode::AutoMelodyDontUsePentatonic])
+			else if (sParam == _mParamCodes.at (ParamCode::AutoMelodyDontUsePentatonic))
 			{
 				if (IsParamAlreadySpecified (ParamCode::AutoMelodyDontUsePentatonic))
 					return StatusCode::ParamAlreadySpecified;
@@ -1269,7 +1520,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_bAutoMelodyDontUsePentatonic = nVal == 1;
 			}
-			else if (sParam == _mParamCodes[ParamCode::ModalInterchangeChancePercentage])
+			else if (sParam == _mParamCodes.at (ParamCode::ModalInterchangeChancePercentage))
 			{
 				// T2015A
 				if (IsParamAlreadySpecified (ParamCode::ModalInterchangeChancePercentage))
@@ -1282,7 +1533,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 				}
 				_nModalInterchangeChancePercentage = std::stoi (vKeyValue[1]);
 			}
-			else if (sParam == _mParamCodes[ParamCode::SYS_RCRHistoryCount])
+			else if (sParam == _mParamCodes.at (ParamCode::SYS_RCRHistoryCount))
 			{
 				if (IsParamAlreadySpecified (ParamCode::SYS_RCRHistoryCount))
 					return StatusCode::ParamAlreadySpecified;
@@ -1304,7 +1555,7 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 			continue;
 		}
 
-		if (sLine.substr (0, 32) == sRulerOld || sLine.substr (0, 31) == sRulerNew.substr (0, 31))
+		if (IsRulerLine (sLine))
 		{
 			// Ruler line. You are able to use either of the two ruler types.
 			// The next two lines should contain
@@ -1409,49 +1660,26 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 	else
 		_nVelocity -= (_nRandVelVariation / 2);	// offset base velocity to allow for upward random variation.
 
-	if (_vChordNames.size() == 0)
+	if (_vChordIds.size() == 0)
 	{
 		_sStatusMessage = "No valid chords specified.";
 		return StatusCode::NoChordsSpecified;
 	}
 
 	// Check we have the same number of chords as note positions
-	if (nNumberOfNotes != _vChordNames.size())
+	if (nNumberOfNotes != _vChordIds.size())
 	{
 		_sStatusMessage = "Number of chords does not match number of notes. (Check your + signs.)";
 		return StatusCode::NumberOfChordsDoesNotMatchNoteCount;
 	}
 
-	// Auto-Melody: If specified, the melody line can include a few instances
-	// of the additional notes from the pentatonic scale of the chord.
-	if (!_bAutoMelodyDontUsePentatonic)
+	// Each note takes the next chord of the progression; a repeat takes the
+	// chord of the note before. (A line's first note is never a repeat.)
+	size_t nChord = 0;
+	for (auto& vSpans : _vLineSpans)
 	{
-		for (int i = 0; i < 2; i++)
-		{
-			// Major chords
-			_mMelodyNotes["maj"].push_back (2);
-			_mMelodyNotes["maj"].push_back (9);
-			_mMelodyNotes["7"].push_back (2);
-			_mMelodyNotes["7"].push_back (9);
-			_mMelodyNotes["maj7"].push_back (2);
-			_mMelodyNotes["maj7"].push_back (9);
-			_mMelodyNotes["9"].push_back (2);
-			_mMelodyNotes["9"].push_back (9);
-			_mMelodyNotes["maj9"].push_back (2);
-			_mMelodyNotes["maj9"].push_back (9);
-			_mMelodyNotes["add9"].push_back (2);
-			_mMelodyNotes["add9"].push_back (9);
-
-			// Minor chords
-			_mMelodyNotes["m"].push_back (5);
-			_mMelodyNotes["m"].push_back (10);
-			_mMelodyNotes["m7"].push_back (5);
-			_mMelodyNotes["m7"].push_back (10);
-			_mMelodyNotes["m9"].push_back (5);
-			_mMelodyNotes["m9"].push_back (10);
-			_mMelodyNotes["madd9"].push_back (5);
-			_mMelodyNotes["madd9"].push_back (10);
-		}
+		for (size_t i = 0; i < vSpans.size(); i++)
+			vSpans[i].nChordId = vSpans[i].bRepeat ? vSpans[i - 1].nChordId : _vChordIds[nChord++];
 	}
 
 	if (_bAllMelodyNotes)
@@ -1461,6 +1689,27 @@ CMIDIHandler::StatusCode CMIDIHandler::VerifyMemFile (const std::vector<std::str
 		_bRandNoteEnd = false;
 	}
 
+	// Multi-part render: apply the channels and track names (default: MIDI
+	// channels 1, 2, 3 and the names of the parts), one per part.
+	if (!_vPartChannels.empty() && _vPartChannels.size() != _vParts.size())
+	{
+		_sStatusMessage = "+PartChannels must have one channel for each of the +Parts.";
+		return StatusCode::InvalidPartChannelsValue;
+	}
+
+	if (!_vPartTrackNames.empty() && _vPartTrackNames.size() != _vParts.size())
+	{
+		_sStatusMessage = "+PartTrackNames must have one name for each of the +Parts.";
+		return StatusCode::InvalidPartTrackNamesValue;
+	}
+
+	for (size_t i = 0; i < _vParts.size(); i++)
+	{
+		_vParts[i].nChannel = _vPartChannels.empty() ? static_cast<uint8_t>(i) : _vPartChannels[i];
+		if (!_vPartTrackNames.empty())
+			_vParts[i].sTrackName = _vPartTrackNames[i];
+	}
+
 
 	return result;
 }
@@ -1480,30 +1729,24 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoRhythm (std::string filen
 
 	//--------------------------------------------------------------------------
 	// Init randomizer vectors
-	auto InitRandVectors = [](std::string s)
+	//
+	// Weights of the lengths 32, 16, 8, 4, 2 and 1 (32nds), from the bias parameter.
+	auto InitLenWeights = [](std::string s)
 	{
 		std::vector<uint32_t> vOut;
 		std::vector<std::string> v = akl::Explode (s, ",");
-		uint32_t nVal = 32;
 		for (uint8_t i = 0; i < 6; i++)
-		{
-			uint32_t nCount = std::stoi (v[i]);
-			for (uint32_t j = 0; j < nCount; j++)
-				vOut.push_back (nVal);
-
-			nVal = nVal >> 1;
-		}
+			vOut.push_back (std::stoi (v[i]));
 		return vOut;
 	};
-	std::vector<uint32_t> vNoteLenChoice = InitRandVectors (_sAutoRhythmNoteLenBias);
-	std::vector<uint32_t> vGapLenChoice = InitRandVectors (_sAutoRhythmGapLenBias);
+	std::vector<uint32_t> vNoteLenWeights = InitLenWeights (_sAutoRhythmNoteLenBias);
+	std::vector<uint32_t> vGapLenWeights = InitLenWeights (_sAutoRhythmGapLenBias);
 
 	std::vector<uint32_t> vNoteOrGap (100);
 	for (uint32_t i = 0; i < _nAutoRhythmConsecutiveNoteChancePercentage; i++)
 		vNoteOrGap[i] = 1;
 	//--------------------------------------------------------------------------
 
-	std::uniform_int_distribution<uint32_t> randNoteOrGap (0, vNoteOrGap.size() - 1);
 
 	// Lambda: Serves to return a length value for either a note position or a gap.
 	//
@@ -1515,23 +1758,37 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoRhythm (std::string filen
 	// be possible, if another chord follows in the same bar, there won't be enough room
 	// for a whole note. maxLen reflects this.
 	//
-	// vChoice: The vector of numbers representing the choice of random values possible.
-	auto RandLen = [&](uint8_t maxNoteLen, uint8_t maxLen, std::vector<uint32_t> vChoice)
+	// vWeights: The weights of the lengths 32, 16, 8, 4, 2 and 1.
+	//
+	// Only the lengths that fit are drawn from. If none of them has any weight, the
+	// longest that fits is used.
+	auto RandLen = [&](uint8_t maxNoteLen, uint8_t maxLen, const std::vector<uint32_t>& vWeights)
 	{
-		uint32_t nIndex = 0;
-		for (uint32_t i = 0; i < vChoice.size(); i++)
+		uint8_t nLimit = (std::min) (maxNoteLen, maxLen);
+
+		uint32_t nTotal = 0;
+		for (uint8_t i = 0; i < 6; i++)
 		{
-			if (vChoice[i] == maxNoteLen)
-			{
-				nIndex = i;
-				break;
-			}
+			if ((32 >> i) <= nLimit)
+				nTotal += vWeights[i];
+		}
+
+		uint8_t nLen = 32;
+		while (nLen > nLimit)
+			nLen >>= 1;
+
+		if (nTotal == 0)
+			return nLen;
+
+		uint32_t nPick = _rng.Below (nTotal);
+		for (uint8_t i = 0; i < 6; i++)
+		{
+			if ((32 >> i) > nLimit)
+				continue;
+			if (nPick < vWeights[i])
+				return static_cast<uint8_t>(32 >> i);
+			nPick -= vWeights[i];
 		}
-		std::uniform_int_distribution<uint32_t> randChoice (nIndex, vChoice.size() - 1);
-		uint8_t nLen;
-		do
-			nLen = vChoice[randChoice (_eng)];
-		while (nLen > maxLen);
 
 		return nLen;
 	};
@@ -1588,7 +1845,7 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoRhythm (std::string filen
 
 				// Randomize whether to create a note, or a gap.
 				// *Always* place note at start of bar.
-				bNoteOn = j == nStart ? 1 : vNoteOrGap[randNoteOrGap (_eng)];
+				bNoteOn = j == nStart ? 1 : vNoteOrGap[_rng.Below (static_cast<uint32_t>(vNoteOrGap.size()))];
 
 				// NB. No consecutive gaps. Consecutive notes, yes, (if _sAutoRhythmNoteChancePercentage non-zero)
 				// but not gaps. Sussing this was a bit improvement. So remember, Andrew, a value of zero fof
@@ -1604,7 +1861,7 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoRhythm (std::string filen
 				if (nLargestNoteLen == 1)
 					bNoteOn = false;
 
-				uint8_t nl = RandLen (nLargestNoteLen, maxLen, bNoteOn ? vNoteLenChoice : vGapLenChoice);
+				uint8_t nl = RandLen (nLargestNoteLen, maxLen, bNoteOn ? vNoteLenWeights : vGapLenWeights);
 
 				// Output the note/gap chars.
 				uint32_t m = j + nl;
@@ -1628,8 +1885,7 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoRhythm (std::string filen
 		std::string comma;
 		for (auto c : vChordRepCount)
 		{
-			_vChordNames[nChordNameIndex] += "(" + std::to_string (c) + ")";
-			newChordList += comma + _vChordNames[nChordNameIndex];
+			newChordList += comma + _vChordSymbols[_vChordIds[nChordNameIndex]].sName + "(" + std::to_string (c) + ")";
 			comma = ", ";
 			nChordNameIndex++;
 		}
@@ -1687,8 +1943,7 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoChords (std::string filen
 
 	// T2015A
 	_bRCR = false;
-	InitChordBank (_vChordNames[0]);
-	std::uniform_int_distribution<uint16_t> randModInt (0, 99);
+	InitChordBank (_vChordSymbols[_vChordIds[0]].sName);
 
 	//--------------------------------------------------------------------------
 	// Output copy of the input file with the generated rhythm.
@@ -1723,7 +1978,7 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoChords (std::string filen
 				// Object that generates the random rhythm pattern, specifying a short note
 				// bias percentage (0 means no short notes; 100 means _all_ short notes).
 				// (Short notes being 16 32nds or shorter.)
-				CAutoRhythm autoRhythm (_nAutoChordsShortNoteBiasPercent);
+				CAutoRhythm autoRhythm (_nAutoChordsShortNoteBiasPercent, _rng);
 				uint32_t nNoteCount;
 				std::string sPattern = autoRhythm.GetPattern (nNoteCount, nNumBarsPerLine * 32);
 
@@ -1734,18 +1989,12 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoChords (std::string filen
 				for (uint32_t k = 0; k < nNoteCount; k++)
 				{
 					// T2015A Which chord bank to use - the main one or the Modal Interchange one.
-					uint16_t iRandModInt = randModInt (_eng);
+					uint16_t iRandModInt = static_cast<uint16_t>(_rng.Below (100));
 					uint8_t iCB = _vChordBankChoice[iRandModInt];
 
-					// This sets the chosen random chord in the CChordBank object;
-					// you then have to interrogate it to retrieve the actual chord value.
-					_vChordBank[iCB]->SetRandomChord();
-
-					// Now apply a possible random chord type variation.
-					std::string sChordVar = _vChordBank[iCB]->GetChordVariation();
-
-					std::string sChordName = _vChordBank[iCB]->GetChordName();
-					ofs << sComma << sChordName << sChordVar;
+					// A chord, with a possible random chord type variation.
+					CChordBank::ChordId chordId = _vChordBank[iCB]->PickChord();
+					ofs << sComma << _vChordBank[iCB]->GetChordName (chordId);
 					sComma = ", ";
 				}
 				ofs << std::endl;
@@ -1764,32 +2013,27 @@ CMIDIHandler::StatusCode CMIDIHandler::CopyFileWithAutoChords (std::string filen
 	return nRes;
 }
 
-CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile, std::string outFile, bool bOverwriteOutFile)
+CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile, std::string outFile, bool bOverwriteOutFile,
+	const MIDIImportOptions& options)
 {
 	StatusCode nRes = StatusCode::Success;
 
-	struct NoteEvent
-	{
-		bool bOn;
-		uint16_t nTime;
-		uint16_t nNoteNum;
-
-		NoteEvent (bool bOn_, uint16_t t, uint16_t n) : bOn (bOn_), nTime (t), nNoteNum (n) {}
-	};
-	std::vector<NoteEvent> vNoteEvents;
-
 	// T2O4GU Holds chord details that have been extracted from MIDI file.
 	struct ChordDetails
 	{
-		uint16_t nStart;    // where the chord begins, in 1/32nds.
-		uint16_t nEnd;
-		std::vector<uint16_t> vNoteNumber;   // eg. 60 = C3
+		uint32_t nStart;		// where the chord begins, in 1/32nds.
+		uint32_t nEnd;
+		uint8_t nBass;			// Lowest note, eg. 60 = C3
+		uint16_t nPitchClasses;	// Bit n set if pitch class n (0 = C) is in the chord.
+
+		ChordDetails (uint32_t nS, uint32_t nE, uint8_t nNote)
+			: nStart (nS), nEnd (nE), nBass (nNote), nPitchClasses (1 << (nNote % 12)) {}
 
-		ChordDetails (uint16_t nS, uint16_t nE, uint16_t nNote)
+		void AddNote (uint8_t nNote)
 		{
-			nStart = nS;
-			nEnd = nE;
-			vNoteNumber.push_back (nNote);
+			nPitchClasses |= 1 << (nNote % 12);
+			if (nNote < nBass)
+				nBass = nNote;
 		}
 	};
 	std::vector<ChordDetails> vChordDetails;  // List of chords.
@@ -1800,306 +2044,238 @@ CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile,
 	//      2 = Minimize: From last Note On to first Note Off, ie. length of overlap of all notes.
 	int chordLengthType = 0;
 
-    std::string chunkType (4, '\0');
-    uint32_t n32;
-    uint16_t n16;
-    uint16_t nNumberTracks = 0;
-
-    auto Swap32 = [](uint32_t n)
+    CSMFReader smf;
+    if (!smf.Open (inFile))
     {
-        return (((n >> 24) & 0xff) | ((n << 8) & 0xff0000) | ((n >> 8) & 0xff00) | ((n << 24) & 0xff000000));
-    };
+        _sStatusMessage = "MIDI file invalid for this operation. " + smf.GetStatusMessage();
+        return StatusCode::InvalidMIDIFile;
+    }
 
-    auto Swap16 = [](uint16_t n)
+    // Format:
+    //      0 = single track
+    //      1 = one or more simultaneous tracks
+    //      2 = one or more sequential indepedent single-track patterns.
+    //
+    // Division must be in ticks per quarter note (not SMPTE).
+    uint16_t nDivision = smf.GetDivision();
+    if (smf.GetFormat() > 2 || nDivision == 0 || (nDivision & 0x8000))
     {
-        return ((n >> 8) | (n << 8));
-    };
+        std::ostringstream ss;
+        ss << "MIDI file invalid for this operation. Unsupported MIDI file format or time division.";
+        _sStatusMessage = ss.str();
+        return StatusCode::InvalidMIDIFile;
+    }
 
-    // Assembles a variable-length variable (from the track buffer)
-    auto ReadValue = [](std::vector<char> vBuf, uint32_t& pos)
+    if (options.nTrack > smf.GetNumTracks())
     {
-        uint32_t nValue = 0;
-        uint8_t nByte = 0;
+        std::ostringstream ss;
+        ss << "MIDI file invalid for this operation. Track " << options.nTrack
+            << " requested, but the file has only " << smf.GetNumTracks() << " track(s).";
+        _sStatusMessage = ss.str();
+        return StatusCode::InvalidMIDIFile;
+    }
 
-        nValue = vBuf[pos++];
+    // Tracks to be converted.
+    std::vector<uint16_t> vTracks;
+    for (uint16_t nTrack = 0; nTrack < smf.GetNumTracks(); nTrack++)
+    {
+        if (options.nTrack == -1 || options.nTrack == nTrack + 1)
+            vTracks.push_back (nTrack);
+    }
 
-        if (nValue & 0x80)
-        {
-            // Extract bottom 7 bits of byte
-            nValue &= 0x7F;
+	// Notes, in Note On order. Note Offs are paired with their Note Ons as the
+	// track is read: vPendingNote[channel * 128 + key] heads a chain (through
+	// iNextPending) of the notes still sounding on that key. A Note Off ends
+	// all of them.
+	struct Note
+	{
+		uint32_t nStart;		// ticks
+		uint32_t nEnd;
+		uint8_t nNoteNum;
+		bool bEnded;
+		int32_t iNextPending;	// Next still-sounding note on the same key, or -1.
+	};
 
-            do
-            {
-                // Next byte
-                nByte = vBuf[pos++];
+	// Each track is decoded independently of the others.
+	struct TrackNotes
+	{
+		std::vector<Note> vNotes;
+		uint32_t nEndTime = 0;	// Time of last event (End Of Track), in ticks.
+		bool bError = false;
+	};
+	std::vector<TrackNotes> vTrackNotes (vTracks.size());
 
-                // Construct value by setting bottom 7 bits, then shifting 7 bits.
-                nValue = (nValue << 7) | (nByte & 0x7F);
+	auto DecodeTrack = [&smf, &options](uint16_t nTrack, TrackNotes& t)
+	{
+		std::vector<Note>& vNotes = t.vNotes;
+		std::vector<int32_t> vPendingNote (16 * 128, -1);
 
-            } while (nByte & 0x80);
+		auto NoteOn = [&](uint32_t nTime, uint8_t nChannel, uint8_t nNoteNum)
+		{
+			int32_t& iPending = vPendingNote[nChannel * 128 + nNoteNum];
+			vNotes.push_back ({ nTime, 0, nNoteNum, false, iPending });
+			iPending = static_cast<int32_t>(vNotes.size() - 1);
+		};
 
-        }
+		auto NoteOff = [&](uint32_t nTime, uint8_t nChannel, uint8_t nNoteNum)
+		{
+			int32_t& iPending = vPendingNote[nChannel * 128 + nNoteNum];
+			for (int32_t i = iPending; i != -1; i = vNotes[i].iNextPending)
+			{
+				vNotes[i].nEnd = nTime;
+				vNotes[i].bEnded = true;
+			}
+			iPending = -1;
+		};
 
-        return nValue;
-    };
+		CSMFReader::TrackReader track = smf.GetTrack (nTrack);
 
-    auto ReadString = [](std::vector<char> vBuf, uint32_t nLen, uint32_t& pos)
-    {
-        std::string s (vBuf.begin() + pos, vBuf.begin() + pos + nLen);
-        pos += nLen;
-        s.erase (s.find_last_not_of ('\0') + 1);            // strip trailing nulls
-        s.erase (s.find_last_not_of (" \t\n\r\f\v") + 1);   // strip trailing whitespace
-        return s;
-    };
+		// For the purposes of interpreting MIDI clips for conversion
+		// to SMFFTI command lines, we're interested in only a few
+		// relevant MIDI events...
+		CSMFReader::Event ev;
+		while (track.NextEvent (ev))
+		{
+			t.nEndTime = ev.nTime;
 
-    // Convert, say, 5 to "0000000000000101"
-    auto BitString8 = [](uint8_t n)
-    {
-        std::string x;
-        for (int i = 7; i >= 0; i--)
-        {
-            char a = n & (1 << i) ? '1' : '0';
-            x += a;
-        }
-        return x;
-    };
+			uint8_t nType = ev.GetType();
+			if (nType != (uint8_t)EventName::NoteOff && nType != (uint8_t)EventName::NoteOn)
+				continue;
 
-	std::ifstream ifs (inFile, std::fstream::in | std::ios::binary);
+			if (options.nChannel != -1 && ev.GetChannel() != options.nChannel - 1)
+				continue;
 
-    // ------------------------------------------------------------------------------
-    // HEADER CHUNK
-    ifs.read (&chunkType[0], 4);
-    if (chunkType == "MThd")
-    {
-        // get length of header - should be 6.
-        ifs.read ((char*)&n32, 4);
-        uint32_t hdrLen = Swap32 (n32);
-
-        // Header data consists of 3 words:
-        //
-        //  1. Format:
-        //      0 = single track
-        //      1 = one or more simultaneous tracks
-        //      2 = one or more sequential indepedent single-track patterns.
-        //
-        //  2. No. Tracks
-        //
-        //  3. Divsion, which specifies meaning of delta-times:
-        //
-        //       bit 15       bits 14 thru 8             bits 7 thru 0
-        //         0          ------- ticks per quarter note ---------
-        //         1          negative SMPTE format      ticks per frame
-
-        ifs.read ((char*)&n16, 2);
-        uint16_t nFileFormat = Swap16 (n16);
-
-		// Only single track files allowed.
-		if (nFileFormat != 0)
-		{
-			std::ostringstream ss;
-			ss << "MIDI file invalid for this operation. Only single-track MIDI files can be used.";
-			_sStatusMessage = ss.str();
-			return StatusCode::InvalidMIDIFile;
+			// Note On with zero velocity is a Note Off.
+			if (nType == (uint8_t)EventName::NoteOff || ev.nData2 == 0)
+				NoteOff (ev.nTime, ev.GetChannel(), ev.nData1 & 0x7F);
+			else
+				NoteOn (ev.nTime, ev.GetChannel(), ev.nData1 & 0x7F);
 		}
 
-        ifs.read ((char*)&n16, 2);
-        nNumberTracks = Swap16 (n16);
-
-        ifs.read ((char*)&n16, 2);
-        uint16_t nDivision = Swap16 (n16);
-    }
+		t.bError = track.Error();
+	};
 
     // ------------------------------------------------------------------------------
     // TRACK CHUNKS
-    for (uint16_t nTrack = 0; nTrack < nNumberTracks; nTrack++)
+    // Large multi-track files are decoded by several threads, each taking the
+    // next track until all are done. Small files aren't worth the thread start-up.
+    size_t nTrackBytes = 0;
+    for (uint16_t nTrack : vTracks)
+        nTrackBytes += smf.GetTrackData (nTrack).size();
+
+    uint32_t nWorkers = 1;
+    if (vTracks.size() > 1 && nTrackBytes >= 256 * 1024)
+        nWorkers = static_cast<uint32_t>((std::min<size_t>) ((std::max) (1u, std::thread::hardware_concurrency()), vTracks.size()));
+
+    std::atomic<size_t> nNext (0);
+    auto Worker = [&]()
     {
-        ifs.read (&chunkType[0], 4);
-        if (chunkType == "MTrk")
-        {
-            // get length of track data.
-            ifs.read ((char*)&n32, 4);
-            uint32_t trkLen = Swap32 (n32);
+        for (size_t i = nNext++; i < vTracks.size(); i = nNext++)
+            DecodeTrack (vTracks[i], vTrackNotes[i]);
+    };
+
+    std::vector<std::thread> vThreads;
+    for (uint32_t i = 1; i < nWorkers; i++)
+        vThreads.emplace_back (Worker);
 
-            // Read all track data into buffer.
-            std::vector<char> trackBuf (trkLen);
-            ifs.read (&trackBuf[0], trkLen);
+    Worker();
 
-            uint32_t offset = 0;
+    for (auto& t : vThreads)
+        t.join();
 
-            // Now we're dealing with a series of <delta-time><event> pairs.
-            bool bEndOfTrack = false;
-            uint8_t nPreviousStatus = 0;
+    for (size_t i = 0; i < vTracks.size(); i++)
+    {
+        if (vTrackNotes[i].bError)
+        {
+            std::ostringstream ss;
+            ss << "MIDI file invalid for this operation. Track " << vTracks[i] + 1 << " is corrupt or truncated.";
+            _sStatusMessage = ss.str();
+            return StatusCode::InvalidMIDIFile;
+        }
+    }
 
-            uint32_t nTotalTime = 0;
+    // Merge the tracks' notes. Format 2 tracks are independent patterns, so
+    // each follows on from the end of the previous one; otherwise all tracks
+    // start at time zero, and notes from different tracks are interleaved in
+    // time order (notes at the same time remain in track order).
+    std::vector<Note> vNotes;
+    if (vTrackNotes.size() == 1)
+        vNotes.swap (vTrackNotes[0].vNotes);
+    else
+    {
+        size_t nNumNotes = 0;
+        uint32_t nTracksWithNotes = 0;
+        for (const auto& t : vTrackNotes)
+        {
+            nNumNotes += t.vNotes.size();
+            nTracksWithNotes += t.vNotes.empty() ? 0 : 1;
+        }
+        vNotes.reserve (nNumNotes);
 
-            while (offset < trkLen && !bEndOfTrack)
+        uint32_t nOffset = 0;
+        for (const auto& t : vTrackNotes)
+        {
+            for (Note note : t.vNotes)
             {
-                uint32_t nDeltaTime = 0;
-                uint8_t nStatus = 0;    // Event type, ie. MIDI, SysEx or Meta.
-
-                // Delta-time is variable length.
-                nDeltaTime = ReadValue (trackBuf, offset);
-
-                nTotalTime += nDeltaTime;
-
-                nStatus = trackBuf[offset++];
-                
-                // "Running Status": There might not always be a status value -
-                // we apply the previous one. Revert the offset in order to read
-                // the event data.
-                if (nStatus < 0x80)
-                {
-                    nStatus = nPreviousStatus;
-                    offset--;
-                }
-
-				// For the purposes of interpreting MIDI clips for conversion
-				// to SMFFTI command lines, we're interested in only a few
-				// relevant MIDI events...
-                if ((nStatus & 0xF0) == (uint8_t)EventName::NoteOff)
-                {
-                    nPreviousStatus = nStatus;
-                    uint16_t nChannel = nStatus & 0x0F;
-                    uint16_t nNoteId = trackBuf[offset++];
-                    uint16_t nNoteVelocity = trackBuf[offset++];
-
-                    // Add to events vector.
-                    vNoteEvents.push_back (NoteEvent (false, nTotalTime, nNoteId));
-                }
-                else if ((nStatus & 0xF0) == (uint8_t)EventName::NoteOn)
-                {
-                    nPreviousStatus = nStatus;
-                    uint16_t nChannel = nStatus & 0x0F;
-                    uint16_t nNoteId = trackBuf[offset++];
-                    uint16_t nNoteVelocity = trackBuf[offset++];
-
-                    // Add to events vector.
-                    vNoteEvents.push_back (NoteEvent (true, nTotalTime, nNoteId));
-                }
-                else if ((nStatus & 0xF0) == (uint8_t)EventName::SysEx)
-                {
-                    nPreviousStatus = nStatus;
-
-                    if (nStatus == 0xFF)
-                    {
-                        // Meta Message
-                        uint8_t nType = trackBuf[offset++];
-                        uint8_t nLength = ReadValue(trackBuf, offset);
-
-                        if (nType == (uint8_t)MetaEventName::MetaSequence)
-                        {
-                            // What is the byte-order of this 16-bit integer?
-                            // Assume LSB, so swap bytes.
-                            uint8_t nLSB = trackBuf[offset++];
-                            uint8_t nMSB = trackBuf[offset++];
-                            uint16_t nValue = (nMSB << 8) | nLSB;
-                        }
-                        else if (nType == (uint8_t)MetaEventName::MetaTrackName)
-                        {
-                            std::string sText = ReadString (trackBuf, nLength, offset);
-                        }
-                        else if (nType == (uint8_t)MetaEventName::MetaEndOfTrack)
-                        {
-                            bEndOfTrack = true;
-                            continue;
-                        }
-                        else if (nType == (uint8_t)MetaEventName::MetaTimeSignature)
-                        {
-                            uint16_t nn = trackBuf[offset++];
-                            uint16_t x = trackBuf[offset];
-                            uint16_t dd = (1 << trackBuf[offset++]);
-                            uint16_t cc = trackBuf[offset++];
-                            uint16_t bb = trackBuf[offset++];
-                        }
-                        else
-                        {
-                            // Unknown meta event.
-                            offset += nLength;
-                        }
-                    }
-                }
-                else
-                {
-                    std::cout << "Unrecognised Event Type: " << BitString8 (nStatus) << std::endl;
-                }
+                note.nStart += nOffset;
+                note.nEnd += nOffset;
+                vNotes.push_back (note);
             }
 
-            // check if EOF reached.
-            if (ifs.peek() == EOF)
-                int ak = 1;
+            if (smf.GetFormat() == 2)
+                nOffset += t.nEndTime;
+        }
+
+        if (smf.GetFormat() != 2 && nTracksWithNotes > 1)
+        {
+            std::stable_sort (vNotes.begin(), vNotes.end(),
+                [](const Note& a, const Note& b) { return a.nStart < b.nStart; });
         }
     }
-    ifs.close();
 
-    // Now parse the Note Event list to identify when each note starts and ends.
-    uint32_t iEvent = 0;
-    while (iEvent < vNoteEvents.size())
+    // The start and end of notes in the chord may be slightly offset, so they
+    // are quantized to 1/32nds (eg. 12 ticks per 1/32nd at 96 ticks per quarter).
+    float fTicksPer32nd = nDivision / 8.0f;
+
+    // Group the notes into chords, in Note On order. "Chord" is defined as any
+    // group of notes which overlap.
+    for (const auto& note : vNotes)
     {
-        // Our primary objective is to locate when notes begin.
-        if (vNoteEvents[iEvent].bOn == false)
-        {
-            iEvent++;
+        if (!note.bEnded)
             continue;
-        }
 
-        // Now read forward to find where this note ends.
-        for (uint32_t i = iEvent + 1; i < vNoteEvents.size(); i++)
+        // Quantize start and end of notes to 1/32nds in order to group notes into chords.
+        float fStart = std::ceil ((note.nStart / fTicksPer32nd) - 0.6f);
+        float fEnd = std::ceil ((note.nEnd / fTicksPer32nd) - 0.6f);
+
+        uint32_t nStart = (uint32_t)fStart;
+        uint32_t nEnd = (uint32_t)fEnd;
+
+        // A note that starts outside a chord begins the next one, so chords
+        // never overlap, and only the latest chord can take this note.
+        if (vChordDetails.size() && nStart >= vChordDetails.back().nStart && nStart < vChordDetails.back().nEnd)
         {
-            // Here we ignore Note On events.
-            if (vNoteEvents[i].bOn)
-                continue;
-            
-            if (vNoteEvents[i].nNoteNum == vNoteEvents[iEvent].nNoteNum)
+            // Add this note to the chord
+            ChordDetails& chord = vChordDetails.back();
+            chord.AddNote (note.nNoteNum);
+
+            if (chordLengthType == 1)
+            {
+                // Maximize
+                if (nEnd > chord.nEnd)
+                    chord.nEnd = nEnd;
+            }
+            else if (chordLengthType == 2)
             {
-                // The start and end of notes in the chord may be slightly offset,
-                // so quantize start and end of notes to 1/32nds (12 ticks per 1/32nd)
-                // in order to group notes into chords.
-                float fStart = std::ceil ((vNoteEvents[iEvent].nTime / 12.0f) - 0.6f);
-                float fEnd = std::ceil ((vNoteEvents[i].nTime / 12.0f) - 0.6f);
-                //float fLen = fEnd - fStart;
-
-                uint32_t nStart = (uint32_t)fStart;
-                uint32_t nEnd = (uint32_t)fEnd;
-                //uint32_t nLen = (uint32_t)fLen;
-
-                // See if vChordDetails already has any notes for this "chord".
-                // "Chord" is defined as any group of notes which overlap.
-                bool bExistingChord = false;
-                for (std::vector<ChordDetails>::iterator it = vChordDetails.begin(); it < vChordDetails.end(); it++)
-            	{
-                    if (nStart >= it->nStart && nStart < it->nEnd)
-                    {
-                        // Yes, it does, so add this note to the chord
-                        bExistingChord = true;
-                        it->vNoteNumber.push_back (vNoteEvents[iEvent].nNoteNum);
-
-                        if (chordLengthType == 1)
-                        {
-                            // Maximize
-                            if (nEnd > it->nEnd)
-                                it->nEnd = nEnd;
-                        }
-                        else if (chordLengthType == 2)
-                        {
-                            // Minimize
-                            it->nStart = nStart;
-                            if (nEnd < it->nEnd)
-                                it->nEnd = nEnd;
-                        }
-
-                        break;
-                    }
-                }
-
-                if (!bExistingChord)
-                    vChordDetails.push_back (ChordDetails (nStart, nEnd, vNoteEvents[i].nNoteNum));
-
-                break;
+                // Minimize
+                chord.nStart = nStart;
+                if (nEnd < chord.nEnd)
+                    chord.nEnd = nEnd;
             }
         }
-
-        iEvent++;
-    };
+        else
+            vChordDetails.push_back (ChordDetails (nStart, nEnd, note.nNoteNum));
+    }
 
     // Output the chords in SMFFTI format.
 	if (!bOverwriteOutFile && akl::MyFileExists (outFile))
@@ -2111,79 +2287,16 @@ CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile,
 		return StatusCode::OutputFileAlreadyExists;
 	}
 
-	// Convert notes to relative note intervals.
-	// eg. From "60, 63, 67" to "0, 3, 7".
-	auto SetNoteZeroOffset = [](std::vector<uint16_t>& vNoteIntervals)
-    {
-		uint16_t nLowestNote = vNoteIntervals[0];
-		for (uint16_t i = 0; i < vNoteIntervals.size(); i++)
-			vNoteIntervals[i] -= nLowestNote;
-    };
-
 	std::vector<char> vOutStrChordPos;
 	std::vector<std::string> vChordName;
 	uint32_t n32ndPos = 0;
 
-	// For the sake of identifying chord types, we need to ensure
-	// all notes are contained within a single octave, so here we
-	// do some necessary downward transposing.
-	_mChordTypes["9"] = "2,4,7,10";
-	_mChordTypes["maj9"] = "2,4,7,11";
-	_mChordTypes["add9"] = "2,4,7";
-	_mChordTypes["m9"] = "2,3,7,10";
-	_mChordTypes["madd9"] = "2,3,7";
-
 	// Loop through chords in the progression.
-    for each (auto c in vChordDetails)
+    for (const auto& c : vChordDetails)
     {
-		// Sort the notes from lowest to highest.
-		// vNotes is used to identify the chord TYPE.
-		std::vector<uint16_t> vNotes (c.vNoteNumber);
-		std::sort (vNotes.begin(), vNotes.end());
-
-		// Remove all duplicate notes, ie. same note one or more octaves higher.
-		uint16_t iStartNote = 0;
-		while (iStartNote < vNotes.size() - 1)
-		{
-			bool bDuplicate = false;
-			uint16_t n1 = vNotes[iStartNote] % 12;
-			for (uint16_t i = iStartNote + 1; i < vNotes.size(); i++)
-			{
-				uint16_t n2 = vNotes[i] % 12;
-				if (n1 == n2)
-				{
-					vNotes.erase (vNotes.begin() + iStartNote);
-					bDuplicate = true;
-					break;
-				}
-			}
-
-			if (!bDuplicate)
-				iStartNote++;
-		}
-
-		// Second copy of notes vector which is used to identify the chord NAME.
-		std::vector<uint16_t> vNotes2 (vNotes);
-
-		// Check if the notes, in their current order, match a chord type...
-		std::string sChordType;
-		bool bMinor;
-		for (int i = 0; i < 10; i++)	// max 10 attempt, easily plenty
-		{
-			SetNoteZeroOffset (vNotes);
-			sChordType = IsValidChordType (vNotes, bMinor);
-			if (sChordType.length())
-				break;
-
-			// No match yet, so transpose the lowest note up an octave and try again.
-			vNotes[0] += 12;
-			std::sort (vNotes.begin(), vNotes.end());
-			vNotes2.push_back (vNotes2[0] + 12);
-			vNotes2.erase (vNotes2.begin());
-			std::sort (vNotes2.begin(), vNotes2.end());
-		}
-
-		if (sChordType.length() == 0)
+		// Identify the chord from its pitch-class set (relative to the bass note).
+		uint8_t nRoot, nType;
+		if (!IdentifyChord (c.nBass, c.nPitchClasses, nRoot, nType))
 		{
 			// Abort
 			std::ostringstream ss;
@@ -2193,21 +2306,12 @@ CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile,
 		}
 
 		// Hack: We don't need "maj" appearing for major chords.
+		std::string sChordType = _vChordTypeInfo[nType].sName;
 		if (sChordType == "maj")
 			sChordType = "";
 
 		// Identify the name of the chord.
-		uint16_t nRoot = (vNotes2[0] % 12);
-		std::string sRoot;
-		for (const auto& pair : _mChromaticScale2)
-		{
-			if (nRoot == pair.second)
-			{
-				sRoot = pair.first;
-				break;
-			}
-		}
-		std::string sChordName = sRoot + sChordType;
+		std::string sChordName = _vPitchClassNames[nRoot] + sChordType;
 
 
 		// Now append chord position/name to output strings.
@@ -2262,7 +2366,7 @@ CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile,
 	auto CountOccurrences = [](const std::string& str, const std::string& target)
 	{
 		uint32_t count = 0;
-		uint32_t pos = 0;
+		size_t pos = 0;
 		while ((pos = str.find(target, pos)) != std::string::npos)
 		{
 			count++;
@@ -2324,93 +2428,273 @@ CMIDIHandler::StatusCode CMIDIHandler::ConvertMIDIToSMFFTI (std::string inFile,
 
 std::string CMIDIHandler::IsValidChordType (const std::vector<uint16_t>& vNotes, bool& bMinor)
 {
+	// vNotes are intervals from the root, eg. "0, 3, 7".
 	std::string sChordType = "";
 	bMinor = false;
 
-	std::string comma = "";
-	std::ostringstream ss;
-	for (uint16_t i = 1; i < vNotes.size(); i++)
+	uint8_t nRoot, nType;
+	if (IdentifyChord (vNotes, nRoot, nType) && nRoot == vNotes[0] % 12)
 	{
-		ss << comma << vNotes[i];
-		comma = ",";
+		sChordType = _vChordTypeInfo[nType].sName;
+		bMinor = _mChordTypesInOctave.at (sChordType)[0] == '3';
 	}
-	std::string sIntervals = ss.str();
 
-	for (const auto& pair : _mChordTypes)
-	{
-		if (sIntervals == pair.second)
-		{
-			sChordType = pair.first;
+	return sChordType;
+}
 
-			if (sIntervals[0] == '3')
-				bMinor = true;
+bool CMIDIHandler::IdentifyChord (const std::vector<uint16_t>& vNotes, uint8_t& nRootPitchClass, uint8_t& nType)
+{
+	if (vNotes.empty())
+		return false;
 
-			break;
-		}
-    }
+	uint16_t nBass = *std::min_element (vNotes.begin(), vNotes.end());
 
-	return sChordType;
+	uint16_t nPitchClasses = 0;
+	for (auto n : vNotes)
+		nPitchClasses |= 1 << (n % 12);
+
+	return IdentifyChord (static_cast<uint8_t>(nBass), nPitchClasses, nRootPitchClass, nType);
 }
 
+bool CMIDIHandler::IdentifyChord (uint8_t nBass, uint16_t nPitchClasses, uint8_t& nRootPitchClass, uint8_t& nType)
+{
+	// Rotate the pitch classes so that the bass is bit 0. (The bass is the
+	// lowest note, even if its pitch class is doubled higher up.)
+	uint8_t nBassPitchClass = nBass % 12;
+	uint16_t nMask = ((nPitchClasses >> nBassPitchClass) | (nPitchClasses << (12 - nBassPitchClass))) & 0xFFF;
+
+	const PitchClassSetEntry& entry = _vPitchClassSets[nMask];
+	if (entry.nType == 0xFF)
+		return false;
 
-CMIDIHandler::StatusCode CMIDIHandler::GenRandMelodies (std::string filename, bool bOverwriteOutFile)
+	nRootPitchClass = (nBassPitchClass + entry.nRootOffset) % 12;
+	nType = entry.nType;
+	return true;
+}
+
+
+CMIDIHandler::StatusCode CMIDIHandler::GenRandMelodies (std::string filename, bool bOverwriteOutFile,
+	const RandMelodyOptions& options)
 {
-	StatusCode nRes = StatusCode::Success;
+	if (options.nMelodies == 0 || options.nNotes == 0 || options.vScale.empty()
+		|| std::any_of (options.vScale.begin(), options.vScale.end(), [](uint8_t n) { return n > 24; }))
+	{
+		_sStatusMessage = "Invalid random melody options.";
+		return StatusCode::InvalidRandMelodyOptions;
+	}
 
-	if (!bOverwriteOutFile && akl::MyFileExists (filename))
+	// With shards, eg. melodies.txt becomes melodies_1.txt, melodies_2.txt ...
+	uint32_t nShards = (std::max) (1u, (std::min) (options.nShards, options.nMelodies));
+	std::vector<std::string> vFiles;
+	if (nShards == 1)
+		vFiles.push_back (filename);
+	else
 	{
-		std::ostringstream ss;
-		ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
-			<< "SMFFTI.exe -grm generic_rand_melodies.txt -o";
-		_sStatusMessage = ss.str();
-		return StatusCode::OutputFileAlreadyExists;
+		for (uint32_t i = 0; i < nShards; i++)
+			vFiles.push_back (akl::NumberedFileName (filename, i + 1));
 	}
 
-	// Major Pentatonic intervals. Since SMFFTI auto-corrects notes according to whether
-	// they are in major or minor key, we don't have to worry about specifying the
-	// Minor Pentatonic for this operation.
-	std::vector<uint8_t> vNotes = { 0, 2, 4, 7, 9 };
-	std::uniform_int_distribution<uint32_t> randNote (0, vNotes.size() - 1);
+	for (const auto& sFile : vFiles)
+	{
+		if (!bOverwriteOutFile && akl::MyFileExists (sFile))
+		{
+			std::ostringstream ss;
+			ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
+				<< "SMFFTI.exe -grm generic_rand_melodies.txt -o";
+			_sStatusMessage = ss.str();
+			return StatusCode::OutputFileAlreadyExists;
+		}
+	}
 
-	std::ofstream ofs (filename, std::ios::out);
+	// The default scale is Major Pentatonic. Since SMFFTI auto-corrects notes according
+	// to whether they are in major or minor key, we don't have to worry about specifying
+	// the Minor Pentatonic for this operation.
+	//
+	// Each note is copied in from its text, eg. ", 7" (without the ", " for the first
+	// note of a melody), instead of being formatted by the stream.
+	std::vector<std::string> vNoteText;
+	size_t nMaxNoteText = 0;
+	for (auto n : options.vScale)
+	{
+		vNoteText.push_back (", " + std::to_string (n));
+		nMaxNoteText = (std::max) (nMaxNoteText, vNoteText.back().size());
+	}
+	uint32_t nNumNotes = static_cast<uint32_t>(vNoteText.size());
 
-	ofs << "# Generic Randomized Melody lines. Generated by SMFFTI (-grm) at "
-		<< akl::TimeStamp() << "\n\n";
+	// "#Melody <n>\nM: <notes>\n\n"
+	const size_t nMaxMelodyText = 32 + options.nNotes * nMaxNoteText;
 
-	for (size_t i = 0; i < 1000; i++)
+	// Melodies are generated a chunk at a time by each worker, into buffers that are
+	// allocated up front. While one set of chunks is being written to the file (in
+	// order, with a single write per chunk), the workers fill the other set.
+	struct Chunk
 	{
-		ofs << "#Melody " << i << "\nM: ";
-		std::string comma;
-		for (size_t j = 0; j < 64; j++)
+		std::vector<char> vText;
+		size_t nSize = 0;
+		uint32_t nFirst = 0;
+		uint32_t nEnd = 0;
+	};
+
+	const uint32_t nChunkMelodies = 2048;
+	uint32_t nWorkers = options.nThreads ? options.nThreads : (std::max) (1u, std::thread::hardware_concurrency());
+	nWorkers = (std::min) (nWorkers, (options.nMelodies + nChunkMelodies - 1) / nChunkMelodies);
+
+	std::vector<Chunk> vChunks (2 * nWorkers);
+	for (auto& chunk : vChunks)
+		chunk.vText.resize ((std::min) (nChunkMelodies, options.nMelodies) * nMaxMelodyText);
+
+	// Each melody has its own stream, so the melodies are the same for a given seed,
+	// whatever the number of threads or shards.
+	const uint64_t nSeed = _rng.GetSeed();
+
+	auto FillChunk = [&](Chunk& chunk)
+	{
+		char* p = chunk.vText.data();
+		for (uint32_t i = chunk.nFirst; i < chunk.nEnd; i++)
 		{
-			uint16_t rn = vNotes[randNote (_eng)];
-			ofs << comma << rn;
-			comma = ", ";
+			CRandom rng (nSeed, i);
+
+			std::memcpy (p, "#Melody ", 8);
+			p = std::to_chars (p + 8, p + 19, i).ptr;
+			std::memcpy (p, "\nM: ", 4);
+			p += 4;
+
+			for (uint32_t j = 0; j < options.nNotes; j++)
+			{
+				const std::string& sNote = vNoteText[rng.Below (nNumNotes)];
+				size_t nSkip = (j == 0) ? 2 : 0;
+				std::memcpy (p, sNote.data() + nSkip, sNote.size() - nSkip);
+				p += sNote.size() - nSkip;
+			}
+
+			std::memcpy (p, "\n\n", 2);
+			p += 2;
 		}
-		ofs << "\n\n";
-	}
+		chunk.nSize = p - chunk.vText.data();
+	};
 
-	ofs.close();
+	std::string sHeader = "# Generic Randomized Melody lines. Generated by SMFFTI (-grm) at "
+		+ akl::TimeStamp() + "\n\n";
 
-	return nRes;
+	for (uint32_t nShard = 0; nShard < nShards; nShard++)
+	{
+		std::ofstream ofs (vFiles[nShard], std::ios::out);
+		if (!ofs.is_open())
+		{
+			_sStatusMessage = "Unable to write output file " + vFiles[nShard] + ".";
+			return StatusCode::UnableToWriteOutputFile;
+		}
+
+		ofs.write (sHeader.data(), sHeader.size());
+
+		// Melodies keep their numbers across shards.
+		uint32_t nNext = static_cast<uint32_t>(static_cast<uint64_t>(options.nMelodies) * nShard / nShards);
+		uint32_t nEnd = static_cast<uint32_t>(static_cast<uint64_t>(options.nMelodies) * (nShard + 1) / nShards);
+
+		std::thread writer;
+		for (uint32_t nSet = 0; nNext < nEnd; nSet ^= 1)
+		{
+			Chunk* pSet = &vChunks[nSet * nWorkers];
+			uint32_t nSetChunks = 0;
+			for (; nSetChunks < nWorkers && nNext < nEnd; nSetChunks++)
+			{
+				pSet[nSetChunks].nFirst = nNext;
+				nNext = (std::min) (nEnd, nNext + nChunkMelodies);
+				pSet[nSetChunks].nEnd = nNext;
+			}
+
+			std::vector<std::thread> vThreads;
+			for (uint32_t i = 1; i < nSetChunks; i++)
+				vThreads.emplace_back (FillChunk, std::ref (pSet[i]));
+
+			FillChunk (pSet[0]);
+
+			for (auto& t : vThreads)
+				t.join();
+
+			if (writer.joinable())
+				writer.join();
+
+			writer = std::thread ([&ofs, pSet, nSetChunks]()
+			{
+				for (uint32_t i = 0; i < nSetChunks; i++)
+					ofs.write (pSet[i].vText.data(), pSet[i].nSize);
+			});
+		}
+
+		if (writer.joinable())
+			writer.join();
+
+		ofs.close();
+		if (ofs.fail())
+		{
+			_sStatusMessage = "Unable to write output file " + vFiles[nShard] + ".";
+			return StatusCode::UnableToWriteOutputFile;
+		}
+	}
+
+	return StatusCode::Success;
 }
 
 CMIDIHandler::StatusCode CMIDIHandler::CreateMIDIFile (const std::string& filename, bool bOverwriteOutFile)
 {
-	std::ofstream ofs;
+	if (!bOverwriteOutFile && akl::MyFileExists (filename))
+	{
+		std::ostringstream ss;
+		ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
+			<< "SMFFTI.exe midicmds.txt MyMIDIFile.mid -o";
+		_sStatusMessage = ss.str();
+		return StatusCode::OutputFileAlreadyExists;
+	}
+
+	// The track is written to the file as it is generated, rather than
+	// building the whole file in memory first.
+	CSMFStreamWriter smf;
+	uint16_t nNumTracks = static_cast<uint16_t>((std::max<size_t>) (1, _vParts.size()));
+	if (!smf.Open (filename, _vParts.empty() ? 0 : 1, nNumTracks, _ticksPerQtrNote))
+	{
+		_sStatusMessage = smf.GetStatusMessage();
+		return StatusCode::UnableToWriteOutputFile;
+	}
 
-	StatusCode nRes = InitMidiFile (ofs, filename, bOverwriteOutFile);
+	StatusCode nRes = InitMidiFile();
 	if (nRes != StatusCode::Success)
 		return nRes;
 
+	_pStreamWriter = &smf;
+	smf.BeginTrack();
+
 	GenerateNoteEvents();
+	FinishNoteEvents();
+
+	// Multi-part: the other tracks were streamed to temporary files, which
+	// follow the first.
+	ForEachPart ([&]()
+	{
+		if (_nActivePart == 0)
+			smf.EndTrack (_trackWriter);
+		else
+			smf.WriteSpooledTrack (_nActivePart, _trackWriter);
+	});
+	_pStreamWriter = nullptr;
+
+	if (!smf.Close())
+	{
+		_sStatusMessage = smf.GetStatusMessage();
+		return StatusCode::UnableToWriteOutputFile;
+	}
 
-	FinishMidiFile (ofs);
+	if (_bAutoMelody)
+	{
+		std::ofstream ofsMelody (_sMelodySaveFile, std::ios::out);
+		ofsMelody << _sMelodyText;
+		ofsMelody.close();
+	}
 
 	if (_bRCR)
 	{
 		// Update file with state value that remembers the count of RCR history records.
-		std::string sParam = "+" + _mParamCodes[ParamCode::SYS_RCRHistoryCount] + "=" + 
+		std::string sParam = "+" + _mParamCodes.at (ParamCode::SYS_RCRHistoryCount) + "=" + 
 			std::to_string (_nRCRHistoryCount);
 		SetParameter (_vInputCopy, sParam);
 
@@ -2420,208 +2704,565 @@ CMIDIHandler::StatusCode CMIDIHandler::CreateMIDIFile (const std::string& filena
 	return nRes;
 }
 
-CMIDIHandler::StatusCode CMIDIHandler::InitMidiFile (std::ofstream& ofs, const std::string& filename, bool bOverwriteOutFile)
+CMIDIHandler::StatusCode CMIDIHandler::CreateMIDIBuffer (std::vector<uint8_t>& vMIDI)
 {
-	StatusCode nRes = StatusCode::Success;
+	StatusCode nRes = InitMidiFile();
+	if (nRes != StatusCode::Success)
+		return nRes;
 
-	if (!bOverwriteOutFile && akl::MyFileExists (filename))
+	GenerateNoteEvents();
+	FinishNoteEvents();
+
+	FinishMidiFile (vMIDI);
+
+	return nRes;
+}
+
+CMIDIHandler::StatusCode CMIDIHandler::CreateSectionedMIDIBuffer (const std::vector<std::string>& vFile,
+	std::vector<uint8_t>& vMIDI)
+{
+	_vSections.clear();
+	if (!SplitSections (vFile, _vHeaderLines, _vSections) || _vSections.size() != _vNotePositions.size())
 	{
-		std::ostringstream ss;
-		ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
-			<< "SMFFTI.exe midicmds.txt MyMIDIFile.mid -o";
-		_sStatusMessage = ss.str();
-		return StatusCode::OutputFileAlreadyExists;
+		// Can't be updated section by section; just render it.
+		_vSections.clear();
+		return CreateMIDIBuffer (vMIDI);
 	}
 
-	ofs.open (filename, std::ios::binary);
+	StatusCode nRes = InitMidiFile();
+	if (nRes != StatusCode::Success)
+		return nRes;
 
-	//-------------------------------------------------------------------------
-	// HEADER
-	ofs << "MThd";
+	// As GenerateNoteEvents, but counting each section's notes and chords.
+	_nNoteCount = -1;
+	for (size_t nItem = 0; nItem < _vSections.size(); nItem++)
+	{
+		const std::vector<NoteSpan>& vSpans = _vLineSpans[nItem];
+		_vSections[nItem].nNotes = vSpans.size();
+		_vSections[nItem].nChords = std::count_if (vSpans.begin(), vSpans.end(),
+			[](const NoteSpan& span) { return !span.bRepeat; });
+		_nNoteCount += (int32_t)vSpans.size();
+	}
+
+	uint32_t nBar = GetFirstBar();
+	int32_t nNote = -1;
+	for (size_t nItem = 0; nItem < _vSections.size(); nItem++)
+	{
+		GenerateSectionEvents (nItem, nBar, nNote);
+		nBar += _vBarCount[nItem];
+		nNote += (int32_t)_vSections[nItem].nNotes;
+	}
+	_nSectionsRegenerated = _vSections.size();
+
+	RenderSections (vMIDI);
+
+	return nRes;
+}
+
+bool CMIDIHandler::UpdateMIDIBuffer (const std::vector<std::string>& vFile, std::vector<uint8_t>& vMIDI)
+{
+	if (_vSections.empty())
+		return false;
+
+	std::vector<std::string> vHeader;
+	std::vector<Section> vNew;
+	if (!SplitSections (vFile, vHeader, vNew) || vHeader != _vHeaderLines)
+		return false;
+
+	// The sections that are unchanged, at the start and at the end.
+	size_t nOld = _vSections.size();
+	size_t nNew = vNew.size();
+	size_t nSame = (std::min) (nOld, nNew);
+	size_t nPrefix = 0;
+	while (nPrefix < nSame && vNew[nPrefix].vLines == _vSections[nPrefix].vLines)
+		nPrefix++;
+	size_t nSuffix = 0;
+	while (nPrefix + nSuffix < nSame && vNew[nNew - 1 - nSuffix].vLines == _vSections[nOld - 1 - nSuffix].vLines)
+		nSuffix++;
+
+	// Verify each changed section by itself, with the parameters.
+	std::vector<std::unique_ptr<CMIDIHandler>> vVerified;
+	for (size_t i = nPrefix; i < nNew - nSuffix; i++)
+	{
+		std::vector<std::string> vSectionFile (vHeader);
+		vSectionFile.insert (vSectionFile.end(), vNew[i].vLines.begin(), vNew[i].vLines.end());
+
+		// A section whose verification draws random numbers (eg. RandomGroove)
+		// would draw other numbers than in a full render.
+		auto pMidiH = std::make_unique<CMIDIHandler> (_sInputFile);
+		if (_bSeedSet)
+			pMidiH->SetSeed (_rng.GetSeed());
+		if (pMidiH->VerifyMemFile (vSectionFile) != StatusCode::Success || pMidiH->_vNotePositions.size() != 1
+			|| pMidiH->UsedRandomNumbers())
+			return false;
+
+		vNew[i].nNotes = pMidiH->_vLineSpans[0].size();
+		vNew[i].nChords = pMidiH->_vChordIds.size();
+
+		// Its chord ids, as ids in this handler's table.
+		std::vector<uint16_t> vIds (pMidiH->_vChordSymbols.size());
+		for (size_t j = 0; j < vIds.size(); j++)
+		{
+			const ChordSymbol& symbol = pMidiH->_vChordSymbols[j];
+			if (!InternChord (symbol.sName, symbol.spec, vIds[j]))
+				return false;
+		}
+		for (auto& nId : pMidiH->_vChordIds)
+			nId = vIds[nId];
+		for (auto& span : pMidiH->_vLineSpans[0])
+			span.nChordId = vIds[span.nChordId];
+
+		vVerified.push_back (std::move (pMidiH));
+	}
+
+	// Replace the changed sections, and their note data.
+	size_t nFirstChord = 0;
+	for (size_t i = 0; i < nPrefix; i++)
+		nFirstChord += _vSections[i].nChords;
+	size_t nEndChord = nFirstChord;
+	for (size_t i = nPrefix; i < nOld - nSuffix; i++)
+		nEndChord += _vSections[i].nChords;
+
+	_vChordIds.erase (_vChordIds.begin() + nFirstChord, _vChordIds.begin() + nEndChord);
+	_vNotePositions.erase (_vNotePositions.begin() + nPrefix, _vNotePositions.end() - nSuffix);
+	_vLineSpans.erase (_vLineSpans.begin() + nPrefix, _vLineSpans.end() - nSuffix);
+	_vBarCount.erase (_vBarCount.begin() + nPrefix, _vBarCount.end() - nSuffix);
+	_vSections.erase (_vSections.begin() + nPrefix, _vSections.end() - nSuffix);
+
+	size_t nChord = nFirstChord;
+	for (size_t i = 0; i < vVerified.size(); i++)
+	{
+		CMIDIHandler& midiH = *vVerified[i];
+		size_t nItem = nPrefix + i;
+		_vChordIds.insert (_vChordIds.begin() + nChord, midiH._vChordIds.begin(), midiH._vChordIds.end());
+		_vNotePositions.insert (_vNotePositions.begin() + nItem, midiH._vNotePositions[0]);
+		_vLineSpans.insert (_vLineSpans.begin() + nItem, std::move (midiH._vLineSpans[0]));
+		_vBarCount.insert (_vBarCount.begin() + nItem, midiH._vBarCount[0]);
+		_vSections.insert (_vSections.begin() + nItem, std::move (vNew[nItem]));
+		nChord += _vSections[nItem].nChords;
+	}
+	_nNoteCount = -1;
+	for (const Section& section : _vSections)
+		_nNoteCount += (int32_t)section.nNotes;
+
+	// Regenerate the new sections. With random offsets, the first and last
+	// sections also depend on where they are (see AddMIDIChordNoteEvents).
+	// Sections that moved have other random number streams (see
+	// GenerateLineNoteEvents) too.
+	size_t nEnd = nPrefix + vVerified.size();
+	if (nNew != nOld && UsedRandomNumbers())
+		nEnd = _vSections.size();
+	InitMidiFile();
+	_nSectionsRegenerated = 0;
+	uint32_t nBar = GetFirstBar();
+	int32_t nNote = -1;
+	for (size_t nItem = 0; nItem < _vSections.size(); nItem++)
+	{
+		if ((nItem >= nPrefix && nItem < nEnd)
+			|| (nItem == 0 && _bRandNoteStart && nPrefix == 0)
+			|| (nItem == _vSections.size() - 1 && _bRandNoteEnd && nSuffix == 0))
+		{
+			GenerateSectionEvents (nItem, nBar, nNote);
+			_nSectionsRegenerated++;
+		}
+
+		nBar += _vBarCount[nItem];
+		nNote += (int32_t)_vSections[nItem].nNotes;
+	}
+
+	RenderSections (vMIDI);
+
+	return true;
+}
+
+bool CMIDIHandler::SplitSections (const std::vector<std::string>& vFile, std::vector<std::string>& vHeader,
+	std::vector<Section>& vSections) const
+{
+	vHeader.clear();
+	vSections.clear();
+
+	for (const auto& sLine : vFile)
+	{
+		if (IsRulerLine (sLine))
+			vSections.emplace_back();
+
+		if (vSections.empty())
+		{
+			vHeader.push_back (sLine);
+			continue;
+		}
+
+		// A comment block could span sections.
+		if (sLine.find ("(#") != std::string::npos || sLine.find ("#)") != std::string::npos)
+			return false;
+
+		vSections.back().vLines.push_back (sLine);
+	}
+
+	return !vSections.empty();
+}
+
+void CMIDIHandler::GenerateSectionEvents (size_t nSection, uint32_t nBar, int32_t nNote)
+{
+	// (In watch mode, the melody text isn't saved.)
+	std::ostringstream ofs;
+	GenerateLineNoteEvents (nSection, nBar, nNote, ofs);
+
+	// Move the events out of each part's event list (where they are the only
+	// ones). Times before the start of the section wrap around, which
+	// RenderSections undoes.
+	uint32_t nStart = nBar * 32 * _ticksPer32nd;
+	Section& section = _vSections[nSection];
+	section.vPartEvents.resize ((std::max<size_t>) (1, _vParts.size()));
+	ForEachPart ([&]()
+	{
+		for (MIDINote& note : _vMIDINoteEvents)
+			note.nTime -= nStart;
 
-	_nVal32 = Swap32 (6);	// Header length; always 6
-	ofs.write (reinterpret_cast<char*>(&_nVal32), sizeof (uint32_t));
+		section.vPartEvents[_nActivePart].swap (_vMIDINoteEvents);
+		_vMIDINoteEvents.clear();
+	});
+}
 
-	_nVal16 = Swap16 (0);	// Format 0: Single, multi-channel track
-	ofs.write (reinterpret_cast<char*>(&_nVal16), sizeof (uint16_t));
+void CMIDIHandler::RenderSections (std::vector<uint8_t>& vMIDI)
+{
+	InitMidiFile();
 
-	_nVal16 = Swap16 (1);	// Number of tracks; alwys 1 if format 0.
-	ofs.write (reinterpret_cast<char*>(&_nVal16), sizeof (uint16_t));
+	uint32_t nBar = GetFirstBar();
+	uint32_t nMaxBackwardOffset = GetMaxBackwardOffset();
+	for (size_t nItem = 0; nItem < _vSections.size(); nItem++)
+	{
+		uint32_t nStart = nBar * 32 * _ticksPer32nd;
+		const Section& section = _vSections[nItem];
+		ForEachPart ([&]()
+		{
+			for (const MIDINote& note : section.vPartEvents[_nActivePart])
+			{
+				_vMIDINoteEvents.push_back (note);
+				_vMIDINoteEvents.back().nTime += nStart;
+			}
+		});
 
-	_nVal16 = Swap16 (_ticksPerQtrNote);	// Division: 96 ticks per 1/4 noteBit 15=0, bits 14-0 = 96
-	ofs.write (reinterpret_cast<char*>(&_nVal16), sizeof (uint16_t));
+		// As GenerateNoteEvents.
+		nBar += _vBarCount[nItem];
+		uint32_t nNextLineStart = nBar * 32 * _ticksPer32nd;
+		FlushNoteEvents (nNextLineStart > nMaxBackwardOffset ? nNextLineStart - nMaxBackwardOffset : 0);
+	}
+
+	FinishNoteEvents();
+	FinishMidiFile (vMIDI);
+}
+
+CMIDIHandler::StatusCode CMIDIHandler::Render (const std::string& sInFile, const std::string& sOutFile,
+	bool bOverwriteOutFile, std::string& sStatusMessage)
+{
+	CMIDIHandler midiH (sInFile);
+
+	StatusCode nRes = midiH.VerifyFile();
+	if (nRes == StatusCode::Success)
+		nRes = midiH.CreateMIDIFile (sOutFile, bOverwriteOutFile);
+
+	sStatusMessage = midiH.GetStatusMessage();
+	return nRes;
+}
+
+CMIDIHandler::StatusCode CMIDIHandler::Render (const std::vector<std::string>& vCommandFile,
+	std::vector<uint8_t>& vMIDI, std::string& sStatusMessage)
+{
+	CMIDIHandler midiH ("");
+
+	StatusCode nRes = midiH.VerifyMemFile (vCommandFile);
+	if (nRes == StatusCode::Success)
+		nRes = midiH.CreateMIDIBuffer (vMIDI);
+
+	sStatusMessage = midiH.GetStatusMessage();
+	return nRes;
+}
+
+CMIDIHandler::StatusCode CMIDIHandler::InitMidiFile()
+{
+	StatusCode nRes = StatusCode::Success;
 
 	//-------------------------------------------------------------------------
-	// ONE AND ONLY TRACK
+	// ONE AND ONLY TRACK (or, multi-part, one track per part)
 	//
 	// It's a series of <delta-time><event> pairs.
-	// We push all track chunk data into a vector byte buffer first, before writing to file.
-
-	//---------------------------------------
-	// Meta-event: Track Name
-	PushVariableValue (0);	// Delta-time is variable length.
-	PushInt8 (0xFF);
-	PushInt8 ((uint8_t)MetaEventName::MetaTrackName);
-	PushVariableValue (_sTrackName.length());
-	PushText (_sTrackName);
-
-	//---------------------------------------
-	// Event 2: Meta-event: Time signature
-	PushVariableValue (0);
-	PushInt8 (0xFF);
-	PushInt8 ((uint8_t)MetaEventName::MetaTimeSignature);
-	PushVariableValue (4);	// Data length.
-	PushInt8 (4);	// 4 beats to the bar.
-	PushInt8 (2);	// Negative power of 2, eg. 2 is a 1/4 note, 4 is 1/8th note.
-	PushInt8 (36);	// No. MIDI clocks per metronome click.
-	PushInt8 (8);	// No. 1/32nd notes per MIDI 1/4 note.
+	// We push all track chunk data into the track writer first; the header
+	// is put in front of it by FinishMidiFile, or (CreateMIDIFile) it is
+	// written to the file as it goes.
+	// (After an earlier render, the state of another part may still be selected.)
+	if (!_vParts.empty())
+		SelectPart (0);
+	_nActivePart = 0;
+	_nPartType = _vParts.empty() ? PartType::All : _vParts[0].nType;
+	_nChannel = _vParts.empty() ? 0 : _vParts[0].nChannel;
+
+	ForEachPart ([&]()
+	{
+		_trackWriter.Clear();
+		_vMIDINoteEvents.clear();
+		_nPrevEventTime = 0;
+		InitNoteStages();
+
+		//---------------------------------------
+		// Meta-event: Track Name
+		const std::string& sTrackName = _vParts.empty() ? _sTrackName : _vParts[_nActivePart].sTrackName;
+		_trackWriter.MetaEvent (0, (uint8_t)MetaEventName::MetaTrackName, sTrackName.data(), sTrackName.length());
+
+		//---------------------------------------
+		// Event 2: Meta-event: Time signature (first track only)
+		if (_nActivePart == 0)
+		{
+			const uint8_t timeSig[4] = {
+				4,		// 4 beats to the bar.
+				2,		// Negative power of 2, eg. 2 is a 1/4 note, 4 is 1/8th note.
+				36,		// No. MIDI clocks per metronome click.
+				8 };	// No. 1/32nd notes per MIDI 1/4 note.
+			_trackWriter.MetaEvent (0, (uint8_t)MetaEventName::MetaTimeSignature, timeSig, sizeof (timeSig));
+		}
+	});
 
 	return nRes;
 }
 
-void CMIDIHandler::FinishMidiFile (std::ofstream& ofs)
+void CMIDIHandler::InitNoteStages()
 {
-	if (_bRandNoteStart || _bRandNoteEnd)
-		SortNoteEventsAndFixOverlaps();
+	_vNoteStages.clear();
 
-	if (_nNoteStagger)
-		ApplyNoteStagger();
-
-	if (_nArpeggiator)
-		ApplyArpeggiation();
-
-	PushNoteEvents();
+	auto AddStage = [&](NoteStageFn pfnProcess)
+	{
+		_vNoteStages.emplace_back();
+		_vNoteStages.back().pfnProcess = pfnProcess;
+	};
 
-	// Meta-event: End Of Track
-	PushVariableValue (0);
-	PushInt8 (0xFF);
-	PushInt8 ((uint8_t)MetaEventName::MetaEndOfTrack);
-	PushVariableValue (0);
+	if (_bRandNoteStart || _bRandNoteEnd)
+		AddStage (&CMIDIHandler::FixRandomOffsetOverlaps);
 
-	// Write track chunk to file.
-	ofs << "MTrk";
-	_nVal32 = Swap32 (_vTrackBuf.size());
-	ofs.write (reinterpret_cast<char*>(&_nVal32), sizeof (uint32_t));	// Chunk length.
-	ofs.write ((char*)&_vTrackBuf[0], _vTrackBuf.size());				// Chunk data.
+	if (_nNoteStagger && IsChordPart())
+		AddStage (&CMIDIHandler::StaggerChordNotes);
 
-	ofs.close();
+	if (_nArpeggiator && IsChordPart())
+	{
+		AddStage (&CMIDIHandler::ArpeggiateChords);
+		AddStage (&CMIDIHandler::FixArpeggioOverlaps);
+	}
 }
 
-std::string CMIDIHandler::GetRandomGroove (bool& bRandomGroove)
+void CMIDIHandler::RunNoteStages (uint32_t nHorizon)
 {
-	// Randomly construct the note positions by building a
-	// string something like "+### +#   +### +#".
+	auto IsBeforeHorizon = [&](const MIDINote& note) { return note.nTime < nHorizon; };
 
-	// Init for dynamic construction.
-	std::string sNotePositions;
+	// The output of each stage is the input of the next.
+	for (NoteStage& stage : _vNoteStages)
+	{
+		stage.vIn.insert (stage.vIn.end(), _vMIDINoteEvents.begin(), _vMIDINoteEvents.end());
+		_vMIDINoteEvents.clear();
+		SortNoteEvents (stage.vIn);
 
-	// Get the current number of bars to populate.
-	uint32_t nNumBars = _vBarCount.back();
+		size_t nUsed = (this->*stage.pfnProcess) (stage, nHorizon);
+		stage.vIn.erase (stage.vIn.begin(), stage.vIn.begin() + nUsed);
 
-	// Lambda func to return random note length
-	auto RandNoteLen = [](std::vector<int> v, size_t& nNum16ths)
+		// Output yet to be made from the input still held can't come before
+		// that input, so its output is final up to there.
+		if (!stage.vIn.empty())
+			nHorizon = (std::min) (nHorizon, stage.vIn.front().nTime);
+
+		auto itFinal = std::partition_point (stage.vOut.begin(), stage.vOut.end(), IsBeforeHorizon);
+		_vMIDINoteEvents.assign (stage.vOut.begin(), itFinal);
+		stage.vOut.erase (stage.vOut.begin(), itFinal);
+	}
+
+	size_t nFinal = std::partition_point (_vMIDINoteEvents.begin(), _vMIDINoteEvents.end(), IsBeforeHorizon)
+		- _vMIDINoteEvents.begin();
+	PushNoteEvents (nFinal);
+	_vMIDINoteEvents.erase (_vMIDINoteEvents.begin(), _vMIDINoteEvents.begin() + nFinal);
+}
+
+void CMIDIHandler::FinishNoteEvents()
+{
+	ForEachPart ([&]()
 	{
-		// Note length:
-		// 0 = off, 1 = 1/16th, 2 = 1/8th, 3 = 3/8ths, 4 = 1/4
-		std::uniform_int_distribution<size_t> randNoteLen (0, v.size() - 1);
-		nNum16ths = v[randNoteLen (_eng)];
-		std::string x = "  ";	// blank 1/16th
-		if (nNum16ths > 0)
-			x = std::string ("+#######").substr (0, nNum16ths * 2);
-		else
-			nNum16ths = 1;	// for blank note still must register a 1/16th note
-		return x;
-	};
+		RunNoteStages (UINT32_MAX);
 
-	// Lambda
-	auto BuildNotePositionString = [&]()
+		// Meta-event: End Of Track
+		_trackWriter.EndOfTrack();
+	});
+}
+
+void CMIDIHandler::FlushNoteEvents (uint32_t nHorizon)
+{
+	ForEachPart ([&]()
 	{
-		sNotePositions = "";
+		RunNoteStages (nHorizon);
 
-		// Iterate in 1/16th increments
-		uint32_t nNum16ths = nNumBars * 16;
-		std::string sNoteLen;
-		size_t nNoteLen16ths = 0;
-		size_t i = 0;
-		while (i < nNum16ths)
+		// Only the first track can go straight to the file; the others are
+		// spooled until it ends.
+		if (_pStreamWriter && _trackWriter.GetData().size() >= _nStreamFlushBytes)
 		{
-			if (i % 4 == 0)
-			{
-				// 1/4 note position
-				// We pass in a weighted list - favours shorter length
-				sNoteLen = RandNoteLen ({ 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 4 }, nNoteLen16ths);	// any of the note lengths
-			}
-			else if (i % 2 == 0)
-			{
-				// 1/8th note position
-				sNoteLen = RandNoteLen ({ 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2 }, nNoteLen16ths);	// Off, 1/16th, 1/8th or 3/8ths
-			}
+			if (_nActivePart == 0)
+				_pStreamWriter->WriteTrackData (_trackWriter);
 			else
-			{
-				// Odd-numbered 1/16th note position,
-				// ie. an upstroke.
-				sNoteLen = RandNoteLen ({ 0, 0, 0, 0, 0, 1, 1, 1, 1 }, nNoteLen16ths);		// Off or 1/16th
-			}
-
-			sNotePositions += sNoteLen;
-			i += nNoteLen16ths;	// advance counter according to determined note len.
-			int ak = 1;
+				_pStreamWriter->SpoolTrackData (_nActivePart, _trackWriter);
 		}
-	};
+	});
+}
 
-	bRandomGroove = true;
+void CMIDIHandler::SelectPart (size_t nPart)
+{
+	if (nPart == _nActivePart)
+		return;
 
-	// Validate the string
-	while (1)
+	SwapPartState (_vParts[_nActivePart]);
+	SwapPartState (_vParts[nPart]);
+
+	_nActivePart = nPart;
+	_nPartType = _vParts[nPart].nType;
+	_nChannel = _vParts[nPart].nChannel;
+}
+
+void CMIDIHandler::SwapPartState (Part& part)
+{
+	std::swap (_vMIDINoteEvents, part.vMIDINoteEvents);
+	std::swap (_trackWriter, part.trackWriter);
+	std::swap (_nPrevEventTime, part.nPrevEventTime);
+	std::swap (_vNoteStages, part.vNoteStages);
+}
+
+void CMIDIHandler::FinishMidiFile (std::vector<uint8_t>& vMIDI)
+{
+	size_t nSize = 14;
+	ForEachPart ([&]() { nSize += 8 + _trackWriter.GetData().size(); });
+
+	vMIDI.clear();
+	vMIDI.reserve (nSize);
+
+	//-------------------------------------------------------------------------
+	// HEADER
+	const char* pChunkType = "MThd";
+	vMIDI.insert (vMIDI.end(), pChunkType, pChunkType + 4);
+
+	// Format 0: Single, multi-channel track; 1: Multi-part, a track per part.
+	uint16_t nNumTracks = static_cast<uint16_t>((std::max<size_t>) (1, _vParts.size()));
+	CTrackWriter::Append32 (vMIDI, 6);		// Header length; always 6
+	CTrackWriter::Append16 (vMIDI, _vParts.empty() ? 0 : 1);
+	CTrackWriter::Append16 (vMIDI, nNumTracks);		// Number of tracks; alwys 1 if format 0.
+	CTrackWriter::Append16 (vMIDI, _ticksPerQtrNote);	// Division: 96 ticks per 1/4 noteBit 15=0, bits 14-0 = 96
+
+	//-------------------------------------------------------------------------
+	// Track chunk(s).
+	ForEachPart ([&]() { _trackWriter.AppendChunk (vMIDI); });
+}
+
+std::string CMIDIHandler::GetRandomGroove (bool& bRandomGroove)
+{
+	// Randomly construct the note positions by building a
+	// string something like "+### +#   +### +#".
+
+	// Get the current number of 1/16ths to populate.
+	const uint32_t nNum16ths = _vBarCount.back() * 16;
+
+	// Note length chances, by position in the beat:
+	// 0 = off, 1 = 1/16th, 2 = 1/8th, 3 = 3/16ths, 4 = 1/4
+	// Favours shorter lengths.
+	const size_t nNumLens = 5;
+	static const double aLenChance[3][nNumLens] = {
+		{ 3 / 11.0, 3 / 11.0, 3 / 11.0, 1 / 11.0, 1 / 11.0 },	// 1/4 note position: any of the note lengths
+		{ 5 / 12.0, 4 / 12.0, 3 / 12.0, 0, 0 },					// 1/8th note position: Off, 1/16th or 1/8th
+		{ 5 / 9.0, 4 / 9.0, 0, 0, 0 } };						// Odd-numbered 1/16th, ie. an upstroke: Off or 1/16th
+	auto LenChance = [](uint32_t i, size_t nLen)
 	{
-		BuildNotePositionString();
+		return aLenChance[i % 4 == 0 ? 0 : (i % 2 == 0 ? 1 : 2)][nLen];
+	};
 
-		// Too many consecutive 1/16ths
-		size_t pos = sNotePositions.find ("+#+#+#+#");
-		if (pos != std::string::npos)
-			continue;
+	// Filter state after a note of nLen (or 1/16th off) from nState; -1 if
+	// the note completes one of the patterns a groove mustn't contain.
+	auto NextState = [](int8_t nState, size_t nLen)
+	{
+		if (nLen == 0)
+			return _vGrooveFilter[nState].aNext[2];
 
-		// No big gaps, ie. 3/8th or larger.
-		pos = sNotePositions.find ("      ");
-		if (pos != std::string::npos)
-			continue;
+		nState = _vGrooveFilter[nState].aNext[0];
+		for (size_t k = 1; k < nLen && nState >= 0; k++)
+			nState = _vGrooveFilter[nState].aNext[1];
+		return nState;
+	};
 
-		// No consecutive 1/4 notes.
-		pos = sNotePositions.find ("+#######+#######");
-		if (pos != std::string::npos)
-			continue;
+	// Each length is drawn with its chance of being drawn, and of the rest of
+	// the string then being acceptable. That gives each acceptable string the
+	// chance it would have if whole strings were drawn until one is
+	// acceptable, in a bounded time. vAccept[i * nStates + nState]: the
+	// chance that the 1/16ths from i on are acceptable.
+	const size_t nStates = _vGrooveFilter.size();
+	std::vector<double> vAccept ((nNum16ths + 1) * nStates, 0.0);
+	std::fill (vAccept.end() - nStates, vAccept.end(), 1.0);
+	auto LenWeight = [&](uint32_t i, int8_t nState, size_t nLen)
+	{
+		double dChance = LenChance (i, nLen);
+		int8_t nNext = NextState (nState, nLen);
+		uint32_t nEnd = i + (nLen ? static_cast<uint32_t>(nLen) : 1);
+		if (dChance == 0.0 || nNext < 0 || nEnd > nNum16ths)
+			return 0.0;
+		return dChance * vAccept[nEnd * nStates + nNext];
+	};
+	for (uint32_t i = nNum16ths; i-- > 0;)
+	{
+		for (size_t nState = 0; nState < nStates; nState++)
+		{
+			double dAccept = 0.0;
+			for (size_t nLen = 0; nLen < nNumLens; nLen++)
+				dAccept += LenWeight (i, static_cast<int8_t>(nState), nLen);
+			vAccept[i * nStates + nState] = dAccept;
+		}
+	}
 
-		// No more than two consecutive 1/8th notes
-		pos = sNotePositions.find ("+###+###+###");
-		if (pos != std::string::npos)
-			continue;
+	std::string sNotePositions;
+	int8_t nState = 0;
+	uint32_t i = 0;
+	while (i < nNum16ths)
+	{
+		// (The last possible length is taken if rounding leaves dPick over.)
+		double dPick = _rng.Uniform() * vAccept[i * nStates + nState];
+		size_t nLen = 0;
+		for (size_t n = 0; n < nNumLens; n++)
+		{
+			double dWeight = LenWeight (i, nState, n);
+			if (dWeight == 0.0)
+				continue;
+
+			nLen = n;
+			dPick -= dWeight;
+			if (dPick < 0.0)
+				break;
+		}
 
-		break;
+		// A blank 1/16th still takes up a 1/16th.
+		sNotePositions += nLen ? std::string ("+#######").substr (0, nLen * 2) : "  ";
+		nState = NextState (nState, nLen);
+		i += nLen ? static_cast<uint32_t>(nLen) : 1;
 	}
 
+	bRandomGroove = true;
 
 	return sNotePositions;
 }
 
 void CMIDIHandler::GenerateNoteEvents()
 {
-	// Double parse of the note positions. First time through counts the notes
-	// and extends the chord list where chord repititions are played (ie. spaces
-	// between hashes). Second parse produces the list (vector) of MIDI note events.
-	// Its' done like this because we need to ascertain the full number of notes
-	// played *before* calling AddMIDIChordNoteEvents.
-
-	// If randomized note start enabled, prefix with an additional bar
-	// to allow for note commencing *before* the notional start position.
-	uint16_t nBar = _bRandNoteStart && (!_bRandNoteOffsetTrim) ? 1 : 0;
+	// One pass over the notes that VerifyMemFile compiled for each note position
+	// line (_vLineSpans), which already have their chords, repeats included.
+	// AddMIDIChordNoteEvents needs the total number of notes, which is just the
+	// sum of the sizes of the span lists.
 
+	uint32_t nBar = GetFirstBar();
+	uint32_t nMaxBackwardOffset = GetMaxBackwardOffset();
 
 	// Melody Mode: Save the melody to timestamped file
-	// so it can be reused.
-	std::ofstream ofs;
-	std::string sMelodySaveFile = _sInputFile;
+	// so it can be reused. The text is built in memory here; CreateMIDIFile
+	// writes it out to _sMelodySaveFile.
+	std::ostringstream ofs;
 	if (_bAutoMelody)
 	{
+		_sMelodySaveFile = _sInputFile;
 		std::string ts = akl::TimeStamp();
 		std::string::size_type pos = _sInputFile.find_last_of ('.');
 		if (pos == std::wstring::npos)
@@ -2630,242 +3271,233 @@ void CMIDIHandler::GenerateNoteEvents()
 			ts += ".txt";
 		}
 
-		sMelodySaveFile.insert (pos, "_" + ts);
-		ofs.open (sMelodySaveFile, std::ios::out);
+		_sMelodySaveFile.insert (pos, "_" + ts);
 
-		std::string fname = PathFindFileNameA (&sMelodySaveFile[0]);
+		std::string fname = _sMelodySaveFile.substr (_sMelodySaveFile.find_last_of ("/\\") + 1);
 		ofs << "+TrackName = " << fname << "\n\n";
 	}
 
-	for (uint8_t i = 0; i < 2; i++)
-	{
-		uint32_t pos32nds = 0;
-
-		bool bNoteOn = false;
-		int32_t nChordPair = -1;
-		int32_t nNote = -1;
-		int32_t nPrevNote = 0;
-		uint32_t nItem = 0;
+	_nNoteCount = -1;
+	for (const auto& vSpans : _vLineSpans)
+		_nNoteCount += (int32_t)vSpans.size();
 
-		for each (auto s in _vNotePositions)
-		{
-			pos32nds = nBar * 32;
-
-			std::string s2 (s);
-			std::transform (s2.begin(), s2.end(), s2.begin(), ::toupper);
+	int32_t nNote = -1;
+	for (size_t nItem = 0; nItem < _vNotePositions.size(); nItem++)
+	{
+		GenerateLineNoteEvents (nItem, nBar, nNote, ofs);
 
-			// If a melody line is present for the current chord set, use it instead of
-			// outputting full chords
-			bool bMelody = false;
-			std::vector<std::string> vMN;
-			int32_t nMelodyNote = -1;
-			if (i == 1 && _vMelodyNotes[nItem].size())
-			{
-				vMN = akl::Explode (_vMelodyNotes[nItem], ":,");
-				bMelody = true;
-			}
+		// move pointer 4 bars forward
+		nBar += _vBarCount[nItem];
 
-			uint32_t nNoteCount = 0;
+		// Events from the following lines can't come before this, so
+		// the ones before it are final.
+		uint32_t nNextLineStart = nBar * 32 * _ticksPer32nd;
+		FlushNoteEvents (nNextLineStart > nMaxBackwardOffset ? nNextLineStart - nMaxBackwardOffset : 0);
+	}
 
-			// Lambda
-			auto ResolveMelodyNote = [&]()
-			{
-				nNoteCount++;
-				nMelodyNote = bMelody ? std::stoi (vMN[nNoteCount]) : -1;
-				return nMelodyNote;
-			};
+	if (_bAutoMelody)
+		_sMelodyText = ofs.str();
+}
 
-			for each (auto c in s)
-			{
-				if (c == '+')
-				{
-					nNote++;
+uint32_t CMIDIHandler::GetFirstBar() const
+{
+	// If randomized note start enabled, prefix with an additional bar
+	// to allow for note commencing *before* the notional start position.
+	return _bRandNoteStart && (!_bRandNoteOffsetTrim) ? 1 : 0;
+}
 
-					// start of note
-					if (!bNoteOn)
-					{
-						if (i == 0)
-							bNoteOn = !bNoteOn;
-						else
-						{
-							AddMIDIChordNoteEvents (ResolveMelodyNote(), ++nChordPair, _vChordNames[nNote], bNoteOn, pos32nds * _ticksPer32nd);
-						}
-					}
-					else
-					{
-						// Another note detected without a gap from previous note,
-						// so insert a Note Off first.
-						if (i == 1)
-						{
-							AddMIDIChordNoteEvents (nMelodyNote, nChordPair, _vChordNames[nPrevNote], bNoteOn, pos32nds * _ticksPer32nd);
-							AddMIDIChordNoteEvents (ResolveMelodyNote(), ++nChordPair, _vChordNames[nNote], bNoteOn, pos32nds * _ticksPer32nd);
-						}
-					}
-				}
-				else if (c == '#')
-				{
-					if (!bNoteOn)
-					{
-						// Consider this as repeat of the last chord
-						if (i == 0)
-							bNoteOn = !bNoteOn;
-						else
-						{
-							AddMIDIChordNoteEvents (ResolveMelodyNote(), ++nChordPair, _vChordNames[nNote], bNoteOn, pos32nds * _ticksPer32nd);
-						}
+uint32_t CMIDIHandler::GetMaxBackwardOffset() const
+{
+	// Furthest any event can be placed before the start of the note position
+	// line it belongs to (by the random start/end offsets, or FunkStrum
+	// shortening a note).
+	return (_bRandNoteStart ? _nRandNoteStartOffset : 0)
+		+ (_bRandNoteEnd ? _nRandNoteEndOffset : 0) + (_bFunkStrum ? _nFunkStrumNoteOffShorten : 0);
+}
 
-						if (i == 0)
-						{
-							std::string sNote = _vChordNames[nNote];
-							_vChordNames.insert (_vChordNames.begin() + nNote, sNote);
-						}
+void CMIDIHandler::GenerateLineNoteEvents (size_t nItem, uint32_t nBar, int32_t& nNote, std::ostringstream& ofs)
+{
+	const std::string& s = _vNotePositions[nItem];
+	uint32_t nLineStart = nBar * 32;
 
-						nNote++;
-					}
-				}
-				else
-				{
-					// end of note
-					if (bNoteOn)
-						if (i == 0)
-							bNoteOn = !bNoteOn;
-						else
-							AddMIDIChordNoteEvents (nMelodyNote, nChordPair, _vChordNames[nNote], bNoteOn, pos32nds * _ticksPer32nd);
-				}
+	// Each line has its own random numbers, whatever order lines are generated in.
+	_rng.SetStream (_nFirstLineStream + nItem);
 
-				pos32nds++;
-				nPrevNote = nNote;
-			}
+	// A melody note, if the line has a melody, is played instead of the full chord.
+	for (const NoteSpan& span : _vLineSpans[nItem])
+	{
+		bool bNoteOn = false;
+		nNote++;
+		AddPartNoteEvents (span.nMelodyNote, nNote, span.nChordId, bNoteOn, (nLineStart + span.nStart) * _ticksPer32nd);
+		AddPartNoteEvents (span.nMelodyNote, nNote, span.nChordId, bNoteOn, (nLineStart + span.nStart + span.nLength) * _ticksPer32nd);
+	}
 
-			// final end of note
-			if (bNoteOn)
-				if (i == 0)
-					bNoteOn = !bNoteOn;
-				else
-					AddMIDIChordNoteEvents (nMelodyNote, nChordPair, _vChordNames[nNote], bNoteOn, pos32nds * _ticksPer32nd);
+	//---------------------------------------------------------------------
+	// Dump the melody notes to file so user can copy the melody.
+	if (_bAutoMelody)
+	{
+		for (size_t j = 0; j < _vBarCount[nItem]; j++)
+			ofs << sRuler;
+		ofs << "\n";
+		ofs << s << std::endl;
 
 
-			//---------------------------------------------------------------------
-			// Dump the melody notes to file so user can copy the melody.
-			if (i == 1 && _bAutoMelody)
+		// Construct list of chords
+		uint32_t nC = 0;
+		std::string cn;	// chord name list, eg. "C, Am, F, G"
+		std::string comma;
+		std::vector<std::string> vNotePosItems = TokenizeNotePosStr (s);
+		for (auto e : vNotePosItems)
+		{
+			if (e[0] == '+')
 			{
-				for (size_t j = 0; j < _vBarCount[nItem]; j++)
-					ofs << sRuler;
-				ofs << "\n";
-				ofs << s << std::endl;
+				cn += comma + _vMelodyChordNames[nC];
+				comma = ", ";
+			}
+			nC++;
+		}
+		ofs << cn << std::endl;
+
+		// Construct sequence of semitone intervals representing the melody
+		uint32_t nCount = 0;
+		std::string prevChordName;
+		std::string dlim;
+		ofs << "M: ";
+		for (auto n : _vRandomMelodyNotes)
+		{
+			ofs << dlim << std::to_string(n);
+			dlim = ", ";
+			nCount++;
+		}
+		ofs << "\n\n";
+	}
+	_vRandomMelodyNotes.clear();
+	_vMelodyChordNames.clear();
+	//---------------------------------------------------------------------
+}
 
+void CMIDIHandler::SortNoteEvents (std::vector<MIDINote>& vEvents)
+{
+	auto SortKey = [](const MIDINote& note) -> uint64_t
+	{
+		return ((uint64_t)note.nTime << 8) | ((uint64_t)((note.nEvent >> 4) & 1) << 7) | (note.nKey & 0x7F);
+	};
 
-				// Construct list of chords
-				uint32_t nC = 0;
-				std::string cn;	// chord name list, eg. "C, Am, F, G"
-				std::string comma;
-				std::vector<std::string> vNotePosItems = TokenizeNotePosStr (s);
-				for (auto e : vNotePosItems)
-				{
-					if (e[0] == '+')
-					{
-						cn += comma + _vMelodyChordNames[nC];
-						comma = ", ";
-					}
-					nC++;
-				}
-				ofs << cn << std::endl;
-
-				// Construct sequence of semitone intervals representing the melody
-				uint32_t nCount = 0;
-				std::string prevChordName;
-				std::string dlim;
-				ofs << "M: ";
-				for (auto n : _vRandomMelodyNotes)
-				{
-					ofs << dlim << std::to_string(n);
-					dlim = ", ";
-					nCount++;
-				}
-				ofs << "\n\n";
-				_vRandomMelodyNotes.clear();
-				_vMelodyChordNames.clear();
-			}
-			//---------------------------------------------------------------------
+	const size_t nSize = vEvents.size();
+	if (nSize < 64)
+	{
+		// Small batches, eg. the events held back by a note stage.
+		std::stable_sort (vEvents.begin(), vEvents.end(),
+			[&](const MIDINote& m1, const MIDINote& m2) { return SortKey (m1) < SortKey (m2); }
+		);
+		return;
+	}
 
+	// LSD radix sort, one byte of the 40-bit key per pass:
+	//
+	//    <time:32><Note On:1><key:7>
+	//
+	// All the byte histograms are counted in one scan. Passes in which every
+	// event has the same byte value (eg. the top bytes of the time, which is
+	// bounded by the song length) are skipped.
+	const int nPasses = 5;
+	uint32_t aCount[nPasses][256] = {};
+	for (const MIDINote& note : vEvents)
+	{
+		uint64_t nKey = SortKey (note);
+		for (int p = 0; p < nPasses; p++)
+			aCount[p][(nKey >> (p * 8)) & 0xFF]++;
+	}
 
-			// move pointer 4 bars forward
-			if (i == 1)
-				nBar += _vBarCount[nItem];
+	_vSortBuf.resize (nSize);
+	for (int p = 0; p < nPasses; p++)
+	{
+		uint32_t* pCount = aCount[p];
+		if (pCount[(SortKey (vEvents[0]) >> (p * 8)) & 0xFF] == nSize)
+			continue;
 
-			nItem++;
+		// Counts to bucket start positions.
+		uint32_t nPos = 0;
+		for (int b = 0; b < 256; b++)
+		{
+			uint32_t n = pCount[b];
+			pCount[b] = nPos;
+			nPos += n;
 		}
 
-		_nNoteCount = nNote;
-	}
+		for (const MIDINote& note : vEvents)
+			_vSortBuf[pCount[(SortKey (note) >> (p * 8)) & 0xFF]++] = note;
 
-	if (_bAutoMelody)
-		ofs.close();
+		vEvents.swap (_vSortBuf);
+	}
 }
 
-void CMIDIHandler::SortNoteEventsAndFixOverlaps()
+void CMIDIHandler::RemoveDuplicateNotes (std::vector<MIDINote>& vEvents)
 {
-	// If randomized note start/end applies, need to sort into event time order
-	// and fix any overlap errors introduced.
-	std::sort (_vMIDINoteEvents.begin(), _vMIDINoteEvents.end(),
-		[](MIDINote m1, MIDINote m2) { return (m1.nTime < m2.nTime);  }
-	);
-
-	// Parse all notes to correct instances of overlap as a result of
-	// the randomized note start/end. We may have introduced two
-	// consecutive ONs. For each note, it should be a strictly
-	// ON-OFF-ON-OFF sequence.
-	std::map<uint8_t, uint8_t> mNotesEncountered;
-	for each (auto note in _vMIDINoteEvents)
-	{
-		std::map<uint8_t, uint8_t>::iterator it;
-		it = mNotesEncountered.find (note.nKey);
-		if (it == mNotesEncountered.end())
+	auto itEnd = std::unique (vEvents.begin(), vEvents.end(),
+		[](const MIDINote& m1, const MIDINote& m2)
 		{
-			// First time for this note, so add it to our list.
-			mNotesEncountered.insert (std::pair<uint8_t, uint8_t>(note.nKey, note.nEvent));
-
-			// Now, for this note, look for all instances of it the list of MIDI notes events,
-			// and ensure that they go on, off, on, off...
-			bool bOn = true;
-			int i = -1;
-			for each (auto note1 in _vMIDINoteEvents)
-			{
-				i++;
+			return m1.nTime == m2.nTime && m1.nEvent == m2.nEvent && m1.nKey == m2.nKey;
+		});
+	vEvents.erase (itEnd, vEvents.end());
+}
 
-				if (note1.nKey != note.nKey)
-					continue;
+uint8_t CMIDIHandler::CountChordPairNotes (const std::vector<MIDINote>& vEvents, size_t nItem, uint32_t nHorizon)
+{
+	// The Note On set ends where the first key comes round again, in the Note
+	// Off set.
+	size_t nEnd = nItem + 1;
+	while (nEnd < vEvents.size() && vEvents[nEnd].nKey != vEvents[nItem].nKey)
+		nEnd++;
+
+	size_t nNumNotes = nEnd - nItem;
+	size_t nLast = nItem + nNumNotes * 2 - 1;
+	if (nLast >= vEvents.size() || vEvents[nLast].nTime >= nHorizon)
+		return 0;
+
+	return (uint8_t)nNumNotes;
+}
 
-				_vMIDINoteEvents[i].nEvent = ((uint8_t)(bOn ? EventName::NoteOn : EventName::NoteOff) | _nChannel);
+size_t CMIDIHandler::FixRandomOffsetOverlaps (NoteStage& stage, uint32_t nHorizon)
+{
+	// Correct instances of overlap as a result of the randomized note
+	// start/end. We may have introduced two consecutive ONs. For each note, it
+	// should be a strictly ON-OFF-ON-OFF sequence; stage.aKeyNoteOn carries on
+	// where the previous batch left off.
+	size_t nCount = 0;
+	for (MIDINote note : stage.vIn)
+	{
+		if (note.nTime >= nHorizon)
+			break;
 
-				bOn = !bOn;
-			}
-		}
+		bool& bOn = stage.aKeyNoteOn[note.nKey & 0x7F];
+		bOn = !bOn;
+		note.nEvent = ((uint8_t)(bOn ? EventName::NoteOn : EventName::NoteOff) | _nChannel);
+		stage.vOut.push_back (note);
+		nCount++;
 	}
+
+	return nCount;
 }
 
-void CMIDIHandler::ApplyNoteStagger()
+size_t CMIDIHandler::StaggerChordNotes (NoteStage& stage, uint32_t nHorizon)
 {
-	SortChordNotes();
+	std::vector<MIDINote>& vIn = stage.vIn;
+	RemoveDuplicateNotes (vIn);
 
-	uint32_t nItem = 0;
+	size_t nItem = 0;
 
-	while (nItem < _vMIDINoteEvents.size())
+	while (nItem < vIn.size())
 	{
 		// Deal with each 'pair' of Chord Note Sets - one for Note On and one for Note Off.
 		//
 		// First: How many notes in the chord?
-		uint8_t nNumNotes = 0;
-		MIDINote note = _vMIDINoteEvents[nItem];
-		do
-		{
-			nNumNotes++;
-			nItem++;
-		} while (nItem < _vMIDINoteEvents.size() && _vMIDINoteEvents[nItem].nKey != note.nKey);
-		nItem -= nNumNotes;
+		uint8_t nNumNotes = CountChordPairNotes (vIn, nItem, nHorizon);
+		if (nNumNotes == 0)
+			break;
 
-		uint32_t nStartTime = _vMIDINoteEvents[nItem].nTime;
-		uint8_t nOrigVel = _vMIDINoteEvents[nItem].nVel;
+		uint32_t nStartTime = vIn[nItem].nTime;
+		uint8_t nOrigVel = vIn[nItem].nVel;
 
 		int8_t ns = _nNoteStagger;
 
@@ -2898,269 +3530,298 @@ void CMIDIHandler::ApplyNoteStagger()
 		if (ns < 0)
 			nNoteStartOffset = std::abs (ns) * (nNumNotes - 1);
 
-		std::vector<MIDINote>::iterator it;
 		for (uint8_t i = 0; i < nNumNotes; i++)
 		{
-			it = _vMIDINoteEvents.begin() + (nItem + i);
-			it->nTime += nNoteStartOffset;
+			MIDINote note = vIn[nItem + i];
+			note.nTime += nNoteStartOffset;
 			nNoteStartOffset += ns;
 
 			// FunkStrum: Declining velocity.
-			it->nVel = (uint8_t)nVel;
+			note.nVel = (uint8_t)nVel;
 			nVel -= nVelAdjAmt;
+			stage.vOut.push_back (note);
 		}
 
+		// The Note Off set is unchanged.
+		stage.vOut.insert (stage.vOut.end(), vIn.begin() + nItem + nNumNotes, vIn.begin() + nItem + nNumNotes * 2);
+
 		// Advance to next chord (pair)
 		nItem += (nNumNotes * 2);
 	}
 
+	// Anything left over at the end is passed on as it is.
+	if (nHorizon == UINT32_MAX)
+	{
+		stage.vOut.insert (stage.vOut.end(), vIn.begin() + nItem, vIn.end());
+		nItem = vIn.size();
+	}
+
 	// Another sort is required, to get everything in time order..
-	std::sort (_vMIDINoteEvents.begin(), _vMIDINoteEvents.end(),
-		[](MIDINote m1, MIDINote m2) { return (m1.nTime < m2.nTime);  }
-	);
+	SortNoteEvents (stage.vOut);
+
+	return nItem;
 }
 
-void CMIDIHandler::ApplyArpeggiation()
+void CMIDIHandler::BuildArpPattern (uint32_t nMode, uint8_t nNumNotes, std::vector<uint8_t>& vArpSequence)
 {
-	SortChordNotes();
-
-	uint32_t nSeq = 0;
-	uint32_t nItem = 0;
-
-	uint32_t nArpGate = (int32_t)(_nArpNoteTicks * _nArpGatePercent);
+	// For the specified arp type construct a sequence list
+	// according to the number of notes in the chord.
+	vArpSequence.clear();
 
-	while (nItem < _vMIDINoteEvents.size())
+	if (nMode == 1)
 	{
-		// Deal with each 'pair' of Chord Note Sets - one for Note On and one for Note Off.
-		//
-		// First: How many notes in the chord?
-		uint8_t nNumNotes = 0;
-		MIDINote note = _vMIDINoteEvents[nItem];
-		do
+		// "Up"
+		for (int8_t i = 0; i < nNumNotes; i++)
 		{
-			nNumNotes++;
-			nItem++;
-		} while (nItem < _vMIDINoteEvents.size() && _vMIDINoteEvents[nItem].nKey != note.nKey);
-		nItem -= nNumNotes;
-		//
-		// For each note in chord, generate a bunch of arp notes by
-		// cycling around the note set.
-		//
-		// Get the Note On and Off times for the chord.
-		uint32_t nStartTime = _vMIDINoteEvents[nItem].nTime;
-		uint32_t nEndTime = _vMIDINoteEvents[nItem + nNumNotes].nTime;
-		//
-
-		// For the specified arp type construct a sequence list
-		// according to the number of notes in the chord.
-		std::vector<uint8_t> vArpSequence;
-
-		if (_nArpeggiator == 1)
+			vArpSequence.push_back (i);
+		}
+	}
+	else if (nMode == 2)
+	{
+		// "Down"
+		for (int8_t i = nNumNotes - 1; i >= 0; i--)
 		{
-			// "Up"
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 2)
+	}
+	else if (nMode == 3)
+	{
+		// "Up Down"
+		for (int8_t i = 0; i < nNumNotes; i++)
 		{
-			// "Down"
-			for (int8_t i = nNumNotes - 1; i >= 0; i--)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 3)
+		for (int8_t i = nNumNotes - 2; i >= 1; i--)
 		{
-			// "Up Down"
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				vArpSequence.push_back (i);
-			}
-			for (int8_t i = nNumNotes - 2; i >= 1; i--)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 4)
+	}
+	else if (nMode == 4)
+	{
+		// "Down Up"
+		for (int8_t i = nNumNotes - 1; i >= 0; i--)
 		{
-			// "Down Up"
-			for (int8_t i = nNumNotes - 1; i >= 0; i--)
-			{
-				vArpSequence.push_back (i);
-			}
-			for (int8_t i = 1; i < nNumNotes - 1; i++)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 5)
+		for (int8_t i = 1; i < nNumNotes - 1; i++)
 		{
-			// "Up & Down"
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				vArpSequence.push_back (i);
-			}
-			for (int8_t i = nNumNotes - 1; i >= 0; i--)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 6)
+	}
+	else if (nMode == 5)
+	{
+		// "Up & Down"
+		for (int8_t i = 0; i < nNumNotes; i++)
 		{
-			// "Down & Up"
-			for (int8_t i = nNumNotes - 1; i >= 0; i--)
-			{
-				vArpSequence.push_back (i);
-			}
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				vArpSequence.push_back (i);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 7)
+		for (int8_t i = nNumNotes - 1; i >= 0; i--)
 		{
-			// "Converge"
-			uint8_t low = 0;
-			uint8_t high = nNumNotes - 1;
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				if (i % 2 == 0)
-					vArpSequence.push_back (low++);
-				else
-					vArpSequence.push_back (high--);
-			}
+			vArpSequence.push_back (i);
 		}
-		else if (_nArpeggiator == 8)
+	}
+	else if (nMode == 6)
+	{
+		// "Down & Up"
+		for (int8_t i = nNumNotes - 1; i >= 0; i--)
 		{
-			// "Diverge"
-			uint8_t low = 1;
-			uint8_t high = 0;
-			uint8_t mid = nNumNotes / 2;
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				if (i % 2 == 0)
-					vArpSequence.push_back (mid + high++);
-				else
-					vArpSequence.push_back (mid - low++);
-			}
+			vArpSequence.push_back (i);
+		}
+		for (int8_t i = 0; i < nNumNotes; i++)
+		{
+			vArpSequence.push_back (i);
+		}
+	}
+	else if (nMode == 7)
+	{
+		// "Converge"
+		uint8_t low = 0;
+		uint8_t high = nNumNotes - 1;
+		for (int8_t i = 0; i < nNumNotes; i++)
+		{
+			if (i % 2 == 0)
+				vArpSequence.push_back (low++);
+			else
+				vArpSequence.push_back (high--);
 		}
-		else if (_nArpeggiator == 9)
+	}
+	else if (nMode == 8)
+	{
+		// "Diverge"
+		uint8_t low = 1;
+		uint8_t high = 0;
+		uint8_t mid = nNumNotes / 2;
+		for (int8_t i = 0; i < nNumNotes; i++)
 		{
-			// "Converge & Diverge"
-			int8_t direction = -1;
-			uint8_t lo = 0;
-			uint8_t hi = nNumNotes - 1;
+			if (i % 2 == 0)
+				vArpSequence.push_back (mid + high++);
+			else
+				vArpSequence.push_back (mid - low++);
+		}
+	}
+	else if (nMode == 9)
+	{
+		// "Converge & Diverge"
+		int8_t direction = -1;
+		uint8_t lo = 0;
+		uint8_t hi = nNumNotes - 1;
 
-			for (int8_t i = 0; i < nNumNotes; i++)
-			{
-				if (direction > 0)
-					vArpSequence.push_back (hi--);
-				else
-					vArpSequence.push_back (lo++);
+		for (int8_t i = 0; i < nNumNotes; i++)
+		{
+			if (direction > 0)
+				vArpSequence.push_back (hi--);
+			else
+				vArpSequence.push_back (lo++);
 
-				direction = -direction;
-			}
+			direction = -direction;
+		}
 
-			// Last value for the converge becomes the first value of diverge.
-			lo = vArpSequence.back() - 1;
-			hi = lo + 2;
-			if (direction < 0)
-			{
-				hi = vArpSequence.back() + 1;
-				lo = hi - 2;
-			}
-			for (int8_t i = 1; i < nNumNotes - 1; i++)
-			{
-				if (direction > 0)
-					vArpSequence.push_back (hi++);
-				else
-					vArpSequence.push_back (lo--);
+		// Last value for the converge becomes the first value of diverge.
+		lo = vArpSequence.back() - 1;
+		hi = lo + 2;
+		if (direction < 0)
+		{
+			hi = vArpSequence.back() + 1;
+			lo = hi - 2;
+		}
+		for (int8_t i = 1; i < nNumNotes - 1; i++)
+		{
+			if (direction > 0)
+				vArpSequence.push_back (hi++);
+			else
+				vArpSequence.push_back (lo--);
 
-				direction = -direction;
-			}
+			direction = -direction;
 		}
-		else if (_nArpeggiator == 10)
+	}
+	else if (nMode == 10)
+	{
+		// "Pinky Up"
+		uint8_t low = 0;
+		uint8_t high = nNumNotes - 1;
+		for (int8_t i = 0; i < nNumNotes - 1; i++)
 		{
-			// "Pinky Up"
-			uint8_t low = 0;
-			uint8_t high = nNumNotes - 1;
-			for (int8_t i = 0; i < nNumNotes - 1; i++)
-			{
-				vArpSequence.push_back (low++);
-				if (low >= high)
-					low = 0;
-				vArpSequence.push_back (high);
-			}
+			vArpSequence.push_back (low++);
+			if (low >= high)
+				low = 0;
+			vArpSequence.push_back (high);
 		}
-		else if (_nArpeggiator == 11)
+	}
+	else if (nMode == 11)
+	{
+		// "Pinky UpDown"
+		uint8_t low = 0;
+		uint8_t high = nNumNotes - 1;
+		int8_t direction = 1;
+		for (int8_t i = 0; i < (nNumNotes - 2) * 2; i++)
 		{
-			// "Pinky UpDown"
-			uint8_t low = 0;
-			uint8_t high = nNumNotes - 1;
-			int8_t direction = 1;
-			for (int8_t i = 0; i < (nNumNotes - 2) * 2; i++)
+			vArpSequence.push_back (low);
+			low += direction;
+			if (low <= 0 || low >= high)
 			{
-				vArpSequence.push_back (low);
+				direction = -direction;
+				low += direction;
 				low += direction;
-				if (low <= 0 || low >= high)
-				{
-					direction = -direction;
-					low += direction;
-					low += direction;
-				}
-				vArpSequence.push_back (high);
 			}
+			vArpSequence.push_back (high);
 		}
-		else if (_nArpeggiator == 12)
+	}
+	else if (nMode == 12)
+	{
+		// "Thumb Up"
+		uint8_t low = 0;
+		uint8_t high = 1;
+		int8_t max = nNumNotes - 1;
+		for (int8_t i = 0; i < max; i++)
 		{
-			// "Thumb Up"
-			uint8_t low = 0;
-			uint8_t high = 1;
-			int8_t max = nNumNotes - 1;
-			for (int8_t i = 0; i < max; i++)
-			{
-				vArpSequence.push_back (low);
-				vArpSequence.push_back (high++);
-				if (high > max)
-					high = 1;
-			}
+			vArpSequence.push_back (low);
+			vArpSequence.push_back (high++);
+			if (high > max)
+				high = 1;
 		}
-		else if (_nArpeggiator == 13)
+	}
+	else if (nMode == 13)
+	{
+		// "Thumb UpDown"
+		uint8_t low = 0;
+		uint8_t high = 1;
+		int8_t direction = 1;
+		int8_t max = (nNumNotes - 2) * 2;
+		for (int8_t i = 0; i < max; i++)
 		{
-			// "Thumb UpDown"
-			uint8_t low = 0;
-			uint8_t high = 1;
-			int8_t direction = 1;
-			int8_t max = (nNumNotes - 2) * 2;
-			for (int8_t i = 0; i < max; i++)
-			{
-				vArpSequence.push_back (low);
-				vArpSequence.push_back (high);
-				if ((high <= 1 && direction == -1) || (high >= (nNumNotes - 1) && direction == 1))
-					direction = -direction;
-				high += direction;
-			}
+			vArpSequence.push_back (low);
+			vArpSequence.push_back (high);
+			if ((high <= 1 && direction == -1) || (high >= (nNumNotes - 1) && direction == 1))
+				direction = -direction;
+			high += direction;
 		}
+	}
+
+	// Some patterns have no notes for the smallest chords (eg. Pinky Up for a
+	// single note): just play the first note.
+	if (vArpSequence.empty())
+		vArpSequence.push_back (0);
+}
+
+const std::vector<uint8_t>& CMIDIHandler::GetArpPattern (uint8_t nNumNotes)
+{
+	if (nNumNotes <= _nMaxArpPatternNotes)
+		return _vArpPatterns[_nArpeggiator * (_nMaxArpPatternNotes + 1) + nNumNotes];
+
+	BuildArpPattern (_nArpeggiator, nNumNotes, _vArpPatternBuf);
+	return _vArpPatternBuf;
+}
+
+size_t CMIDIHandler::ArpeggiateChords (NoteStage& stage, uint32_t nHorizon)
+{
+	std::vector<MIDINote>& vIn = stage.vIn;
+	RemoveDuplicateNotes (vIn);
+
+	size_t nItem = 0;
+
+	uint32_t nArpGate = (int32_t)(_nArpNoteTicks * _nArpGatePercent);
+
+	while (nItem < vIn.size())
+	{
+		// Deal with each 'pair' of Chord Note Sets - one for Note On and one for Note Off.
+		//
+		// First: How many notes in the chord?
+		uint8_t nNumNotes = CountChordPairNotes (vIn, nItem, nHorizon);
+		if (nNumNotes == 0)
+			break;
+		//
+		// For each note in chord, generate a bunch of arp notes by
+		// cycling around the note set.
+		//
+		// Get the Note On and Off times for the chord.
+		uint32_t nStartTime = vIn[nItem].nTime;
+		uint32_t nEndTime = vIn[nItem + nNumNotes].nTime;
+		//
+
+		const std::vector<uint8_t>& vArpSequence = GetArpPattern (nNumNotes);
+
+		// Number of arp notes: the first is at the start time, and then one
+		// every _nArpNoteTicks before the end time. Two events each.
+		uint32_t nNumArpNotes = nEndTime > nStartTime ? (nEndTime - nStartTime + _nArpNoteTicks - 1) / _nArpNoteTicks : 1;
+		size_t nOut = stage.vOut.size();
+		stage.vOut.resize (nOut + nNumArpNotes * 2);
 
 		// First note in arp sequence.
 		uint8_t nArpItem = 0;
-		note = _vMIDINoteEvents[nItem + vArpSequence[nArpItem]];
+		MIDINote note = vIn[nItem + vArpSequence[nArpItem]];
 
 		// For the first note, start time is unchanged
-		_vMIDINoteEvents2.push_back (note);
+		stage.vOut[nOut++] = note;
 		// New event off for the arp note
 		uint8_t nEventType = ((uint8_t)EventName::NoteOff) | _nChannel;
 		uint32_t nTimeNote = note.nTime;
 		note.nTime += nArpGate;
 		note.nEvent = nEventType;
-		_vMIDINoteEvents2.push_back (note);
+		stage.vOut[nOut++] = note;
 
 		//
 		// Loop until end time reached.
 		uint32_t nCurTime = nTimeNote + _nArpNoteTicks;
-		uint32_t nItemSave = nItem;
 		int8_t nOctave = 0;
 		uint8_t nTotalOctaveSteps = std::abs (_nArpOctaveSteps);
 		uint8_t nOctaveCount = 0;
@@ -3191,7 +3852,7 @@ void CMIDIHandler::ApplyArpeggiation()
 				}
 			}
 
-			MIDINote note = _vMIDINoteEvents[nItem + vArpSequence[nArpItem]];
+			MIDINote note = vIn[nItem + vArpSequence[nArpItem]];
 
 			// Apply any Octave Step Transposition.
 			uint16_t noteTemp = nOctave * 12;
@@ -3201,30 +3862,37 @@ void CMIDIHandler::ApplyArpeggiation()
 
 			// Note start.
 			note.nTime = nCurTime;
-			_vMIDINoteEvents2.push_back (note);
+			stage.vOut[nOut++] = note;
 
 			// Note end.
 			nEventType = ((uint8_t)EventName::NoteOff) | _nChannel;
 			nTimeNote = note.nTime;
 			note.nTime += nArpGate; //nArpNoteTicks;
 			note.nEvent = nEventType;
-			_vMIDINoteEvents2.push_back (note);
+			stage.vOut[nOut++] = note;
 
 			nCurTime = nTimeNote + _nArpNoteTicks;	//note.nTime;
 		}
 
 		// Advance to next chord (pair)
-		nItem = nItemSave + (nNumNotes * 2);
+		nItem += (nNumNotes * 2);
 	}
 
-	_vMIDINoteEvents.assign (_vMIDINoteEvents2.begin(), _vMIDINoteEvents2.end());
-
+	// Anything left over at the end is passed on as it is.
+	if (nHorizon == UINT32_MAX)
+	{
+		stage.vOut.insert (stage.vOut.end(), vIn.begin() + nItem, vIn.end());
+		nItem = vIn.size();
+	}
 
 	// Another sort is required, to get everything in time order..
-	std::sort (_vMIDINoteEvents.begin(), _vMIDINoteEvents.end(),
-		[](MIDINote m1, MIDINote m2) { return (m1.nTime < m2.nTime);  }
-	);
+	SortNoteEvents (stage.vOut);
+
+	return nItem;
+}
 
+size_t CMIDIHandler::FixArpeggioOverlaps (NoteStage& stage, uint32_t nHorizon)
+{
 	// Check for and fix overlaps, ie. instances of 2 consecutive Note On events
 	// for the same note. Example:
 	//
@@ -3256,121 +3924,80 @@ void CMIDIHandler::ApplyArpeggiation()
 	//        4. 532 Note Off
 	//
 	// So then we have a correct sequence of Note On, Note Off, Note On, Notew Off, etc.
-
-	uint32_t item1 = 0;
-	uint32_t item2 = 0;
-	uint32_t item3 = 0;
-	std::map<uint8_t, uint8_t> mNotesEncountered;
-
-	while (item1 < _vMIDINoteEvents.size())
+	//
+	// This is done in one pass, keeping for each key whether it is sounding,
+	// the sequence number of its last Note On, and how many of its Note Off
+	// events are still to be deleted. The state carries on from one batch to
+	// the next.
+	size_t nCount = 0;
+	for (const MIDINote& note : stage.vIn)
 	{
-		MIDINote n1 = _vMIDINoteEvents[item1];
+		if (note.nTime >= nHorizon)
+			break;
+		nCount++;
 
-		std::map<uint8_t, uint8_t>::iterator it;
-		it = mNotesEncountered.find (n1.nKey);
-		if (it == mNotesEncountered.end())
+		uint8_t nKey = note.nKey & 0x7F;
+		if ((note.nEvent & 0xF0) == (uint8_t)EventName::NoteOn)
 		{
-			// First time for this note, so add it to our list.
-			mNotesEncountered.insert (std::pair<uint8_t, uint8_t>(n1.nKey, n1.nEvent));
-
-			item2 = item1 + 1;
-			while (item2 < _vMIDINoteEvents.size())
+			if (stage.aKeyNoteOn[nKey])
 			{
-				MIDINote n2 = _vMIDINoteEvents[item2];
-				if (n2.nKey == n1.nKey)
-				{
-					if (n2.nEvent == ((uint8_t)EventName::NoteOn & 0xF0) && n1.nEvent == ((uint8_t)EventName::NoteOn & 0xF0))
-					{
-						// Overlap.
-						//
-						// Insert a Note Off event so that it sits before this n2 Note On event.
-						MIDINote nNew (n1.nSeq, n2.nTime, (uint8_t)EventName::NoteOff | _nChannel, n1.nKey, 0);
-						_vMIDINoteEvents.insert (_vMIDINoteEvents.begin() + item2, nNew);
-						//
-						// Locate the next event for the this note, which should be a Note Off, and delete it.
-						item2++;
-						item3 = item2 + 1;
-						while (item3 < _vMIDINoteEvents.size())
-						{
-							MIDINote n3 = _vMIDINoteEvents[item3];
-							if (n3.nKey == n2.nKey)
-							{
-								if ((n3.nEvent & 0xF0) == (uint8_t)EventName::NoteOff)
-								{
-									// Delete from vector.
-									_vMIDINoteEvents.erase (_vMIDINoteEvents.begin() + item3);
-									break;
-								}
-							}
-							item3++;
-						}
-					}
-					n1 = n2;
-				}
-				item2++;
+				// Overlap.
+				//
+				// Insert a Note Off event so that it sits before this Note On
+				// event, and delete the next Note Off for this note.
+				stage.vOut.push_back (MIDINote (stage.aKeyNoteOnSeq[nKey], note.nTime, (uint8_t)EventName::NoteOff | _nChannel, note.nKey, 0));
+				stage.aKeyOffsToDelete[nKey]++;
+			}
+			stage.aKeyNoteOn[nKey] = true;
+			stage.aKeyNoteOnSeq[nKey] = note.nSeq;
+		}
+		else
+		{
+			if (stage.aKeyOffsToDelete[nKey])
+			{
+				stage.aKeyOffsToDelete[nKey]--;
+				continue;
 			}
+			stage.aKeyNoteOn[nKey] = false;
 		}
-		item1++;
+		stage.vOut.push_back (note);
 	}
+
+	return nCount;
 }
 
-void CMIDIHandler::SortChordNotes()
+void CMIDIHandler::PushNoteEvents (size_t nCount)
 {
-	// For the sake of Arpeggiation or Note Stagger...
-	// If downward transposition has occurred we must re-order the note such that,
-	// for each group with the same time, sort into ascending note order
-
-	std::map<uint8_t, MIDINote> mTemp;
-
-	std::vector<MIDINote> vTemp;
-	uint32_t itemFirst = 0;
-	uint32_t itemLast = 1;
-	while (1)
-	{
-		while (itemLast < _vMIDINoteEvents.size()
-			&& _vMIDINoteEvents[itemLast].nTime == _vMIDINoteEvents[itemFirst].nTime
-			&& _vMIDINoteEvents[itemLast].nEvent == _vMIDINoteEvents[itemFirst].nEvent)
-			itemLast++;
-		for (uint32_t i = itemFirst; i < itemLast; i++)
-		{
-			MIDINote note = _vMIDINoteEvents[i];
-			mTemp.insert (std::pair<uint8_t, MIDINote> (note.nKey, note));
-		}
-		for each (auto v in mTemp)
-		{
-			MIDINote n = v.second;
-			vTemp.push_back (n);
-		}
-		mTemp.clear();
-
-		if (itemLast >= _vMIDINoteEvents.size())
-			break;
+	_trackWriter.Reserve (nCount, 4);
 
-		itemFirst = itemLast;
-		itemLast++;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		const MIDINote& note = _vMIDINoteEvents[i];
+		_trackWriter.ChannelEvent (note.nTime - _nPrevEventTime, note.nEvent, note.nKey, note.nVel);
+		_nPrevEventTime = note.nTime;
 	}
-
-	_vMIDINoteEvents.assign (vTemp.begin(), vTemp.end());
 }
 
-void CMIDIHandler::PushNoteEvents()
+void CMIDIHandler::AddPartNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, uint16_t nChordId, bool& bNoteOn, uint32_t nEventTime)
 {
-	uint32_t nPrevNoteTime = 0;
-	for each (auto note in _vMIDINoteEvents)
+	if (_vParts.empty())
 	{
-		uint32_t nNoteTime = note.nTime;
-		uint32_t nDeltaTime = nNoteTime - nPrevNoteTime;
-
-		PushVariableValue (nDeltaTime);
-		PushInt8 (note.nEvent);
-		PushInt8 (note.nKey);
-		PushInt8 (note.nVel);
-
-		nPrevNoteTime = nNoteTime;
+		AddMIDIChordNoteEvents (nMelodyNote, nNoteSeq, nChordId, bNoteOn, nEventTime);
+		return;
 	}
+
+	// The same note for every part; only the melody part plays the melody line.
+	bool bPartNoteOn = bNoteOn;
+	ForEachPart ([&]()
+	{
+		bPartNoteOn = bNoteOn;
+		AddMIDIChordNoteEvents (_nPartType == PartType::Melody ? nMelodyNote : -1,
+			nNoteSeq, nChordId, bPartNoteOn, nEventTime);
+	});
+	bNoteOn = bPartNoteOn;
 }
 
-void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, std::string chordName, bool& bNoteOn, uint32_t nEventTime)
+void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, uint16_t nChordId, bool& bNoteOn, uint32_t nEventTime)
 {
 	bNoteOn = !bNoteOn;
 
@@ -3378,32 +4005,22 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	{
 		// FunkStrum: Shorten the note slightly, to prevent
 		// funk notes running into each other.
-		nEventTime -= 3;
+		nEventTime -= _nFunkStrumNoteOffShorten;
 	}
 
-	// Set randomizer ranges for note positions.
-	std::uniform_int_distribution<int> randNoteStartOffset (-_nRandNoteStartOffset, _nRandNoteStartOffset);
-	std::uniform_int_distribution<int> randNoteEndOffset (-_nRandNoteEndOffset, _nRandNoteEndOffset);
-
-	std::uniform_int_distribution<int> randNoteStartOffsetPositive (0, _nRandNoteStartOffset);
-	std::uniform_int_distribution<int> randNoteEndOffsetNegative (-_nRandNoteEndOffset, 0);
-
-	// Range for random velocity.
-	std::uniform_int_distribution<int> randVelVariation (0, _nRandVelVariation);
-	
 	// Lambda funcs for randomizing note start/end.
 	auto fnRandStart = [&](bool bPositiveOnly)
 	{
 		int8_t nRand = 0;
 		if (_bRandNoteStart)
-			nRand = bPositiveOnly && _bRandNoteOffsetTrim ? randNoteStartOffsetPositive (_eng) : randNoteStartOffset (_eng);
+			nRand = _rng.Between (bPositiveOnly && _bRandNoteOffsetTrim ? 0 : -_nRandNoteStartOffset, _nRandNoteStartOffset);
 		return nRand;
 	};
 	auto fnRandEnd = [&](bool bNegativeOnly)
 	{
 		int8_t nRand = 0;
 		if (_bRandNoteEnd)
-			nRand = bNegativeOnly && _bRandNoteOffsetTrim ? randNoteEndOffsetNegative (_eng) : randNoteEndOffset (_eng);
+			nRand = _rng.Between (-_nRandNoteEndOffset, bNegativeOnly && _bRandNoteOffsetTrim ? 0 : _nRandNoteEndOffset);
 		return nRand;
 	};
 
@@ -3411,17 +4028,20 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	auto fnRandVel = [&]() {
 		uint8_t nRand = 0;
 		if (_nRandVelVariation > 0)
-			nRand = randVelVariation (_eng);
+			nRand = static_cast<uint8_t>(_rng.Below (_nRandVelVariation + 1u));
 		uint16_t nTemp = _nVelocity + nRand;
 		if (nTemp > 127)
 			nTemp = 127;
 		return (uint8_t)nTemp;
 	};
 
-	std::vector<std::string> vChordIntervals;
-	uint8_t nRoot = 0;
-	std::string sChordType;
-	GetChordIntervals (chordName, nRoot, vChordIntervals, sChordType);
+	const ChordSymbol& symbol = _vChordSymbols[nChordId];
+	const ChordSpec& chord = symbol.spec;
+	const std::string& chordName = symbol.sName;
+	const ChordTypeInfo& chordType = _vChordTypeInfo[chord.nType];
+
+	// Root in the octave register (_nProvisionalLowestNote is the C).
+	uint8_t nRoot = _nProvisionalLowestNote + chord.nRootPitchClass;
 
 	// 2311281548 Also apply transposition to root note. This helps for bass line melodies,
 	// if we don't want wide register. Particularly useful when Root Note Only used.
@@ -3439,7 +4059,7 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	// Has a melody note been specified?
 	if (nMelodyNote >= 0)
 	{
-		static uint8_t nNote;
+		uint8_t& nNote = _nFixedMelodyNote;
 		if (bNoteOn)
 		{
 			uint8_t mn = (uint8_t)nMelodyNote;
@@ -3448,7 +4068,7 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 			// Auto-correct notes to match scale of the chord.
 			// This can happen if you re-use a melody from a major chord
 			// for a minor chord, or vice-versa
-			if (vChordIntervals[0] == "3")
+			if (chord.aIntervals[0] == 3)
 			{
 				if (mn == 2 || mn == 4 || mn == 9)
 					mn++;
@@ -3477,19 +4097,18 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	// AutoMelody: Instead of chords, output a random note
 	// from the Major/Minor Pentatonic scale of the chord.
 	// (No position offset is applicable.)
-	if (_bAutoMelody)
+	// Multi-part: for the melody part, where there's no melody line.
+	if ((_bAutoMelody && _nPartType == PartType::All) || _nPartType == PartType::Melody)
 	{
 		// Notes (semitone intervals) that can be used in the melody.
 		// Essentially, Major or Minor Pentatonic.
-		auto it = _mMelodyNotes.find (sChordType);
-		std::vector<uint8_t> vNotes = it->second;
-
-		std::uniform_int_distribution<uint32_t> randNote (0, vNotes.size() - 1);
+		const std::vector<uint8_t>& vNotes = _bAutoMelodyDontUsePentatonic
+			? *chordType.pMelodyNotes : *chordType.pMelodyNotesPentatonic;
 
-		static uint8_t nNote;
+		uint8_t& nNote = _nAutoMelodyNote;
 		if (bNoteOn)
 		{
-			uint8_t rn = vNotes[randNote (_eng)];
+			uint8_t rn = vNotes[_rng.Below (static_cast<uint32_t>(vNotes.size()))];
 			nNote = nRoot + rn;
 
 			// 231128 We now transpose for +AutoMelody
@@ -3508,14 +4127,35 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 		return;
 	}
 
+	// Extra bass note (+BassNote): the root, an octave down (none if that's below 0).
+	auto fnAddBassNote = [&]()
+	{
+		notePosOffset = (bNoteOn ? fnRandStart (nNoteSeq == 0) : fnRandEnd (nNoteSeq == _nNoteCount));
+
+		nET = nEventTime + notePosOffset;
+		int16_t noteTemp = nRoot - 12;
+		if (noteTemp >= 0)
+		{
+			MIDINote note (nNoteSeq, nET, nEventType, nRoot - 12, fnRandVel());
+			_vMIDINoteEvents.push_back (note);
+		}
+	};
+
+	// Multi-part bass: the chords' extra bass note, on its own track.
+	if (_nPartType == PartType::Bass)
+	{
+		fnAddBassNote();
+		return;
+	}
+
 	// Output ALL possible melody notes. For major/minor chords, this will be the pentatonic;
 	// in the case of suspended/diminished chords, it will just be the chord notes.
 	if (_bAllMelodyNotes)
 	{
- 		auto it = _mMelodyNotes.find (sChordType);
-		std::vector<uint8_t> vNotes = it->second;
+		const std::vector<uint8_t>& vNotes = _bAutoMelodyDontUsePentatonic
+			? *chordType.pMelodyNotes : *chordType.pMelodyNotesPentatonic;
 		uint8_t nLastNote = 127;
-		for each (auto nSemitones in vNotes)
+		for (auto nSemitones : vNotes)
 		{
 			if (nSemitones == nLastNote)
 				continue;
@@ -3538,19 +4178,9 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	}
 
 
-	// Optional extra bass note
-	if (_bAddBassNote)
-	{
-		notePosOffset = (bNoteOn ? fnRandStart (nNoteSeq == 0) : fnRandEnd (nNoteSeq == _nNoteCount));
-
-		nET = nEventTime + notePosOffset;
-		int16_t noteTemp = nRoot - 12;
-		if (noteTemp >= 0)
-		{
-			MIDINote note (nNoteSeq, nET, nEventType, nRoot - 12, fnRandVel());
-			_vMIDINoteEvents.push_back (note);
-		}
-	}
+	// Optional extra bass note (played by the bass part instead, if there is one).
+	if (_bAddBassNote && !HasPart (PartType::Bass))
+		fnAddBassNote();
 
 	// Root note
 	notePosOffset = (bNoteOn ? fnRandStart (nNoteSeq == 0) : fnRandEnd (nNoteSeq == _nNoteCount));
@@ -3562,9 +4192,9 @@ void CMIDIHandler::AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSe
 	// Chord notes
 	if (_bRootNoteOnly == false)
 	{
-		for each (auto item in vChordIntervals)
+		for (uint8_t i = 0; i < chord.nNumIntervals; i++)
 		{
-			uint8_t nSemitones = std::stoi (item);
+			uint8_t nSemitones = chord.aIntervals[i];
 
 			// Downward transposition occurs if note is higher than highest-note threshold, or 127.
 			uint16_t nNote = nRoot + nSemitones;
@@ -3620,38 +4250,75 @@ int8_t CMIDIHandler::NoteToMidi (std::string sNote, uint8_t& nNote, uint8_t& nSh
 bool CMIDIHandler::GetChordIntervals (std::string sChordName, uint8_t& nRoot, 
 	std::vector<std::string>& vChordIntervals, std::string& sChordType)
 {
-	bool bOK = true;
+	ChordSpec chord;
+	if (!ResolveChord (sChordName, chord))
+		return false;
 
-	std::string sChord;
-	sChord.assign (1, sChordName[0]);
-	if (sChordName.size() > 1 && (sChordName[1] == 'b' || sChordName[1] == '#'))
-		sChord += sChordName[1];
-	sChord += _sOctaveRegister;
 	uint8_t nSharpFlat = 0;
-	int8_t res = NoteToMidi (sChord, nRoot, nSharpFlat);
+	if (NoteToMidi ("C" + _sOctaveRegister, nRoot, nSharpFlat) == -1)
+		return false;
+	nRoot += chord.nRootPitchClass;
+
+	sChordType = _vChordTypeInfo[chord.nType].sName;
+	vChordIntervals = akl::Explode (_mChordTypes.at (sChordType), ",");
+
+	return true;
+}
+
+bool CMIDIHandler::InternChord (const std::string& sChordName, const ChordSpec& chord, uint16_t& nId)
+{
+	auto it = _mChordSymbolIds.find (sChordName);
+	if (it != _mChordSymbolIds.end())
+	{
+		nId = it->second;
+		return true;
+	}
+
+	if (_vChordSymbols.size() > UINT16_MAX)
+		return false;
+
+	nId = (uint16_t)_vChordSymbols.size();
+	_vChordSymbols.push_back ({ sChordName, chord });
+	_mChordSymbolIds.emplace (sChordName, nId);
+	return true;
+}
 
-	if (res == -1)
+bool CMIDIHandler::ResolveChord (const std::string& sChordName, ChordSpec& chord)
+{
+	if (sChordName.empty())
 		return false;
 
-	// Adjust for flat/sharp.
-	uint8_t nCount = 1;
-	if (nSharpFlat > 0)
+	// Root note, with optional flat/sharp.
+	size_t nCount = 1;
+	if (sChordName.size() > 1 && (sChordName[1] == 'b' || sChordName[1] == '#'))
 		nCount++;
 
+	std::string sRoot = sChordName.substr (0, nCount);
+	sRoot[0] = std::toupper (sRoot[0]);
+
+	auto itRoot = _mChromaticScale.find (sRoot);
+	if (itRoot == _mChromaticScale.end())
+		return false;
+
 	// Chord type
-	std::string chordType = sChordName.substr (nCount, sChordName.size() - nCount);
+	std::string chordType = sChordName.substr (nCount);
 	if (chordType == "")
 		chordType = "maj";
 
-	std::map<std::string, std::string>::iterator it;
-	it = _mChordTypes.find (chordType);
-	if (it == _mChordTypes.end())
+	auto itType = _mChordTypeIds.find (chordType);
+	if (itType == _mChordTypeIds.end())
 		return false;
 
-	vChordIntervals = akl::Explode (it->second, ",");
-	sChordType = it->first;
+	chord.nRootPitchClass = itRoot->second;
+	chord.nType = itType->second;
 
-	return bOK;
+	std::vector<std::string> vIntervals = akl::Explode (_mChordTypes.at (chordType), ",");
+	assert (vIntervals.size() <= sizeof (chord.aIntervals));
+	chord.nNumIntervals = static_cast<uint8_t>(vIntervals.size());
+	for (uint8_t i = 0; i < chord.nNumIntervals; i++)
+		chord.aIntervals[i] = static_cast<uint8_t>(std::stoi (vIntervals[i]));
+
+	return true;
 }
 
 CMIDIHandler::StatusCode CMIDIHandler::SetParameter (std::vector<std::string>& vF, const std::string& sP)
@@ -3710,69 +4377,6 @@ std::vector<std::string> CMIDIHandler::GetFileVec()
 	return _vFile;
 }
 
-uint32_t CMIDIHandler::Swap32 (uint32_t n) const
-{
-	return (((n >> 24) & 0xff) | ((n << 8) & 0xff0000) | ((n >> 8) & 0xff00) | ((n << 24) & 0xff000000));
-};
-
-uint16_t CMIDIHandler::Swap16 (uint16_t n) const
-{
-	return ((n >> 8) | (n << 8));
-};
-
-std::string CMIDIHandler::BitString (uint32_t n, uint32_t numBits) const
-{
-	std::string x;
-	for (int i = numBits - 1; i >= 0; i--)
-	{
-		char a = n & (1 << i) ? '1' : '0';
-		x += a;
-		if (i % 8 == 0)
-			x += "|";
-	}
-	return x;
-};
-
-void CMIDIHandler::PushVariableValue (uint32_t nVal)
-{
-	auto x = BitString (nVal, 32);
-
-	uint32_t buf = nVal & 0x7F;
-
-	while ((nVal >>= 7) > 0)
-	{
-		buf <<= 8;
-		buf |= 0x80;
-		buf += (nVal & 0x7F);
-	}
-
-	x = BitString (buf, 32);
-
-	_vTrackBuf.push_back (buf & 0xFF);
-	_nOffset++;
-	while (buf & 0x80)
-	{
-		buf >>= 8;
-		_vTrackBuf.push_back (buf & 0xFF);
-		_nOffset++;
-	}
-
-	int ak = 1;
-};
-
-void CMIDIHandler::PushInt8 (uint8_t n)
-{
-	_vTrackBuf.push_back (n);
-	_nOffset++;
-}
-
-void CMIDIHandler::PushText (const std::string& s)
-{
-	auto bytes = reinterpret_cast<const byte*>(s.data());
-	_vTrackBuf.insert (_vTrackBuf.end(), bytes, bytes + s.length());
-	_nOffset += s.length();
-}
-
 std::vector<std::string> CMIDIHandler::TokenizeNotePosStr (std::string notePosStr)
 {
 	// Parse a string like "+## ##### ##+## # # ####+## # #" and
@@ -3852,18 +4456,8 @@ bool CMIDIHandler::ValidBiasParam (std::string& str, uint8_t numValues)
 		if (!akl::VerifyTextInteger (v[i], nVal, 0, 1000))
 			return false;
 
-		// Absolute hack: To prevent endless loop, in the case of AutoRhythmNoteLenBias
-		// and AutoRhythmGapLenBias, ensure that there is at least one instance for the
-		// 32nds values. That is, a parameter value of, for example, "1, 1, 1, 1, 1, 0"
-		// will cause loop, so this would be changed to "1, 1, 1, 1, 1, 1". This is
-		// all about guaranteeing that we can have a note or gap length of 1/32nd when
-		// necessary. Can't easily think of a way around this for now.
-		// If you really do not want to have any 32nd notes/gaps, specify big numbers
-		// (eg. 1000) for the other values - this should virtually exclude 32nds.
-		if (i == 5 && nVal == 0)
-			v[i] = "1";
-
-		// Reconstruct param string for sake of dreadful hack mentioned above.
+		// (The lengths are drawn only from those that fit, so a weight of zero for
+		// 32nds no longer needs to be changed to 1 to prevent an endless loop.)
 		str2 += comma + v[i];
 		comma = ", ";
 	}
@@ -3895,8 +4489,8 @@ void CMIDIHandler::InitChordBank (const std::string& sKey)
 
 	// Create two CChordBank objects that will hold the chord lists. One is for the main key,
 	// the other is a Modal Interchange version, which *may* be used for chord selection (T2015A).
-	_vChordBank.push_back (std::make_unique<CChordBank> (sNote, _vChordTypeVariationFactors));
-	_vChordBank.push_back (std::make_unique<CChordBank> (sNote, _vChordTypeVariationFactors));
+	_vChordBank.push_back (std::make_unique<CChordBank> (sNote, _vChordTypeVariationFactors, _rng));
+	_vChordBank.push_back (std::make_unique<CChordBank> (sNote, _vChordTypeVariationFactors, _rng));
 
 	// Initialize index values for referencing the relevant chord bank.
 	if (bMinorKey)
@@ -3927,6 +4521,20 @@ void CMIDIHandler::InitChordBank (const std::string& sKey)
 		uint8_t whichChordBank = i < _nModalInterchangeChancePercentage ? _iCB_ModInt : _iCB_Main;
 		_vChordBankChoice.push_back (whichChordBank);
 	}
+
+	for (uint8_t iCB = 0; iCB < 2; iCB++)
+	{
+		double dBankChance = std::count (_vChordBankChoice.begin(), _vChordBankChoice.end(), iCB) / 100.0;
+
+		std::vector<CChordBank::ChordChance> v;
+		_vChordBank[iCB]->GetChordChances (v);
+		for (auto& c : v)
+		{
+			c.dChance *= dBankChance;
+			if (c.dChance > 0.0)
+				_vRCRChoices.push_back (c);
+		}
+	}
 }
 
 std::string CMIDIHandler::GetStatusMessage()
@@ -3934,16 +4542,42 @@ std::string CMIDIHandler::GetStatusMessage()
 	return _sStatusMessage;
 }
 
+void CMIDIHandler::SetSeed (uint64_t nSeed)
+{
+	_rng.Seed (nSeed);
+	_bSeeded = true;
+	_bSeedSet = true;
+}
+
+bool CMIDIHandler::ParseSeed (const std::string& sValue, uint64_t& nSeed)
+{
+	if (sValue.empty() || sValue.size() > 19 || sValue.find_first_not_of ("0123456789") != std::string::npos)
+		return false;
+
+	nSeed = std::stoull (sValue);
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Static class members
 
-std::string CMIDIHandler::_version = "0.45";
+std::string CMIDIHandler::_version = "0.46";
 
 std::map<std::string, std::string>CMIDIHandler::_mChordTypes;
+std::map<std::string, std::string>CMIDIHandler::_mChordTypesInOctave;
 std::map<std::string, std::vector<uint8_t>>CMIDIHandler::_mMelodyNotes;
+std::map<std::string, std::vector<uint8_t>>CMIDIHandler::_mMelodyNotesPentatonic;
+std::vector<CMIDIHandler::ChordTypeInfo>CMIDIHandler::_vChordTypeInfo;
+std::map<std::string, uint8_t>CMIDIHandler::_mChordTypeIds;
 std::map<std::string, uint8_t>CMIDIHandler::_mChromaticScale;
 std::map<std::string, uint8_t>CMIDIHandler::_mChromaticScale2;
+std::vector<CMIDIHandler::PitchClassSetEntry>CMIDIHandler::_vPitchClassSets;
+std::vector<std::vector<uint8_t>>CMIDIHandler::_vArpPatterns;
+std::vector<std::string>CMIDIHandler::_vPitchClassNames;
 std::vector<std::string>CMIDIHandler::_vRFGChords;
+std::vector<std::string>CMIDIHandler::_vRFGChordNames;
+std::vector<std::vector<uint8_t>>CMIDIHandler::_vRFGCandidates;
+std::vector<CMIDIHandler::GrooveFilterState>CMIDIHandler::_vGrooveFilter;
 std::map<CMIDIHandler::ParamCode, std::string>CMIDIHandler::_mParamCodes;
 
 CMIDIHandler::ClassMemberInit CMIDIHandler::cmi;
@@ -3969,6 +4603,16 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 	_mChordTypes.insert (std::pair<std::string, std::string>("dim7",	"3,6,9"));		// Diminished 7th
 	_mChordTypes.insert (std::pair<std::string, std::string>("m7b5",	"3,6,10"));		// Half-Diminished 7th
 
+	// For the sake of identifying chord types, we need to ensure
+	// all notes are contained within a single octave, so here we
+	// do some necessary downward transposing.
+	_mChordTypesInOctave = _mChordTypes;
+	_mChordTypesInOctave["9"] = "2,4,7,10";
+	_mChordTypesInOctave["maj9"] = "2,4,7,11";
+	_mChordTypesInOctave["add9"] = "2,4,7";
+	_mChordTypesInOctave["m9"] = "2,3,7,10";
+	_mChordTypesInOctave["madd9"] = "2,3,7";
+
 	// Auto-Melody: Semitone positions of all the notes available.
 	// (The +AutoMelodyUsePentatonic parameter allows you to expand the notes in the major and minor
 	// chords to include the additional notes of the chord's respective pentatonic scale.)
@@ -3998,11 +4642,26 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 	_mMelodyNotes.insert (std::pair<std::string, std::vector<uint8_t>>("m7b5",   { 0, 0, 0, 0, 0, 3, 3, 6, 6, 10 } ));
 
 	// Sanity check that _mMelodyNotes corresponds correctly to _mChordTypes.
-	for each (auto ct in _mChordTypes)
+	for (auto ct : _mChordTypes)
 	{
 		std::map<std::string, std::vector<uint8_t>>::iterator it;
 		it = _mMelodyNotes.find (ct.first);
-		ASSERT (it != _mMelodyNotes.end());
+		assert (it != _mMelodyNotes.end());
+	}
+
+	// Pentatonic version: Two each of the 2nd and 6th for major chords, and of
+	// the 4th and 7th for minor chords.
+	_mMelodyNotesPentatonic = _mMelodyNotes;
+	for (const auto& ct : { "maj", "7", "maj7", "9", "maj9", "add9" })
+		_mMelodyNotesPentatonic[ct].insert (_mMelodyNotesPentatonic[ct].end(), { 2, 9, 2, 9 });
+	for (const auto& ct : { "m", "m7", "m9", "madd9" })
+		_mMelodyNotesPentatonic[ct].insert (_mMelodyNotesPentatonic[ct].end(), { 5, 10, 5, 10 });
+
+	// Chord type ids for compiled chords (ChordSpec).
+	for (const auto& ct : _mChordTypes)
+	{
+		_mChordTypeIds[ct.first] = static_cast<uint8_t>(_vChordTypeInfo.size());
+		_vChordTypeInfo.push_back ({ ct.first, &_mMelodyNotes.at (ct.first), &_mMelodyNotesPentatonic.at (ct.first) });
 	}
 
 	_mChromaticScale.insert (std::pair<std::string, uint8_t>("C", 0));
@@ -4037,6 +4696,45 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 	_mChromaticScale2.insert (std::pair<std::string, uint8_t>("Bb", 10));
 	_mChromaticScale2.insert (std::pair<std::string, uint8_t>("B", 11));
 
+	_vPitchClassNames.resize (12);
+	for (const auto& pc : _mChromaticScale2)
+		_vPitchClassNames[pc.second] = pc.first;
+
+	// Pitch-class set table for chord recognition. Every chord type, with the
+	// bass on each of its notes in turn.
+	_vPitchClassSets.resize (4096);
+	for (const auto& info : _vChordTypeInfo)
+	{
+		std::vector<uint8_t> vIntervals = { 0 };
+		for (const auto& iv : akl::Explode (_mChordTypesInOctave.at (info.sName), ","))
+			vIntervals.push_back (static_cast<uint8_t>(std::stoi (iv)));
+
+		for (auto nBassInterval : vIntervals)
+		{
+			uint8_t nRootOffset = (12 - nBassInterval) % 12;
+			uint16_t nMask = 0;
+			for (auto iv : vIntervals)
+				nMask |= 1 << ((nRootOffset + iv) % 12);
+
+			// Prefer the root closest above the bass; for the same root, the
+			// first type in _mChordTypes order.
+			PitchClassSetEntry& entry = _vPitchClassSets[nMask];
+			if (entry.nType == 0xFF || nRootOffset < entry.nRootOffset)
+			{
+				entry.nRootOffset = nRootOffset;
+				entry.nType = _mChordTypeIds.at (info.sName);
+			}
+		}
+	}
+
+	// Arpeggiator patterns, for each arp type and number of notes in a chord.
+	_vArpPatterns.resize (14 * (_nMaxArpPatternNotes + 1));
+	for (uint32_t nMode = 1; nMode <= 13; nMode++)
+	{
+		for (uint8_t nNumNotes = 1; nNumNotes <= _nMaxArpPatternNotes; nNumNotes++)
+			BuildArpPattern (nMode, nNumNotes, _vArpPatterns[nMode * (_nMaxArpPatternNotes + 1) + nNumNotes]);
+	}
+
 	// Weighted to favour certain chords.
 	//
 	// m7
@@ -4085,6 +4783,73 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 	_vRFGChords.push_back ("A7sus4");
 	_vRFGChords.push_back ("B7sus4");
 
+	for (const auto& sChord : _vRFGChords)
+	{
+		if (std::find (_vRFGChordNames.begin(), _vRFGChordNames.end(), sChord) == _vRFGChordNames.end())
+			_vRFGChordNames.push_back (sChord);
+	}
+
+	size_t nNumRFGChords = _vRFGChordNames.size();
+	_vRFGCandidates.resize (2 * nNumRFGChords);
+	for (size_t nLast = 0; nLast < 2; nLast++)
+	{
+		for (size_t nPrev = 0; nPrev < nNumRFGChords; nPrev++)
+		{
+			for (const auto& sChord : _vRFGChords)
+			{
+				size_t nChord = std::find (_vRFGChordNames.begin(), _vRFGChordNames.end(), sChord) - _vRFGChordNames.begin();
+				bool bSus = (sChord.find ("sus") != std::string::npos);
+				if (nChord == nPrev || (nLast && sChord == "Em7") || (!nLast && bSus))
+					continue;
+
+				_vRFGCandidates[nLast * nNumRFGChords + nPrev].push_back (static_cast<uint8_t>(nChord));
+			}
+		}
+	}
+
+	// Random groove filter, in 1/16ths: S = note start, H = note held, R = off.
+	// The states are the proper prefixes of the patterns; the next state is the
+	// longest of them that the 1/16ths so far end with.
+	const std::vector<std::string> vGroovePatterns = {
+		"SSSS",			// Too many consecutive 1/16ths: "+#+#+#+#"
+		"RRR",			// Big gap, ie. 3/16ths or larger: "      "
+		"SHHHSHHH",		// Consecutive 1/4 notes: "+#######+#######"
+		"SHSHSH" };		// More than two consecutive 1/8th notes: "+###+###+###"
+	std::vector<std::string> vGrooveStates (1);
+	for (const auto& sPattern : vGroovePatterns)
+	{
+		for (size_t n = 1; n < sPattern.size(); n++)
+		{
+			if (std::find (vGrooveStates.begin(), vGrooveStates.end(), sPattern.substr (0, n)) == vGrooveStates.end())
+				vGrooveStates.push_back (sPattern.substr (0, n));
+		}
+	}
+
+	const std::string sGrooveTokens = "SHR";
+	for (const auto& sState : vGrooveStates)
+	{
+		GrooveFilterState state;
+		for (size_t t = 0; t < sGrooveTokens.size(); t++)
+		{
+			std::string s = sState + sGrooveTokens[t];
+			bool bMatch = std::any_of (vGroovePatterns.begin(), vGroovePatterns.end(), [&](const std::string& sPattern)
+				{ return s.size() >= sPattern.size() && s.compare (s.size() - sPattern.size(), sPattern.size(), sPattern) == 0; });
+			if (bMatch)
+				continue;
+
+			for (size_t n = 0; n <= s.size(); n++)
+			{
+				auto it = std::find (vGrooveStates.begin(), vGrooveStates.end(), s.substr (n));
+				if (it != vGrooveStates.end())
+				{
+					state.aNext[t] = static_cast<int8_t>(it - vGrooveStates.begin());
+					break;
+				}
+			}
+		}
+		_vGrooveFilter.push_back (state);
+	}
+
 	// Set up the parameter codes
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
 		(CMIDIHandler::ParamCode::AllMelodyNotes, "AllMelodyNotes"));
@@ -4162,6 +4927,12 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 		(CMIDIHandler::ParamCode::NoteStagger, "NoteStagger"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
 		(CMIDIHandler::ParamCode::OctaveRegister, "OctaveRegister"));
+	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
+		(CMIDIHandler::ParamCode::PartChannels, "PartChannels"));
+	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
+		(CMIDIHandler::ParamCode::Parts, "Parts"));
+	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
+		(CMIDIHandler::ParamCode::PartTrackNames, "PartTrackNames"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
 		(CMIDIHandler::ParamCode::RandNoteEndOffset, "RandNoteEndOffset"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
@@ -4174,6 +4945,8 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 		(CMIDIHandler::ParamCode::RandVelVariation, "RandVelVariation"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
 		(CMIDIHandler::ParamCode::RootNoteOnly, "RootNoteOnly"));
+	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
+		(CMIDIHandler::ParamCode::Seed, "Seed"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
 		(CMIDIHandler::ParamCode::TrackName, "TrackName"));
 	_mParamCodes.insert (std::pair<CMIDIHandler::ParamCode, std::string>
@@ -4186,6 +4959,3 @@ CMIDIHandler::ClassMemberInit::ClassMemberInit ()
 		(CMIDIHandler::ParamCode::SYS_RCRHistoryCount, "SYS_RCRHistoryCount"));
 }
 
-// Randomizer static variable declaration
-std::default_random_engine CMIDIHandler::_eng;
-
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "CChordBank.h"
+#include "CSMFStreamWriter.h"
+#include "CRandom.h"
 
 enum class EventName : uint8_t
 {
@@ -133,7 +135,17 @@ public:
 		ParamAlreadySpecified,
 		IllegalParamAfterMusicData,
 		InvalidSYS_RCRHistoryCount,
-		NoMusicData
+		NoMusicData,
+		InvalidBatchManifest,
+		UnableToWriteOutputFile,
+		InvalidPartsValue,
+		InvalidPartChannelsValue,
+		InvalidPartTrackNamesValue,
+		InvalidSeedValue,
+		InvalidRandMelodyOptions,
+		InvalidRandFunkGrooveOptions,
+		TooManyChordSymbols,
+		InvalidMelodyLine
 	};
 
 	enum class ParamCode : uint16_t
@@ -176,12 +188,16 @@ public:
 		ModalInterchangeChancePercentage,
 		NoteStagger,
 		OctaveRegister,
+		PartChannels,
+		Parts,
+		PartTrackNames,
 		RandNoteEndOffset,
 		RandNoteOffsetTrim,
 		RandNoteStartOffset,
 		RandomChordReplacementKey,
 		RandVelVariation,
 		RootNoteOnly,
+		Seed,
 		TrackName,
 		TransposeThreshold,
 		Velocity,
@@ -194,6 +210,19 @@ public:
 
 	StatusCode CreateRandomFunkGrooveMIDICommandFile (std::string sOutFile, bool bOverwriteOutFile);
 
+	// Random Funk Groove, in bulk (-rfg with -count). The grooves are numbered
+	// after sOutFile, eg. groove_1.txt, groove_2.txt ..., and optionally
+	// rendered to groove_1.mid, groove_2.mid ... as they are made.
+	struct RandomFunkGrooveOptions
+	{
+		uint32_t nGrooves = 1;
+		uint32_t nThreads = 0;		// 0: one per hardware thread.
+		bool bRenderMIDI = false;
+	};
+
+	StatusCode CreateRandomFunkGrooves (const std::string& sOutFile, bool bOverwriteOutFile,
+		const RandomFunkGrooveOptions& options);
+
 	// Validate the command file.
 	StatusCode VerifyFile();
 
@@ -203,6 +232,56 @@ public:
 	// Whack out a dead simple MIDI file. Single track with just a few notes.
 	StatusCode CreateMIDIFile (const std::string& filename, bool bOverwriteOutFile);
 
+	// Same as CreateMIDIFile, but the Standard MIDI File bytes are returned in
+	// vMIDI (cleared first, capacity kept) and nothing is written to disk.
+	// Call once, after verifying the command file. For Auto-Melody, the melody
+	// text that CreateMIDIFile would save is available from GetMelodyText().
+	StatusCode CreateMIDIBuffer (std::vector<uint8_t>& vMIDI);
+
+	// In-process rendering: verify the command file and create the MIDI file
+	// in one call, without going through the command-line front-end.
+	static StatusCode Render (const std::string& sInFile, const std::string& sOutFile,
+		bool bOverwriteOutFile, std::string& sStatusMessage);
+
+	// In-process rendering of an in-memory command file to an in-memory MIDI file.
+	static StatusCode Render (const std::vector<std::string>& vCommandFile,
+		std::vector<uint8_t>& vMIDI, std::string& sStatusMessage);
+
+	// Watch mode (see CWatchRender). As CreateMIDIBuffer, but the note events
+	// of each section of the music data (a ruler line, up to the next one) are
+	// kept, so UpdateMIDIBuffer can regenerate just the sections that change.
+	// Call once, after VerifyMemFile (vFile).
+	StatusCode CreateSectionedMIDIBuffer (const std::vector<std::string>& vFile, std::vector<uint8_t>& vMIDI);
+
+	// vFile is an edited copy of the command file: verify and regenerate the
+	// sections that differ, and render the whole of it to vMIDI. Returns false,
+	// having changed nothing, if that can't be done (eg. a parameter was
+	// changed, or a changed section is not valid by itself); the file must
+	// then be verified and rendered from scratch, by a new CMIDIHandler.
+	// Only the note data is kept up to date, not the copy of the file used to
+	// write back the RCR history.
+	bool UpdateMIDIBuffer (const std::vector<std::string>& vFile, std::vector<uint8_t>& vMIDI);
+
+	size_t GetSectionCount() const { return _vSections.size(); }
+	size_t GetSectionsRegenerated() const { return _nSectionsRegenerated; }
+
+	const std::string& GetMelodyText() const { return _sMelodyText; }
+
+	// Seed the randomizer, so the same numbers are drawn every time (overrides
+	// +Seed). Call before verifying the command file.
+	void SetSeed (uint64_t nSeed);
+
+	// Whether a seed was given (+Seed or SetSeed), and the seed in use.
+	bool IsSeeded() const { return _bSeeded; }
+	uint64_t GetSeed() const { return _rng.GetSeed(); }
+
+	// True if any random numbers have been drawn, ie. (unless seeded) verifying
+	// or rendering the command file might not give the same result again.
+	bool UsedRandomNumbers() const { return _rng.GetDrawCount() > 0 || _bChordBankInit; }
+
+	// A seed (+Seed, or -seed on the command line): decimal, up to 64 bits.
+	static bool ParseSeed (const std::string& sValue, uint64_t& nSeed);
+
 	// Generate a copy of the input file, but with it containing a
 	// randomly-generated rhythm.
 	StatusCode CopyFileWithAutoRhythm (std::string filename, bool bOverwriteOutFile);
@@ -214,19 +293,55 @@ public:
 	// T2015A
 	void UsingAutoChords() { _bAutoChords = true; }
 
+	// T2O4GU Which notes of the MIDI file are converted. By default all tracks
+	// (and channels) are merged; format 2 patterns are placed one after another.
+	struct MIDIImportOptions
+	{
+		int32_t nTrack = -1;	// 1 to no. of tracks, or -1 for all tracks.
+		int32_t nChannel = -1;	// 1 to 16, or -1 for all channels.
+	};
+
 	// T2O4GU
-	StatusCode ConvertMIDIToSMFFTI (std::string inFile, std::string outFile, bool bOverwriteOutFile);
+	StatusCode ConvertMIDIToSMFFTI (std::string inFile, std::string outFile, bool bOverwriteOutFile,
+		const MIDIImportOptions& options);
 	std::string IsValidChordType (const std::vector<uint16_t>& vNotes, bool& bMinor);
 
-	StatusCode GenRandMelodies (std::string filename, bool bOverwriteOutFile);
+	// Identify root and chord type from any voicing of the chord's MIDI notes.
+	static bool IdentifyChord (const std::vector<uint16_t>& vNotes, uint8_t& nRootPitchClass, uint8_t& nType);
+	static bool IdentifyChord (uint8_t nBass, uint16_t nPitchClasses, uint8_t& nRootPitchClass, uint8_t& nType);
+
+	// Generic Randomized Melodies (-grm).
+	struct RandMelodyOptions
+	{
+		uint32_t nMelodies = 1000;
+		uint32_t nNotes = 64;						// Per melody.
+		std::vector<uint8_t> vScale = { 0, 2, 4, 7, 9 };	// Intervals (0 - 24) to choose from.
+		uint32_t nThreads = 0;						// 0: one per hardware thread.
+		uint32_t nShards = 1;						// No. of output files.
+	};
+
+	// With more than one shard, the melodies are split across files named
+	// after filename, eg. melodies_1.txt, melodies_2.txt ...
+	StatusCode GenRandMelodies (std::string filename, bool bOverwriteOutFile, const RandMelodyOptions& options);
 
 	std::string GetStatusMessage();
 
 	static std::string _version;
 
-	static std::map<std::string, uint8_t>& GetChromaticScale() { return _mChromaticScale; }
+	static const std::map<std::string, uint8_t>& GetChromaticScale() { return _mChromaticScale; }
 	bool GetChordIntervals (std::string sChordName, uint8_t& nRoot, std::vector<std::string>& vChordIntervals, std::string& sChordType);
 
+	// A chord name (eg. "Bbm7") compiled into what event generation needs, so
+	// chord names are parsed once, by VerifyMemFile, rather than per note event.
+	struct ChordSpec
+	{
+		uint8_t nRootPitchClass = 0;	// 0 (C) to 11 (B)
+		uint8_t nType = 0;				// Index into _vChordTypeInfo
+		uint8_t nNumIntervals = 0;
+		uint8_t aIntervals[4] = {};		// Semitones above the root, as per _mChordTypes
+	};
+	static bool ResolveChord (const std::string& sChordName, ChordSpec& chord);
+
 	// Set parameter inside a SMFFTI file. This is to facilitate batch
 	// command processing, eg. using a .bat file to execute multiple
 	// SMFFTI operations.
@@ -235,30 +350,40 @@ public:
 	std::vector<std::string> GetFileVec();
 
 private:
+	friend struct SortNoteEventsTest;	// tests/SMFFTITests.cpp
+
 	std::string GetRandomGroove (bool& bRandomGroove);
+
+	// The lines of a Random Funk Groove command file, from the current stream.
+	void MakeRandomFunkGroove (const std::string& sTrackName, std::vector<std::string>& vLines);
 	void GenerateNoteEvents();
-	void SortNoteEventsAndFixOverlaps();
-	void ApplyNoteStagger();
-	void ApplyArpeggiation();
-	void SortChordNotes();
-	void PushNoteEvents();
 
-	void AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, std::string chordName, bool& bNoteOn, uint32_t nEventTime);
-	int8_t NoteToMidi (std::string sNote, uint8_t& nNote, uint8_t& nSharpFlat);
+	// Add the note events of a note position line, which starts at nBar. nNote
+	// is the number of the note before it, and is updated to its last note.
+	void GenerateLineNoteEvents (size_t nItem, uint32_t nBar, int32_t& nNote, std::ostringstream& ofs);
 
-	StatusCode InitMidiFile (std::ofstream& ofs, const std::string& filename, bool bOverwriteOutFile);
-	void FinishMidiFile (std::ofstream& ofs);
+	// Bar where the first note position line starts.
+	uint32_t GetFirstBar() const;
 
-	uint32_t Swap32 (uint32_t n) const;
-	uint16_t Swap16 (uint16_t n) const;
+	// Furthest an event can be placed before the start of its note position line.
+	uint32_t GetMaxBackwardOffset() const;
+	void PushNoteEvents (size_t nCount);
 
-	std::string BitString (uint32_t n, uint32_t numBits) const;
-		
-	// Convert 32-bit integer to the MIDI "variable length" value and append to buffer.
-	void PushVariableValue (uint32_t n);
+	// Write out the note events before nHorizon, which are final.
+	void FlushNoteEvents (uint32_t nHorizon);
 
-	void PushInt8 (uint8_t n);
-	void PushText (const std::string& s);
+	// Post-process and write out the remaining note events, and end the track.
+	void FinishNoteEvents();
+
+	void AddMIDIChordNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, uint16_t nChordId, bool& bNoteOn, uint32_t nEventTime);
+
+	// Multi-part render: AddMIDIChordNoteEvents for each part. (Otherwise, just
+	// calls AddMIDIChordNoteEvents.)
+	void AddPartNoteEvents (int32_t nMelodyNote, uint32_t nNoteSeq, uint16_t nChordId, bool& bNoteOn, uint32_t nEventTime);
+	int8_t NoteToMidi (std::string sNote, uint8_t& nNote, uint8_t& nSharpFlat);
+
+	StatusCode InitMidiFile();
+	void FinishMidiFile (std::vector<uint8_t>& vMIDI);
 
 	std::vector<std::string> TokenizeNotePosStr (std::string notePosStr);
 
@@ -278,13 +403,43 @@ private:
 	std::vector<std::string> _vNotePositions;
 	std::vector<uint32_t> _vNotePosLineInFile;
 	std::vector<uint32_t> _vRulerLineInFile;
-	std::vector<std::string> _vChordNames;
-	std::vector<std::string> _vMelodyNotes;
+
+	// Each distinct chord name in the file is compiled once, into this table;
+	// chords are referred to by their index in it.
+	struct ChordSymbol
+	{
+		std::string sName;
+		ChordSpec spec;
+	};
+	std::vector<ChordSymbol> _vChordSymbols;
+	std::unordered_map<std::string, uint16_t> _mChordSymbolIds;
+
+	// Id of sChordName in _vChordSymbols, adding it if it's new. False if the
+	// table is full.
+	bool InternChord (const std::string& sChordName, const ChordSpec& chord, uint16_t& nId);
+
+	std::vector<uint16_t> _vChordIds;		// The chord progression, as written.
+
+	// A note of a note position line, as compiled by VerifyMemFile.
+	struct NoteSpan
+	{
+		uint32_t nStart = 0;		// 32nds from the start of the line
+		uint32_t nLength = 0;		// In 32nds
+		uint16_t nChordId = 0;		// Index into _vChordSymbols
+		int8_t nMelodyNote = -1;	// Semitones above the root, from the "M:" line; -1 if none
+		bool bRepeat = false;		// Starts with '#': repeats the chord of the note before
+	};
+	std::vector<std::vector<NoteSpan>> _vLineSpans;	// One list for each of _vNotePositions.
 	std::vector<uint32_t> _vBarCount;
 
 	// Track chunk storage
-	std::vector<byte> _vTrackBuf;
-	uint32_t _nOffset = 0;
+	CTrackWriter _trackWriter;
+	uint32_t _nPrevEventTime = 0;		// For delta-times.
+
+	// CreateMIDIFile: The track is written to the file whenever this many bytes
+	// are waiting in _trackWriter.
+	CSMFStreamWriter* _pStreamWriter = nullptr;
+	static const size_t _nStreamFlushBytes = 64 * 1024;
 
 	uint16_t _ticksPerQtrNote = 96;
 	uint16_t _ticksPer16th;
@@ -295,8 +450,6 @@ private:
 	uint32_t _currentTime = 0;
 
 	// Transitory values
-	uint32_t _nVal32 = 0;
-	uint16_t _nVal16 = 0;
 	std::string _sText = "";
 
 	uint8_t _nVelocity = 80;
@@ -334,7 +487,142 @@ private:
 	};
 	std::vector<MIDINote> _vMIDINoteEvents;
 
-	std::vector<MIDINote> _vMIDINoteEvents2;
+	// Stable sort by time, then Note Off before Note On, then key.
+	void SortNoteEvents (std::vector<MIDINote>& vEvents);
+
+	// Note event post-processing: a pipeline of stages, set up by
+	// InitNoteStages. Events pass through each stage once, in batches, on their
+	// way from _vMIDINoteEvents to the track writer.
+	//
+	// A stage function takes events from the front of stage.vIn (which is in
+	// time order, and is complete before nHorizon), adds the events it makes of
+	// them to stage.vOut (none earlier than the event it was made from, and
+	// leaving stage.vOut in time order), and returns the number of input events
+	// it has used up.
+	// Input it can't deal with yet, eg. a chord whose Note Offs are not
+	// complete, stays in stage.vIn until the next batch.
+	struct NoteStage;
+	typedef size_t (CMIDIHandler::*NoteStageFn)(NoteStage& stage, uint32_t nHorizon);
+	struct NoteStage
+	{
+		NoteStageFn pfnProcess = nullptr;
+		std::vector<MIDINote> vIn;
+		std::vector<MIDINote> vOut;
+
+		// Per-key state, for the overlap fixing stages.
+		bool aKeyNoteOn[128] = {};
+		uint32_t aKeyNoteOnSeq[128] = {};
+		uint32_t aKeyOffsToDelete[128] = {};
+	};
+	std::vector<NoteStage> _vNoteStages;
+
+	void InitNoteStages();
+
+	// Pass the events before nHorizon through the stages to the track writer.
+	void RunNoteStages (uint32_t nHorizon);
+
+	size_t FixRandomOffsetOverlaps (NoteStage& stage, uint32_t nHorizon);
+	size_t StaggerChordNotes (NoteStage& stage, uint32_t nHorizon);
+	size_t ArpeggiateChords (NoteStage& stage, uint32_t nHorizon);
+
+	// The arp pattern for the +Arpeggiator type and a chord of nNumNotes notes;
+	// from _vArpPatterns, unless the chord is bigger than any there.
+	const std::vector<uint8_t>& GetArpPattern (uint8_t nNumNotes);
+	std::vector<uint8_t> _vArpPatternBuf;
+	size_t FixArpeggioOverlaps (NoteStage& stage, uint32_t nHorizon);
+
+	// Number of notes in the chord (pair of Note On and Note Off sets) at the
+	// front of vEvents, from nItem; 0 if the pair is not complete before nHorizon.
+	static uint8_t CountChordPairNotes (const std::vector<MIDINote>& vEvents, size_t nItem, uint32_t nHorizon);
+
+	// Drop repeats of an event (same time, event and key), keeping the first,
+	// so each key is in a chord note set just once.
+	static void RemoveDuplicateNotes (std::vector<MIDINote>& vEvents);
+
+	// Multi-part render (+Parts): a format 1 file, with one track per part, all
+	// generated in one pass over the progression. The event list, track writer
+	// etc. of the part being generated are the ones above; SelectPart swaps
+	// them with those kept in the part.
+	enum class PartType : uint8_t
+	{
+		All,		// Single-track render.
+		Chords,
+		Bass,		// The chords' extra bass note (+BassNote), whether or not it's set.
+		Melody		// Melody line (M:) if there is one, otherwise Auto-Melody.
+	};
+	struct Part
+	{
+		PartType nType = PartType::Chords;
+		std::string sTrackName;
+		uint8_t nChannel = 0;
+
+		std::vector<MIDINote> vMIDINoteEvents;
+		CTrackWriter trackWriter;
+		uint32_t nPrevEventTime = 0;
+		std::vector<NoteStage> vNoteStages;
+	};
+	std::vector<Part> _vParts;
+	std::vector<uint8_t> _vPartChannels;		// +PartChannels (0-15)
+	std::vector<std::string> _vPartTrackNames;	// +PartTrackNames
+	size_t _nActivePart = 0;
+	PartType _nPartType = PartType::All;
+
+	void SelectPart (size_t nPart);
+	void SwapPartState (Part& part);
+
+	// Note stagger and arpeggiation apply only to chords.
+	bool IsChordPart() const { return _nPartType == PartType::All || _nPartType == PartType::Chords; }
+
+	bool HasPart (PartType nType) const
+	{
+		return std::any_of (_vParts.begin(), _vParts.end(), [nType](const Part& part) { return part.nType == nType; });
+	}
+
+	// Call fn with each part selected in turn (just once for a single-track render).
+	template <typename Fn> void ForEachPart (Fn fn)
+	{
+		if (_vParts.empty())
+		{
+			fn();
+			return;
+		}
+
+		for (size_t i = 0; i < _vParts.size(); i++)
+		{
+			SelectPart (i);
+			fn();
+		}
+	}
+
+	std::vector<MIDINote> _vSortBuf;	// Scratch for SortNoteEvents.
+
+	// Watch mode: the command file, as the lines before the first ruler line
+	// and a list of sections, each with the note events it generated.
+	struct Section
+	{
+		std::vector<std::string> vLines;
+		size_t nNotes = 0;
+		size_t nChords = 0;			// Its chords in _vChordIds.
+
+		// The events of each part (just one, for a single-track render), with
+		// times relative to the start of the section.
+		std::vector<std::vector<MIDINote>> vPartEvents;
+	};
+	std::vector<std::string> _vHeaderLines;
+	std::vector<Section> _vSections;
+	size_t _nSectionsRegenerated = 0;
+
+	// False if the music data can't be split into sections that can be
+	// verified by themselves, eg. it has comment blocks.
+	bool SplitSections (const std::vector<std::string>& vFile, std::vector<std::string>& vHeader,
+		std::vector<Section>& vSections) const;
+
+	// Generate the events of section nSection, which starts at nBar, and whose
+	// first note is nNote + 1.
+	void GenerateSectionEvents (size_t nSection, uint32_t nBar, int32_t nNote);
+
+	// Render the events of all the sections to vMIDI.
+	void RenderSections (std::vector<uint8_t>& vMIDI);
 
 	int32_t _nNoteCount = -1;
 	int8_t _nNoteStagger = 0;
@@ -357,6 +645,7 @@ private:
 	int8_t _nArpOctaveSteps = 0;	// Positive/negative values to transpose higher/lower
 
 	bool _bFunkStrum = false;
+	static const uint32_t _nFunkStrumNoteOffShorten = 3;	// Ticks; see also GetMaxBackwardOffset.
 	double _nFunkStrumUpStrokeAttenuation = 1.0;
 	uint8_t _nFunkStrumVelDeclineIncrement = 5;
 
@@ -364,6 +653,12 @@ private:
 	uint32_t _autoMelodyLineNum = 0;
 	std::vector<uint8_t> _vRandomMelodyNotes;
 	std::vector<std::string> _vMelodyChordNames;
+	std::string _sMelodySaveFile;
+	std::string _sMelodyText;
+
+	// Melody note of the current note-on, held until the matching note-off.
+	uint8_t _nFixedMelodyNote = 0;
+	uint8_t _nAutoMelodyNote = 0;
 
 	// +AllMelodyNotes: To output ALL possible melody notes
 	// as a "chord", in order to see all notes in MIDI files
@@ -376,8 +671,14 @@ private:
 
 	std::string _sStatusMessage = "";
 
-	// Randomizer
-	std::random_device _rdev;
+	// Randomizer (one per instance, so handlers can run concurrently). Seeded
+	// by +Seed or SetSeed, otherwise from std::random_device. Stream 0 is used
+	// while verifying, and for the other operations; each note position line
+	// is rendered with its own stream (see _nFirstLineStream).
+	CRandom _rng;
+	bool _bSeeded = false;		// By +Seed or SetSeed.
+	bool _bSeedSet = false;		// By SetSeed.
+	static const uint64_t _nFirstLineStream = 1;
 
 	// Auto-Rhythm (-ar): Three params for controlling the articulation
 	// of the groove/syncopation. The defaults set here are for a
@@ -407,6 +708,12 @@ private:
 
 	std::string sRuler = sRulerNew;
 
+	// Either type of ruler line.
+	bool IsRulerLine (const std::string& sLine) const
+	{
+		return sLine.substr (0, 32) == sRulerOld || sLine.substr (0, 31) == sRulerNew.substr (0, 31);
+	}
+
 	// Auto-chords: For *minor* keys, percentage bias for
 	// (i) root chord (2) other minor chords (3) major chords,
 	// respectively. If value less than 100, the remainder is
@@ -439,6 +746,10 @@ private:
 	uint8_t _iCB_ModInt = 0;
 	std::vector<uint8_t> _vChordBankChoice;
 
+	// Every chord that RCR can choose, from either chord bank, with the chance
+	// of it being chosen.
+	std::vector<CChordBank::ChordChance> _vRCRChoices;
+
 	// For RandomChordReplacement (RCR)
 	std::vector<std::string> _vInputCopy;
 	bool _bRCR = false;
@@ -462,22 +773,79 @@ private:
 
 	//---------------------------------------------------------------------
 	// Static class members
+	//
+	// These are built once by ClassMemberInit and are read-only from then on,
+	// so they can be shared by any number of concurrent handlers.
 
 	// Inner class hack for initializing class members.
 	static struct ClassMemberInit { ClassMemberInit(); } cmi;
 
 	static std::map<std::string, std::string>_mChordTypes;
 
+	// T2O4GU Same as _mChordTypes, but with the 9ths brought down within
+	// the octave, for identifying chord types in MIDI files.
+	static std::map<std::string, std::string>_mChordTypesInOctave;
+
 	// For each chord type, list of notes from the scale (semitone values)
 	// that can be used for auto-melody.
 	static std::map<std::string, std::vector<uint8_t>> _mMelodyNotes;
 
+	// As _mMelodyNotes, but major and minor chords also include a few instances
+	// of the additional notes from their pentatonic scale.
+	static std::map<std::string, std::vector<uint8_t>> _mMelodyNotesPentatonic;
+
+	// One entry per chord type in _mChordTypes (same order); ChordSpec::nType
+	// indexes this.
+	struct ChordTypeInfo
+	{
+		std::string sName;
+		const std::vector<uint8_t>* pMelodyNotes;
+		const std::vector<uint8_t>* pMelodyNotesPentatonic;
+	};
+	static std::vector<ChordTypeInfo> _vChordTypeInfo;
+	static std::map<std::string, uint8_t> _mChordTypeIds;
+
 	static std::map<std::string, uint8_t>_mChromaticScale;
 	static std::map<std::string, uint8_t>_mChromaticScale2;
 
+	// T2O4GU Chord recognition: Indexed by the pitch-class set of the notes
+	// relative to the lowest (bass) note, ie. bit n set if a note is n semitones
+	// (mod 12) above the bass. Where a set fits more than one chord (sus2/sus4,
+	// dim7), the entry has the root closest above the bass.
+	struct PitchClassSetEntry
+	{
+		uint8_t nRootOffset = 0;	// Root, in semitones above the bass.
+		uint8_t nType = 0xFF;		// Index into _vChordTypeInfo; 0xFF if not a chord.
+	};
+	static std::vector<PitchClassSetEntry> _vPitchClassSets;
+
+	// Arpeggiator patterns: the order in which the notes of a chord are played,
+	// as indices into the chord's notes (lowest first). Indexed by
+	// arp type * (_nMaxArpPatternNotes + 1) + number of notes.
+	static const uint8_t _nMaxArpPatternNotes = 16;
+	static std::vector<std::vector<uint8_t>> _vArpPatterns;
+	static void BuildArpPattern (uint32_t nMode, uint8_t nNumNotes, std::vector<uint8_t>& vArpSequence);
+
+	// Pitch class to note name, as per _mChromaticScale2.
+	static std::vector<std::string> _vPitchClassNames;
+
 	static std::vector<std::string> _vRFGChords;
 
-	static std::default_random_engine _eng;
+	// The distinct chords of _vRFGChords, and for each chord after the first,
+	// the entries of _vRFGChords (as indexes into _vRFGChordNames) allowed
+	// there: _vRFGCandidates[bLast * _vRFGChordNames.size() + nPrevChord].
+	static std::vector<std::string> _vRFGChordNames;
+	static std::vector<std::vector<uint8_t>> _vRFGCandidates;
+
+	// GetRandomGroove: recognises the patterns a random groove mustn't contain,
+	// a 1/16th at a time. aNext[token] (0 = note start "+#", 1 = note held "##",
+	// 2 = off "  ") is the next state, or -1 if the 1/16th completes a pattern.
+	// State 0 is the start.
+	struct GrooveFilterState
+	{
+		int8_t aNext[3] = { -1, -1, -1 };
+	};
+	static std::vector<GrooveFilterState> _vGrooveFilter;
 
 	static std::map<ParamCode, std::string> _mParamCodes;
 };
@@ -0,0 +1,32 @@
+#include "pch.h"
+#include "CRandom.h"
+
+namespace {
+
+uint64_t SplitMix64 (uint64_t& n)
+{
+	uint64_t z = (n += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+}
+
+uint64_t CRandom::RandomSeed()
+{
+	std::random_device rdev;
+	return (static_cast<uint64_t>(rdev()) << 32) ^ rdev();
+}
+
+void CRandom::Seed (uint64_t nSeed, uint64_t nStream)
+{
+	_nSeed = nSeed;
+
+	// Mix the stream number into the seed, then fill the state from it.
+	uint64_t n = nSeed;
+	uint64_t nStreamKey = nStream;
+	n ^= SplitMix64 (nStreamKey);
+	for (uint64_t& s : _s)
+		s = SplitMix64 (n);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+17/10/26 Randomizer: a xoshiro256** generator, set up (by way of splitmix64)
+from a 64-bit seed and a stream number. The same seed always gives the same
+numbers, and each stream (eg. one per note position line) is independent of
+the others, so it doesn't matter in which order, or on which thread, streams
+are used.
+
+	CRandom rng (nSeed);
+	uint32_t n = rng.Below (10);			// 0 - 9
+	int32_t nOffset = rng.Between (-5, 5);	// -5 - 5
+	rng.SetStream (nItem + 1);
+
+It is also a UniformRandomBitGenerator, for the std:: distributions.
+*/
+
+class CRandom
+{
+public:
+	typedef uint64_t result_type;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT64_MAX; }
+
+	// A seed from std::random_device, for when none is given.
+	static uint64_t RandomSeed();
+
+	explicit CRandom (uint64_t nSeed = 0, uint64_t nStream = 0) { Seed (nSeed, nStream); }
+
+	void Seed (uint64_t nSeed, uint64_t nStream = 0);
+	uint64_t GetSeed() const { return _nSeed; }
+
+	// Switch to another stream of the same seed.
+	void SetStream (uint64_t nStream) { Seed (_nSeed, nStream); }
+
+	result_type operator()()
+	{
+		uint64_t nResult = RotateLeft (_s[1] * 5, 7) * 9;
+		uint64_t t = _s[1] << 17;
+		_s[2] ^= _s[0];
+		_s[3] ^= _s[1];
+		_s[1] ^= _s[2];
+		_s[0] ^= _s[3];
+		_s[2] ^= t;
+		_s[3] = RotateLeft (_s[3], 45);
+		_nDraws++;
+		return nResult;
+	}
+
+	// 0 to n - 1 (n > 0), without bias: a multiply, and rarely a retry,
+	// instead of a division.
+	uint32_t Below (uint32_t n)
+	{
+		uint64_t m = ((*this)() >> 32) * n;
+		if (static_cast<uint32_t>(m) < n)
+		{
+			uint32_t nThreshold = (0u - n) % n;
+			while (static_cast<uint32_t>(m) < nThreshold)
+				m = ((*this)() >> 32) * n;
+		}
+		return static_cast<uint32_t>(m >> 32);
+	}
+
+	// nLow to nHigh, inclusive.
+	int32_t Between (int32_t nLow, int32_t nHigh)
+	{
+		return nLow + static_cast<int32_t>(Below (static_cast<uint32_t>(nHigh - nLow) + 1));
+	}
+
+	// 0 (inclusive) to 1 (exclusive), from the top 53 bits.
+	double Uniform()
+	{
+		return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// Numbers drawn since construction, from all streams.
+	uint64_t GetDrawCount() const { return _nDraws; }
+
+protected:
+	static uint64_t RotateLeft (uint64_t n, int k) { return (n << k) | (n >> (64 - k)); }
+
+	uint64_t _nSeed = 0;
+	uint64_t _s[4];
+	uint64_t _nDraws = 0;
+};
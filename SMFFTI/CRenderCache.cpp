@@ -0,0 +1,285 @@
+#include "pch.h"
+#include "CRenderCache.h"
+#include "Common.h"
+
+namespace {
+
+const char _szMagic[] = "SMFFTIRC";
+const size_t _nMagicLen = 8;
+
+// 64-bit FNV-1a.
+uint64_t HashKey (const std::string& sKey)
+{
+	uint64_t nHash = 0xCBF29CE484222325ULL;
+	for (unsigned char c : sKey)
+	{
+		nHash ^= c;
+		nHash *= 0x100000001B3ULL;
+	}
+	return nHash;
+}
+
+bool ReadFile (const std::string& sFile, std::vector<uint8_t>& v)
+{
+	std::ifstream ifs (sFile, std::ios::binary);
+	if (!ifs.is_open())
+		return false;
+
+	v.assign (std::istreambuf_iterator<char> (ifs), std::istreambuf_iterator<char>());
+	return !ifs.bad();
+}
+
+struct CacheEntry
+{
+	std::filesystem::path path;
+	std::filesystem::file_time_type tUsed;
+	uint64_t nSize;
+};
+
+// The entries in sDir, and their total size.
+uint64_t ListEntries (const std::string& sDir, std::vector<CacheEntry>* pEntries)
+{
+	uint64_t nTotal = 0;
+	std::error_code ec;
+	for (const auto& dirEntry : std::filesystem::directory_iterator (sDir, ec))
+	{
+		if (dirEntry.path().extension() != ".rcache")
+			continue;
+
+		CacheEntry entry;
+		entry.path = dirEntry.path();
+		entry.tUsed = dirEntry.last_write_time (ec);
+		entry.nSize = dirEntry.file_size (ec);
+		if (ec)
+			continue;
+
+		nTotal += entry.nSize;
+		if (pEntries)
+			pEntries->push_back (entry);
+	}
+	return nTotal;
+}
+
+bool WriteFile (const std::string& sFile, const std::vector<uint8_t>& v)
+{
+	std::ofstream ofs (sFile, std::ios::binary | std::ios::trunc);
+	if (!ofs.is_open())
+		return false;
+
+	ofs.write (reinterpret_cast<const char*>(v.data()), v.size());
+	ofs.close();
+	return !ofs.fail();
+}
+
+}
+
+CRenderCache::CRenderCache (const std::string& sDir, uint64_t nMaxBytes)
+	: _sDir (sDir), _nMaxBytes (nMaxBytes)
+{
+	_nTotalBytes = ListEntries (_sDir, nullptr);
+}
+
+void CRenderCache::SetSeed (uint64_t nSeed)
+{
+	_bSeedSet = true;
+	_nSeed = nSeed;
+}
+
+bool CRenderCache::MakeKey (const std::vector<std::string>& vFile, std::string& sKey) const
+{
+	// (A +Seed parameter is part of the file text.)
+	std::ostringstream ss;
+	ss << "SMFFTI v" << CMIDIHandler::_version << "\nSeed ";
+	if (_bSeedSet)
+		ss << _nSeed << "\n";
+	else
+		ss << "-\n";
+
+	// Skip what VerifyMemFile skips.
+	bool bCommentBlock = false;
+	for (const auto& sLine : vFile)
+	{
+		std::string sTemp = akl::RemoveWhitespace (sLine, 4);
+
+		if (sTemp.find ("(#") == 0)
+		{
+			bCommentBlock = true;
+			continue;
+		}
+		if (sTemp.size() >= 2 && sTemp.find ("#)") == sTemp.size() - 2)
+		{
+			bCommentBlock = false;
+			continue;
+		}
+		if (bCommentBlock || sTemp.empty() || sTemp[0] == '#')
+			continue;
+
+		if (sTemp[0] == '+' && sTemp.find ('=') != std::string::npos)
+		{
+			// Parameter. Spaces inside the value are kept (eg. +TrackName).
+			size_t nPos = sLine.find ('=');
+			std::string sName = akl::RemoveWhitespace (sLine.substr (0, nPos), 4);
+			std::string sValue = akl::RemoveWhitespace (sLine.substr (nPos + 1), 3);
+
+			// RCR writes the chord progression history back to the command file.
+			if (sName == "+RandomChordReplacementKey")
+				return false;
+
+			ss << sName << '=' << sValue << '\n';
+		}
+		else if (sTemp.find_first_not_of ("+#$.|[]") == std::string::npos)
+		{
+			// Ruler or note positions, where the spaces count.
+			ss << akl::RemoveWhitespace (sLine, 2) << '\n';
+		}
+		else
+		{
+			// Chords (or a melody line).
+			ss << sTemp << '\n';
+		}
+	}
+
+	sKey = ss.str();
+	return true;
+}
+
+std::string CRenderCache::GetEntryFile (const std::string& sKey) const
+{
+	std::ostringstream ss;
+	ss << std::hex << std::setw (16) << std::setfill ('0') << HashKey (sKey) << ".rcache";
+	return (std::filesystem::path (_sDir) / ss.str()).string();
+}
+
+bool CRenderCache::Lookup (const std::string& sKey, std::vector<uint8_t>& vMIDI)
+{
+	std::string sFile = GetEntryFile (sKey);
+
+	std::vector<uint8_t> vEntry;
+	bool bHit = ReadFile (sFile, vEntry) && vEntry.size() >= _nMagicLen + 4
+		&& std::memcmp (vEntry.data(), _szMagic, _nMagicLen) == 0;
+
+	if (bHit)
+	{
+		const uint8_t* p = vEntry.data() + _nMagicLen;
+		size_t nKeyLen = (size_t (p[0]) << 24) | (size_t (p[1]) << 16) | (size_t (p[2]) << 8) | p[3];
+		size_t nStart = _nMagicLen + 4 + nKeyLen;
+		bHit = nStart <= vEntry.size() && nKeyLen == sKey.size()
+			&& std::memcmp (p + 4, sKey.data(), nKeyLen) == 0;
+
+		if (bHit)
+			vMIDI.assign (vEntry.begin() + nStart, vEntry.end());
+	}
+
+	if (!bHit)
+	{
+		_nMisses++;
+		return false;
+	}
+
+	// Mark it as recently used, for Evict.
+	std::error_code ec;
+	std::filesystem::last_write_time (sFile, std::filesystem::file_time_type::clock::now(), ec);
+
+	_nHits++;
+	return true;
+}
+
+void CRenderCache::Store (const std::string& sKey, const std::vector<uint8_t>& vMIDI)
+{
+	std::vector<uint8_t> vEntry (_szMagic, _szMagic + _nMagicLen);
+	CTrackWriter::Append32 (vEntry, static_cast<uint32_t>(sKey.size()));
+	vEntry.insert (vEntry.end(), sKey.begin(), sKey.end());
+	vEntry.insert (vEntry.end(), vMIDI.begin(), vMIDI.end());
+
+	std::lock_guard<std::mutex> lock (_mutex);
+
+	std::error_code ec;
+	std::filesystem::create_directories (_sDir, ec);
+
+	// Written under another name first, so a reader never sees half an entry.
+	std::string sFile = GetEntryFile (sKey);
+	std::string sTempFile = sFile + ".tmp";
+	if (!WriteFile (sTempFile, vEntry))
+	{
+		std::filesystem::remove (sTempFile, ec);
+		return;		// Not cached; not an error.
+	}
+
+	// (It may replace an entry with the same key.)
+	uint64_t nReplaced = std::filesystem::file_size (sFile, ec);
+	if (ec)
+		nReplaced = 0;
+	std::filesystem::rename (sTempFile, sFile, ec);
+	if (ec)
+		return;
+
+	_nTotalBytes += vEntry.size() - (std::min<uint64_t>) (nReplaced, _nTotalBytes);
+	if (_nTotalBytes > _nMaxBytes)
+		Evict();
+}
+
+void CRenderCache::Evict()
+{
+	// (The running total is corrected here too, eg. if another process has
+	// changed the cache.)
+	std::vector<CacheEntry> vEntries;
+	_nTotalBytes = ListEntries (_sDir, &vEntries);
+	if (_nTotalBytes <= _nMaxBytes)
+		return;
+
+	std::sort (vEntries.begin(), vEntries.end(),
+		[](const CacheEntry& a, const CacheEntry& b) { return a.tUsed < b.tUsed; });
+
+	std::error_code ec;
+	for (const auto& entry : vEntries)
+	{
+		if (_nTotalBytes <= _nMaxBytes)
+			break;
+
+		if (std::filesystem::remove (entry.path, ec))
+			_nTotalBytes -= entry.nSize;
+	}
+}
+
+CMIDIHandler::StatusCode CRenderCache::Render (const std::string& sInFile, const std::string& sOutFile,
+	bool bOverwriteOutFile, std::string& sStatusMessage)
+{
+	std::vector<std::string> vFile;
+	std::string sKey;
+	std::vector<uint8_t> vMIDI;
+	bool bCacheable = false;
+
+	// (Errors, eg. an existing output file, are left to the render to report.)
+	if (akl::MyFileExists (sInFile) && (bOverwriteOutFile || !akl::MyFileExists (sOutFile)))
+	{
+		akl::LoadTextFileIntoVector (sInFile, vFile);
+		bCacheable = MakeKey (vFile, sKey);
+
+		if (bCacheable && Lookup (sKey, vMIDI) && WriteFile (sOutFile, vMIDI))
+		{
+			sStatusMessage.clear();
+			return CMIDIHandler::StatusCode::Success;
+		}
+	}
+
+	CMIDIHandler midiH (sInFile);
+	if (_bSeedSet)
+		midiH.SetSeed (_nSeed);
+
+	CMIDIHandler::StatusCode nRes = midiH.VerifyFile();
+	if (nRes == CMIDIHandler::StatusCode::Success)
+		nRes = midiH.CreateMIDIFile (sOutFile, bOverwriteOutFile);
+
+	sStatusMessage = midiH.GetStatusMessage();
+
+	// Keep it only if the same file would be rendered again (and the
+	// command file wasn't changed since the key was made).
+	if (nRes == CMIDIHandler::StatusCode::Success && bCacheable
+		&& (midiH.IsSeeded() || !midiH.UsedRandomNumbers()) && midiH.GetMelodyText().empty()
+		&& midiH.GetFileVec() == vFile && ReadFile (sOutFile, vMIDI))
+	{
+		Store (sKey, vMIDI);
+	}
+
+	return nRes;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "CMIDIHandler.h"
+
+/*
+17/10/26 On-disk render cache (-cache <dir>). A rendered MIDI file is stored
+under a hash of its key: the normalized command file (comments, comment blocks,
+blank lines and insignificant whitespace removed), the version and the seed of
+the randomizer. A hit is written straight to the output file, without the
+command file being verified or rendered.
+
+Only renders that can be repeated are stored: seeded ones (+Seed or -seed), and
+ones that use no random numbers. Files with +RandomChordReplacementKey, which
+write back to themselves, and Auto-Melody renders, which save the melody to
+another file, are not cached. When the cache grows beyond its size limit, the least recently used
+entries are removed. (The size of the cache is counted once, when it's opened,
+and kept up to date as entries are stored, so the directory is only listed again
+when entries have to be removed.)
+
+Entry file: "SMFFTIRC", key length (4 bytes), key, MIDI file. The key is
+compared in full, so hash collisions can't give a wrong file.
+*/
+
+class CRenderCache
+{
+public:
+	static const uint64_t _nDefaultMaxBytes = 256 * 1024 * 1024;
+
+	CRenderCache (const std::string& sDir, uint64_t nMaxBytes = _nDefaultMaxBytes);
+
+	// Seed every render (as CMIDIHandler::SetSeed).
+	void SetSeed (uint64_t nSeed);
+
+	// The cache key of a command file; false if it must not be cached.
+	bool MakeKey (const std::vector<std::string>& vFile, std::string& sKey) const;
+
+	bool Lookup (const std::string& sKey, std::vector<uint8_t>& vMIDI);
+	void Store (const std::string& sKey, const std::vector<uint8_t>& vMIDI);
+
+	// As CMIDIHandler::Render, but through the cache.
+	CMIDIHandler::StatusCode Render (const std::string& sInFile, const std::string& sOutFile,
+		bool bOverwriteOutFile, std::string& sStatusMessage);
+
+	uint32_t GetHitCount() const { return _nHits; }
+	uint32_t GetMissCount() const { return _nMisses; }
+
+protected:
+	std::string GetEntryFile (const std::string& sKey) const;
+
+	// Remove least recently used entries until the cache fits in _nMaxBytes.
+	void Evict();
+
+	std::string _sDir;
+	uint64_t _nMaxBytes;
+	uint64_t _nTotalBytes = 0;	// Of the entries in _sDir.
+	bool _bSeedSet = false;
+	uint64_t _nSeed = 0;
+
+	// Batch renders share the cache between threads.
+	std::mutex _mutex;
+	std::atomic<uint32_t> _nHits {0};
+	std::atomic<uint32_t> _nMisses {0};
+};
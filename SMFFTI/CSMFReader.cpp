@@ -0,0 +1,199 @@
+#include "pch.h"
+#include "CSMFReader.h"
+
+bool CSMFReader::Open (const std::string& sFile)
+{
+	std::ifstream ifs (sFile, std::ios::binary | std::ios::ate);
+	if (!ifs.is_open())
+	{
+		_sStatusMessage = "Unable to open MIDI file.";
+		return false;
+	}
+
+	std::vector<uint8_t> vData (static_cast<size_t>(ifs.tellg()));
+	ifs.seekg (0);
+	ifs.read (reinterpret_cast<char*>(vData.data()), vData.size());
+
+	return Load (std::move (vData));
+}
+
+bool CSMFReader::Load (std::vector<uint8_t> vData)
+{
+	_vData = std::move (vData);
+	_vTracks.clear();
+	return ReadChunks();
+}
+
+bool CSMFReader::ReadChunks()
+{
+	const uint8_t* p = _vData.data();
+	const uint8_t* pEnd = p + _vData.size();
+
+	// ------------------------------------------------------------------------------
+	// HEADER CHUNK: "MThd", length (6 or more), format, no. tracks, division.
+	if (pEnd - p < 14 || std::string (p, p + 4) != "MThd" || Read32 (p + 4) < 6)
+	{
+		_sStatusMessage = "Not a Standard MIDI File (no MThd header).";
+		return false;
+	}
+
+	uint32_t nHeaderLen = Read32 (p + 4);
+	_nFormat = Read16 (p + 8);
+	uint16_t nNumberTracks = Read16 (p + 10);
+	_nDivision = Read16 (p + 12);
+
+	if (static_cast<size_t>(pEnd - p) - 8 < nHeaderLen)
+	{
+		_sStatusMessage = "MIDI file header is truncated.";
+		return false;
+	}
+	p += 8 + nHeaderLen;
+
+	// ------------------------------------------------------------------------------
+	// TRACK CHUNKS. Chunks of any other type are skipped.
+	while (pEnd - p >= 8 && _vTracks.size() < nNumberTracks)
+	{
+		bool bTrack = std::string (p, p + 4) == "MTrk";
+		uint32_t nLen = Read32 (p + 4);
+		p += 8;
+
+		if (static_cast<size_t>(pEnd - p) < nLen)
+		{
+			_sStatusMessage = "MIDI file track chunk is truncated.";
+			return false;
+		}
+
+		if (bTrack)
+			_vTracks.push_back (Span (p, nLen));
+
+		p += nLen;
+	}
+
+	if (_vTracks.size() < nNumberTracks)
+	{
+		_sStatusMessage = "MIDI file has fewer track chunks than its header specifies.";
+		return false;
+	}
+
+	return true;
+}
+
+bool CSMFReader::TrackReader::ReadByte (uint8_t& n)
+{
+	if (_nPos >= _track.size())
+		return false;
+
+	n = _track[_nPos++];
+	return true;
+}
+
+bool CSMFReader::TrackReader::ReadVariableValue (uint32_t& n)
+{
+	// Up to 4 bytes, 7 bits each, most significant first; the top bit is set
+	// on all but the last byte.
+	n = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		uint8_t nByte;
+		if (!ReadByte (nByte))
+			return false;
+
+		n = (n << 7) | (nByte & 0x7F);
+		if ((nByte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+bool CSMFReader::TrackReader::ReadSpan (size_t nLen, Span& span)
+{
+	if (_track.size() - _nPos < nLen)
+		return false;
+
+	span = Span (_track.pData + _nPos, nLen);
+	_nPos += nLen;
+	return true;
+}
+
+bool CSMFReader::TrackReader::NextEvent (Event& ev)
+{
+	if (_bEndOfTrack || _bError || _nPos >= _track.size())
+		return false;
+
+	auto Fail = [this]()
+	{
+		_bError = true;
+		return false;
+	};
+
+	uint32_t nDeltaTime;
+	uint8_t nStatus;
+	if (!ReadVariableValue (nDeltaTime) || !ReadByte (nStatus))
+		return Fail();
+
+	_nTime += nDeltaTime;
+
+	ev.nTime = _nTime;
+	ev.nData1 = 0;
+	ev.nData2 = 0;
+	ev.nMetaType = 0;
+	ev.data = Span();
+
+	// "Running Status": There might not always be a status value -
+	// we apply the previous one, and the byte is the first data byte.
+	bool bRunningStatus = false;
+	if (nStatus < 0x80)
+	{
+		if (_nRunningStatus == 0)
+			return Fail();
+
+		ev.nData1 = nStatus;
+		nStatus = _nRunningStatus;
+		bRunningStatus = true;
+	}
+
+	ev.nStatus = nStatus;
+
+	if (nStatus == 0xFF)
+	{
+		// Meta event: type, length, data.
+		uint32_t nLen;
+		if (!ReadByte (ev.nMetaType) || !ReadVariableValue (nLen) || !ReadSpan (nLen, ev.data))
+			return Fail();
+
+		if (ev.nMetaType == 0x2F)
+			_bEndOfTrack = true;
+
+		_nRunningStatus = 0;
+	}
+	else if (nStatus == 0xF0 || nStatus == 0xF7)
+	{
+		// SysEx: length, data.
+		uint32_t nLen;
+		if (!ReadVariableValue (nLen) || !ReadSpan (nLen, ev.data))
+			return Fail();
+
+		_nRunningStatus = 0;
+	}
+	else if (nStatus >= 0xF0)
+	{
+		// System common/real-time messages don't belong in a MIDI file.
+		return Fail();
+	}
+	else
+	{
+		// Channel message: Program Change and Channel Pressure have one data
+		// byte, the others two.
+		if (!bRunningStatus && !ReadByte (ev.nData1))
+			return Fail();
+
+		uint8_t nType = nStatus & 0xF0;
+		if (nType != 0xC0 && nType != 0xD0 && !ReadByte (ev.nData2))
+			return Fail();
+
+		_nRunningStatus = nStatus;
+	}
+
+	return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+/*
+17/10/26 Standard MIDI File reader. The whole file is read into one buffer;
+header and track chunks, and the events within a track, are then read in place
+through Spans (pointer + size) without further copying. All reads are bounds
+checked, so a truncated or corrupt file gives an error rather than reading past
+the end of the buffer.
+
+	CSMFReader smf;
+	if (!smf.Open ("clip.mid"))
+		... smf.GetStatusMessage()
+
+	for (uint16_t i = 0; i < smf.GetNumTracks(); i++)
+	{
+		CSMFReader::TrackReader track = smf.GetTrack (i);
+		CSMFReader::Event ev;
+		while (track.NextEvent (ev))
+			...
+		if (track.Error())
+			...
+	}
+*/
+
+class CSMFReader
+{
+public:
+	// View of bytes inside the file buffer.
+	struct Span
+	{
+		const uint8_t* pData = nullptr;
+		size_t nSize = 0;
+
+		Span() {}
+		Span (const uint8_t* p, size_t n) : pData (p), nSize (n) {}
+
+		const uint8_t* begin() const { return pData; }
+		const uint8_t* end() const { return pData + nSize; }
+		size_t size() const { return nSize; }
+		bool empty() const { return nSize == 0; }
+		uint8_t operator[] (size_t i) const { return pData[i]; }
+	};
+
+	struct Event
+	{
+		uint32_t nTime = 0;		// Absolute time, in ticks.
+		uint8_t nStatus = 0;	// Status byte, including channel. (Running status resolved.)
+		uint8_t nData1 = 0;		// Channel messages: eg. note number.
+		uint8_t nData2 = 0;		// Channel messages: eg. velocity.
+		uint8_t nMetaType = 0;	// Meta events (nStatus 0xFF) only.
+		Span data;				// Meta event and SysEx payload.
+
+		uint8_t GetType() const { return nStatus & 0xF0; }
+		uint8_t GetChannel() const { return nStatus & 0x0F; }
+		bool IsMeta() const { return nStatus == 0xFF; }
+	};
+
+	// Reads the <delta-time><event> pairs of one track chunk.
+	class TrackReader
+	{
+	public:
+		TrackReader (Span track) : _track (track) {}
+
+		// Next event, or false at end of track (after the End Of Track meta event,
+		// or at the end of the chunk data) or on error.
+		bool NextEvent (Event& ev);
+
+		bool Error() const { return _bError; }
+
+	protected:
+		bool ReadByte (uint8_t& n);
+		bool ReadVariableValue (uint32_t& n);
+		bool ReadSpan (size_t nLen, Span& span);
+
+		Span _track;
+		size_t _nPos = 0;
+		uint32_t _nTime = 0;
+		uint8_t _nRunningStatus = 0;
+		bool _bEndOfTrack = false;
+		bool _bError = false;
+	};
+
+	// The track Spans point into _vData: a copy would point into the original's
+	// buffer, but a move keeps the buffer (and so its address).
+	CSMFReader() = default;
+	CSMFReader (const CSMFReader&) = delete;
+	CSMFReader& operator= (const CSMFReader&) = delete;
+	CSMFReader (CSMFReader&&) = default;
+	CSMFReader& operator= (CSMFReader&&) = default;
+
+	// Read the file into the buffer and enumerate its chunks.
+	bool Open (const std::string& sFile);
+
+	// Same as Open, from a file already in memory.
+	bool Load (std::vector<uint8_t> vData);
+
+	// Header chunk:
+	//	Format 0 = single track, 1 = simultaneous tracks, 2 = independent patterns.
+	//	Division: bit 15 = 0: ticks per quarter note; 1: SMPTE format.
+	uint16_t GetFormat() const { return _nFormat; }
+	uint16_t GetNumTracks() const { return static_cast<uint16_t>(_vTracks.size()); }
+	uint16_t GetDivision() const { return _nDivision; }
+
+	Span GetTrackData (uint16_t nTrack) const { return _vTracks[nTrack]; }
+	TrackReader GetTrack (uint16_t nTrack) const { return TrackReader (_vTracks[nTrack]); }
+
+	std::string GetStatusMessage() const { return _sStatusMessage; }
+
+	// Big-endian values.
+	static uint32_t Read32 (const uint8_t* p) { return (uint32_t (p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+	static uint16_t Read16 (const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+
+protected:
+	bool ReadChunks();
+
+	std::vector<uint8_t> _vData;
+	std::vector<Span> _vTracks;
+
+	uint16_t _nFormat = 0;
+	uint16_t _nDivision = 0;
+
+	std::string _sStatusMessage;
+};
@@ -0,0 +1,121 @@
+#include "pch.h"
+#include "CSMFStreamWriter.h"
+
+bool CSMFStreamWriter::Open (const std::string& sFile, uint16_t nFormat, uint16_t nNumTracks, uint16_t nDivision)
+{
+	_sFile = sFile;
+	_ofs.open (sFile, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!_ofs.is_open())
+	{
+		_sStatusMessage = "Unable to create output file.";
+		return false;
+	}
+
+	//-------------------------------------------------------------------------
+	// HEADER
+	uint8_t header[14] = { 'M', 'T', 'h', 'd',
+		0, 0, 0, 6,											// Header length; always 6
+		uint8_t (nFormat >> 8), uint8_t (nFormat),
+		uint8_t (nNumTracks >> 8), uint8_t (nNumTracks),
+		uint8_t (nDivision >> 8), uint8_t (nDivision) };
+	_ofs.write (reinterpret_cast<const char*>(header), sizeof (header));
+
+	return true;
+}
+
+void CSMFStreamWriter::BeginTrack()
+{
+	_ofs.write ("MTrk", 4);
+	_nLengthPos = _ofs.tellp();
+	_ofs.write ("\0\0\0\0", 4);		// Chunk length, patched by EndTrack.
+	_nTrackLen = 0;
+}
+
+void CSMFStreamWriter::WriteTrackData (CTrackWriter& track)
+{
+	const std::vector<uint8_t>& vData = track.GetData();
+	_ofs.write (reinterpret_cast<const char*>(vData.data()), vData.size());
+	_nTrackLen += static_cast<uint32_t>(vData.size());
+	track.Clear();
+}
+
+void CSMFStreamWriter::EndTrack (CTrackWriter& track)
+{
+	WriteTrackData (track);
+
+	std::streampos nEndPos = _ofs.tellp();
+	_ofs.seekp (_nLengthPos);
+
+	uint8_t length[4] = { uint8_t (_nTrackLen >> 24), uint8_t (_nTrackLen >> 16), uint8_t (_nTrackLen >> 8), uint8_t (_nTrackLen) };
+	_ofs.write (reinterpret_cast<const char*>(length), sizeof (length));
+
+	_ofs.seekp (nEndPos);
+}
+
+void CSMFStreamWriter::SpoolTrackData (size_t nTrack, CTrackWriter& track)
+{
+	if (nTrack >= _vSpools.size())
+		_vSpools.resize (nTrack + 1);
+
+	Spool& spool = _vSpools[nTrack];
+	if (!spool.fs.is_open())
+	{
+		spool.sFile = _sFile + ".track" + std::to_string (nTrack) + ".tmp";
+		spool.fs.open (spool.sFile, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+		if (!spool.fs.is_open())
+			_bSpoolFailed = true;
+	}
+
+	const std::vector<uint8_t>& vData = track.GetData();
+	spool.fs.write (reinterpret_cast<const char*>(vData.data()), vData.size());
+	spool.nLen += static_cast<uint32_t>(vData.size());
+	track.Clear();
+}
+
+void CSMFStreamWriter::WriteSpooledTrack (size_t nTrack, CTrackWriter& track)
+{
+	BeginTrack();
+
+	if (nTrack < _vSpools.size() && _vSpools[nTrack].nLen > 0)
+	{
+		Spool& spool = _vSpools[nTrack];
+		spool.fs.seekg (0);
+		_ofs << spool.fs.rdbuf();
+		if (spool.fs.fail())
+			_bSpoolFailed = true;
+		_nTrackLen += spool.nLen;
+	}
+
+	EndTrack (track);
+}
+
+bool CSMFStreamWriter::Close()
+{
+	_ofs.close();
+	RemoveSpools();
+	if (_ofs.fail() || _bSpoolFailed)
+	{
+		_sStatusMessage = "Error writing output file.";
+		return false;
+	}
+	return true;
+}
+
+CSMFStreamWriter::~CSMFStreamWriter()
+{
+	RemoveSpools();
+}
+
+void CSMFStreamWriter::RemoveSpools()
+{
+	std::error_code ec;
+	for (auto& spool : _vSpools)
+	{
+		if (!spool.fs.is_open())
+			continue;
+
+		spool.fs.close();
+		std::filesystem::remove (spool.sFile, ec);
+	}
+	_vSpools.clear();
+}
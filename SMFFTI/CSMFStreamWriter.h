@@ -0,0 +1,85 @@
+#pragma once
+
+#include "CTrackWriter.h"
+
+/*
+17/10/26 Standard MIDI File stream writer. Writes the header chunk when the file
+is opened; each track chunk is then written as its events are produced, so the
+whole file never has to be held in memory. The track chunk length isn't known
+until the track ends, so a placeholder is written and then patched by seeking
+back to it.
+
+	CSMFStreamWriter smf;
+	if (!smf.Open ("out.mid", 0, 1, 96))
+		... smf.GetStatusMessage()
+
+	CTrackWriter track;
+	smf.BeginTrack();
+	while (...)
+	{
+		track.ChannelEvent (...);
+		smf.WriteTrackData (track);		// or when track.GetData().size() is large
+	}
+	track.EndOfTrack();
+	smf.EndTrack (track);
+	smf.Close();
+
+Format 1: the tracks are generated together, but each chunk has to follow the
+one before it in the file. So the first track is written straight to the file,
+and each of the others to a temporary file ("<out>.trackN.tmp") until the first
+has ended; WriteSpooledTrack then copies it into the file.
+
+	smf.SpoolTrackData (1, track2);		// while generating
+	...
+	smf.EndTrack (track1);
+	track2.EndOfTrack();
+	smf.WriteSpooledTrack (1, track2);
+*/
+
+class CSMFStreamWriter
+{
+public:
+	// Create the file and write the header chunk.
+	bool Open (const std::string& sFile, uint16_t nFormat, uint16_t nNumTracks, uint16_t nDivision);
+
+	// Write the track chunk type and a placeholder length.
+	void BeginTrack();
+
+	// Write the track writer's data to the file, and clear it.
+	void WriteTrackData (CTrackWriter& track);
+
+	// Write any remaining data (which should end with End Of Track), then
+	// patch the chunk length.
+	void EndTrack (CTrackWriter& track);
+
+	// Write the track writer's data to track nTrack's temporary file, and clear it.
+	void SpoolTrackData (size_t nTrack, CTrackWriter& track);
+
+	// Write track nTrack: its temporary file, then any remaining data.
+	void WriteSpooledTrack (size_t nTrack, CTrackWriter& track);
+
+	// False if any write failed. Removes the temporary files.
+	bool Close();
+
+	~CSMFStreamWriter();
+
+	std::string GetStatusMessage() const { return _sStatusMessage; }
+
+protected:
+	struct Spool
+	{
+		std::string sFile;
+		std::fstream fs;
+		uint32_t nLen = 0;
+	};
+
+	void RemoveSpools();
+
+	std::string _sFile;
+	std::ofstream _ofs;
+	std::streampos _nLengthPos = 0;		// Where the current track's length goes.
+	uint32_t _nTrackLen = 0;
+	std::vector<Spool> _vSpools;		// By track number.
+	bool _bSpoolFailed = false;
+	std::string _sStatusMessage;
+};
@@ -0,0 +1,28 @@
+#include "pch.h"
+#include "CTrackWriter.h"
+
+void CTrackWriter::MetaEvent (uint32_t nDeltaTime, uint8_t nType, const void* pData, uint32_t nDataLen)
+{
+	// <delta-time> FF <type> <length> <data>
+	uint8_t buf[10];
+	size_t nLen = EncodeVariableValue (nDeltaTime, buf);
+	buf[nLen++] = 0xFF;
+	buf[nLen++] = nType;
+	nLen += EncodeVariableValue (nDataLen, buf + nLen);
+
+	_vData.insert (_vData.end(), buf, buf + nLen);
+
+	auto bytes = reinterpret_cast<const uint8_t*>(pData);
+	if (nDataLen)
+		_vData.insert (_vData.end(), bytes, bytes + nDataLen);
+}
+
+void CTrackWriter::AppendChunk (std::vector<uint8_t>& vMIDI) const
+{
+	vMIDI.reserve (vMIDI.size() + 8 + _vData.size());
+
+	const char* pChunkType = "MTrk";
+	vMIDI.insert (vMIDI.end(), pChunkType, pChunkType + 4);
+	Append32 (vMIDI, static_cast<uint32_t>(_vData.size()));		// Chunk length.
+	vMIDI.insert (vMIDI.end(), _vData.begin(), _vData.end());	// Chunk data.
+}
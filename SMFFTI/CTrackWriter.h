@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+17/10/26 Standard MIDI File track chunk writer. Builds the <delta-time><event>
+pairs of one track chunk in a byte buffer, which keeps its capacity between
+tracks/renders. Reserve() presizes the buffer from the number of events, so
+writing the events doesn't reallocate; each event is encoded into a small local
+array and appended to the buffer in one go.
+
+	CTrackWriter track;
+	track.Clear();
+	track.Reserve (vEvents.size());
+	track.MetaEvent (0, 0x03, sName.data(), sName.length());
+	for (...)
+		track.ChannelEvent (nDeltaTime, 0x90, nKey, nVel);
+	track.EndOfTrack();
+	track.AppendChunk (vMIDI);
+*/
+
+class CTrackWriter
+{
+public:
+	// Most bytes a channel event can take: 4 byte delta-time, status, 2 data bytes.
+	static const size_t _nMaxChannelEventLen = 7;
+
+	// Empty the buffer (its capacity is kept).
+	void Clear() { _vData.clear(); }
+
+	// Make room for nNumEvents more channel events, plus nExtraBytes. (Grows
+	// the buffer geometrically, as it's called for each batch of events.)
+	void Reserve (size_t nNumEvents, size_t nExtraBytes = 0)
+	{
+		size_t nSize = _vData.size() + nNumEvents * _nMaxChannelEventLen + nExtraBytes;
+		if (nSize > _vData.capacity())
+			_vData.reserve ((std::max) (nSize, 2 * _vData.capacity()));
+	}
+
+	void ChannelEvent (uint32_t nDeltaTime, uint8_t nStatus, uint8_t nData1, uint8_t nData2)
+	{
+		uint8_t buf[_nMaxChannelEventLen];
+		size_t nLen = EncodeVariableValue (nDeltaTime, buf);
+		buf[nLen] = nStatus;
+		buf[nLen + 1] = nData1;
+		buf[nLen + 2] = nData2;
+		_vData.insert (_vData.end(), buf, buf + nLen + 3);
+	}
+
+	void MetaEvent (uint32_t nDeltaTime, uint8_t nType, const void* pData, uint32_t nDataLen);
+
+	// Meta-event: End Of Track
+	void EndOfTrack (uint32_t nDeltaTime = 0) { MetaEvent (nDeltaTime, 0x2F, nullptr, 0); }
+
+	// Append the whole chunk ("MTrk", length, data) to vMIDI.
+	void AppendChunk (std::vector<uint8_t>& vMIDI) const;
+
+	const std::vector<uint8_t>& GetData() const { return _vData; }
+
+	// Encode n (up to 0x0FFFFFFF) as a MIDI variable length value: 7 bits
+	// per byte, most significant first, top bit set on all but the last byte.
+	// Writes 1 to 4 bytes to p and returns the number written.
+	static size_t EncodeVariableValue (uint32_t n, uint8_t* p)
+	{
+		assert (n <= 0x0FFFFFFF);
+
+		size_t nLen = 1 + (n > 0x7F) + (n > 0x3FFF) + (n > 0x1FFFFF);
+
+		uint8_t buf[4] = {
+			static_cast<uint8_t>(((n >> 21) & 0x7F) | 0x80),
+			static_cast<uint8_t>(((n >> 14) & 0x7F) | 0x80),
+			static_cast<uint8_t>(((n >> 7) & 0x7F) | 0x80),
+			static_cast<uint8_t>(n & 0x7F) };
+
+		std::memcpy (p, buf + 4 - nLen, nLen);
+		return nLen;
+	}
+
+	// Big-endian values.
+	static void Append32 (std::vector<uint8_t>& v, uint32_t n)
+	{
+		uint8_t buf[4] = { uint8_t (n >> 24), uint8_t (n >> 16), uint8_t (n >> 8), uint8_t (n) };
+		v.insert (v.end(), buf, buf + 4);
+	}
+
+	static void Append16 (std::vector<uint8_t>& v, uint16_t n)
+	{
+		uint8_t buf[2] = { uint8_t (n >> 8), uint8_t (n) };
+		v.insert (v.end(), buf, buf + 2);
+	}
+
+protected:
+	std::vector<uint8_t> _vData;
+};
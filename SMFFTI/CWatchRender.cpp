@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "CWatchRender.h"
+#include "Common.h"
+
+CWatchRender::CWatchRender (const std::string& sInFile, const std::string& sOutFile, bool bOverwriteOutFile)
+	: _sInFile (sInFile), _sOutFile (sOutFile), _bOverwriteOutFile (bOverwriteOutFile)
+{
+}
+
+void CWatchRender::SetSeed (uint64_t nSeed)
+{
+	_bSeedSet = true;
+	_nSeed = nSeed;
+}
+
+bool CWatchRender::InputChanged() const
+{
+	std::error_code ec;
+	auto tWrite = std::filesystem::last_write_time (_sInFile, ec);
+	return !ec && tWrite != _tInFileWrite;
+}
+
+CMIDIHandler::StatusCode CWatchRender::Update()
+{
+	auto tStart = std::chrono::steady_clock::now();
+
+	std::error_code ec;
+	_tInFileWrite = std::filesystem::last_write_time (_sInFile, ec);
+	if (ec || !akl::MyFileExists (_sInFile))
+	{
+		_sStatusMessage = "Unable to open input file.";
+		return CMIDIHandler::StatusCode::InvalidInputFile;
+	}
+
+	std::vector<std::string> vFile;
+	akl::LoadTextFileIntoVector (_sInFile, vFile);
+
+	_bIncremental = _pMidiH && _pMidiH->UpdateMIDIBuffer (vFile, _vMIDI);
+	if (!_bIncremental)
+	{
+		// Start again from scratch. (Until this succeeds, the next save
+		// is also rendered in full.)
+		_pMidiH.reset();
+		auto pMidiH = std::make_unique<CMIDIHandler> (_sInFile);
+		if (_bSeedSet)
+			pMidiH->SetSeed (_nSeed);
+
+		CMIDIHandler::StatusCode nRes = pMidiH->VerifyMemFile (vFile);
+		if (nRes == CMIDIHandler::StatusCode::Success)
+			nRes = pMidiH->CreateSectionedMIDIBuffer (vFile, _vMIDI);
+
+		if (nRes != CMIDIHandler::StatusCode::Success)
+		{
+			_sStatusMessage = pMidiH->GetStatusMessage();
+			return nRes;
+		}
+
+		_pMidiH = std::move (pMidiH);
+	}
+
+	CMIDIHandler::StatusCode nRes = WriteOutputFile();
+
+	_dElapsedSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - tStart).count();
+
+	return nRes;
+}
+
+CMIDIHandler::StatusCode CWatchRender::WriteOutputFile()
+{
+	if (!_bOutputWritten && !_bOverwriteOutFile && akl::MyFileExists (_sOutFile))
+	{
+		std::ostringstream ss;
+		ss << "Output file already exists. Use the -o switch to overwrite, eg:\n"
+			<< "    SMFFTI.exe -watch mymidi.txt mymidi.mid -o";
+		_sStatusMessage = ss.str();
+		return CMIDIHandler::StatusCode::OutputFileAlreadyExists;
+	}
+
+	// What's in the file already is the previous render. Chunk lengths (which
+	// change whenever the number of events does) are patched where they are,
+	// and the rest is rewritten from the first byte that differs.
+	size_t nSame = 0;
+	std::vector<size_t> vPatches;
+	if (_bOutputWritten)
+	{
+		// Where the chunk lengths are: 4 bytes, after each chunk's type.
+		std::vector<size_t> vLengths;
+		for (size_t nChunk = 0; nChunk + 8 <= _vMIDI.size();)
+		{
+			vLengths.push_back (nChunk + 4);
+			const uint8_t* p = _vMIDI.data() + nChunk + 4;
+			nChunk += 8 + ((size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3]);
+		}
+
+		size_t nSize = (std::min) (_vPrevMIDI.size(), _vMIDI.size());
+		size_t iLength = 0;
+		while (nSame < nSize)
+		{
+			if (iLength < vLengths.size() && nSame == vLengths[iLength] && nSame + 4 <= nSize)
+			{
+				if (!std::equal (_vMIDI.begin() + nSame, _vMIDI.begin() + nSame + 4, _vPrevMIDI.begin() + nSame))
+					vPatches.push_back (nSame);
+				nSame += 4;
+				iLength++;
+				continue;
+			}
+
+			if (_vMIDI[nSame] != _vPrevMIDI[nSame])
+				break;
+			nSame++;
+		}
+
+		if (nSame == _vMIDI.size() && _vPrevMIDI.size() == _vMIDI.size() && vPatches.empty())
+			return CMIDIHandler::StatusCode::Success;
+	}
+
+	std::fstream fs (_sOutFile, _bOutputWritten ? std::ios::in | std::ios::out | std::ios::binary
+		: std::ios::out | std::ios::trunc | std::ios::binary);
+	bool bWritten = fs.is_open();
+	if (bWritten)
+	{
+		for (size_t nPatch : vPatches)
+		{
+			fs.seekp (nPatch);
+			fs.write (reinterpret_cast<const char*>(_vMIDI.data() + nPatch), 4);
+		}
+		fs.seekp (nSame);
+		fs.write (reinterpret_cast<const char*>(_vMIDI.data() + nSame), _vMIDI.size() - nSame);
+		fs.close();
+		bWritten = !fs.fail();
+	}
+
+	// Drop the end of a longer previous render.
+	if (bWritten && _bOutputWritten && _vPrevMIDI.size() > _vMIDI.size())
+	{
+		std::error_code ec;
+		std::filesystem::resize_file (_sOutFile, _vMIDI.size(), ec);
+		bWritten = !ec;
+	}
+
+	if (!bWritten)
+	{
+		_bOutputWritten = false;	// Contents unknown: write all of it next time.
+		_sStatusMessage = "Unable to write output file.";
+		return CMIDIHandler::StatusCode::UnableToWriteOutputFile;
+	}
+
+	_vPrevMIDI = _vMIDI;
+	_bOutputWritten = true;
+
+	return CMIDIHandler::StatusCode::Success;
+}
+
+size_t CWatchRender::GetSectionCount() const
+{
+	return _pMidiH ? _pMidiH->GetSectionCount() : 0;
+}
+
+size_t CWatchRender::GetSectionsRegenerated() const
+{
+	return _pMidiH ? _pMidiH->GetSectionsRegenerated() : 0;
+}
+
+std::string CWatchRender::GetSummary() const
+{
+	std::ostringstream ss;
+	if (_bIncremental)
+		ss << GetSectionsRegenerated() << " of " << GetSectionCount() << " sections regenerated";
+	else
+		ss << "Full render";
+	ss << " in " << _dElapsedSeconds * 1000.0 << " ms.";
+	return ss.str();
+}
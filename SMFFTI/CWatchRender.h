@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CMIDIHandler.h"
+
+/*
+17/10/26 Watch mode (-watch). Renders the command file whenever it is saved.
+The parsed command file, and the note events of each of its sections (a ruler
+line, up to the next one), are kept between saves, so usually only the sections
+that were edited are verified and regenerated. Changing a parameter, or an edit
+that can't be dealt with section by section, gives a full render instead.
+
+Chunk lengths that changed are patched where they are, and the rest of the MIDI
+file is rewritten from the first event byte that differs. Watch mode doesn't write the RCR history back to the command file, nor save
+the Auto-Melody text.
+*/
+
+class CWatchRender
+{
+public:
+	CWatchRender (const std::string& sInFile, const std::string& sOutFile, bool bOverwriteOutFile);
+
+	// Seed every render (as CMIDIHandler::SetSeed).
+	void SetSeed (uint64_t nSeed);
+
+	// True if the command file has been saved since the last Update().
+	bool InputChanged() const;
+
+	// Render the command file as it is now.
+	CMIDIHandler::StatusCode Update();
+
+	bool WasIncremental() const { return _bIncremental; }
+	size_t GetSectionCount() const;
+	size_t GetSectionsRegenerated() const;
+	double GetElapsedSeconds() const { return _dElapsedSeconds; }
+	std::string GetSummary() const;
+	std::string GetStatusMessage() const { return _sStatusMessage; }
+
+protected:
+	CMIDIHandler::StatusCode WriteOutputFile();
+
+	std::string _sInFile;
+	std::string _sOutFile;
+	bool _bOverwriteOutFile = false;
+	bool _bSeedSet = false;
+	uint64_t _nSeed = 0;
+
+	std::unique_ptr<CMIDIHandler> _pMidiH;
+	std::vector<uint8_t> _vMIDI;
+	std::vector<uint8_t> _vPrevMIDI;	// As written to the output file.
+	bool _bOutputWritten = false;
+
+	std::filesystem::file_time_type _tInFileWrite;
+	bool _bIncremental = false;
+	double _dElapsedSeconds = 0.0;
+	std::string _sStatusMessage;
+};
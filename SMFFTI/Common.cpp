@@ -54,7 +54,7 @@ std::string RemoveWhitespace (const std::string& s, uint8_t mode)
 	bool bLeadingWhitespace = true;
 	while (*pChar)
 	{
-		if (_istspace ((unsigned char)*pChar))
+		if (std::isspace ((unsigned char)*pChar))
 		{
 			// Whitespace
 
@@ -221,15 +221,27 @@ bool MyFileExists (const std::string& name)
 	return f.good();
 }
 
+std::string NumberedFileName (const std::string& name, uint32_t n, const std::string& sExtension)
+{
+	std::filesystem::path path (name);
+	std::string sName = path.stem().string() + "_" + std::to_string (n)
+		+ (sExtension.empty() ? path.extension().string() : sExtension);
+	return (path.parent_path() / sName).string();
+}
+
 std::string TimeStamp()
 {
-	static char szTimeStamp[30];
+	char szTimeStamp[16];	// yymmddhhmmss
 	time_t now;
 	time(&now);
 	struct tm Now;
+#ifdef _MSC_VER
 	localtime_s(&Now, &now);
-	sprintf_s (szTimeStamp, "%02d%02d%02d%02d%02d%02d",
-		(Now.tm_year - 100), Now.tm_mon + 1, Now.tm_mday, Now.tm_hour, Now.tm_min, Now.tm_sec);
+#else
+	localtime_r(&now, &Now);
+#endif
+	if (std::strftime (szTimeStamp, sizeof (szTimeStamp), "%y%m%d%H%M%S", &Now) == 0)
+		return "";
 
 	return szTimeStamp;
 }
@@ -13,6 +13,9 @@ bool VerifyTextInteger (std::string sNum, int32_t& nReturnValue, int32_t nFrom,
 bool VerifyDoubleInteger (std::string sNum, double& nReturnValue, double nFrom, double nTo);
 
 bool MyFileExists (const std::string& name);
+
+// eg. ("melodies.txt", 2) -> "melodies_2.txt". sExtension, if given, replaces the extension.
+std::string NumberedFileName (const std::string& name, uint32_t n, const std::string& sExtension = "");
 std::string TimeStamp();
 
 }
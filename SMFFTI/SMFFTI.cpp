@@ -2,9 +2,10 @@
 //
 
 #include "pch.h"
-#include "framework.h"
 #include "SMFFTI.h"
 
+#ifndef SMFFTI_NO_MFC
+
 #include <mmsystem.h>
 
 #ifdef _DEBUG
@@ -16,8 +17,22 @@
 
 CWinApp theApp;
 
+#endif
+
 using namespace std;
 
+#ifdef SMFFTI_NO_MFC
+
+// Portable front-end (eg. Linux): no MFC initialization required, everything
+// is in the core library.
+int main (int argc, char* argv[])
+{
+    DoStuff (argc, argv);
+    return 0;
+}
+
+#else
+
 int main (int argc, char* argv[])
 {
     int nRetCode = 0;
@@ -49,6 +64,8 @@ int main (int argc, char* argv[])
     return nRetCode;
 }
 
+#endif
+
 void DoStuff (int argc, char* argv[])
 {
     std::vector<std::string> vArgs;
@@ -58,7 +75,7 @@ void DoStuff (int argc, char* argv[])
 
     if (argc < 2)
     {
-        MessageBeep (MB_ICONERROR);
+        ErrorBeep();
         PrintUsage();
         return;
     }
@@ -71,6 +88,7 @@ void DoStuff (int argc, char* argv[])
         return;
     }
 
+#ifndef SMFFTI_NO_MFC
     // T2P7E7 Wizard mode
     if (std::string (argv[1]) == "-w")
     {
@@ -78,6 +96,7 @@ void DoStuff (int argc, char* argv[])
         myUI.Run();
         return;
     }
+#endif
 
     // T2RQLW Set Parameter From Command Line
     if (vArgs[1] == "-p")
@@ -104,7 +123,7 @@ void DoStuff (int argc, char* argv[])
             return;
         }
 
-        std::vector<std::string>& vFile = pMidiH->GetFileVec();
+        std::vector<std::string> vFile = pMidiH->GetFileVec();
 
         if (pMidiH->SetParameter (vFile, vArgs[2]) != CMIDIHandler::StatusCode::Success)
         {
@@ -136,7 +155,7 @@ void DoStuff (int argc, char* argv[])
 
     if (argc < 3)
     {
-        MessageBeep (MB_ICONERROR);
+        ErrorBeep();
         PrintUsage();
         return;
     }
@@ -155,19 +174,116 @@ void DoStuff (int argc, char* argv[])
         }
     }
 
+    // -seed <n>: make the same random choices every time.
+    bool bSeed = false;
+    uint64_t nSeed = 0;
+    for (size_t i = 3; i + 1 < vArgs.size(); i++)
+    {
+        if (vArgs[i] != "-seed")
+            continue;
+
+        if (!CMIDIHandler::ParseSeed (vArgs[i + 1], nSeed))
+        {
+            PrintError ("Invalid -seed value (a whole number, 0 or more).");
+            return;
+        }
+        bSeed = true;
+    }
+
+    // Render cache (plain and batch renders): -cache <dir> [-cachemb <n>]
+    std::unique_ptr<CRenderCache> pCache;
+    int32_t nCacheMB = static_cast<int32_t>(CRenderCache::_nDefaultMaxBytes >> 20);
+    for (size_t i = 3; i + 1 < vArgs.size(); i++)
+    {
+        if (vArgs[i] == "-cachemb" && !akl::VerifyTextInteger (vArgs[i + 1], nCacheMB, 1, 1000000))
+        {
+            PrintError ("Invalid -cachemb value (range 1-1000000).");
+            return;
+        }
+    }
+    for (size_t i = 3; i + 1 < vArgs.size(); i++)
+    {
+        if (vArgs[i] == "-cache")
+            pCache = std::make_unique<CRenderCache> (vArgs[i + 1], static_cast<uint64_t>(nCacheMB) << 20);
+    }
+    if (pCache && bSeed)
+        pCache->SetSeed (nSeed);
+
     // Random Funk Groove: -rfg switch
     // We generate a input MIDI command file.
+    // SMFFTI.exe -rfg <outfile> [-count <n> [-t <threads>] [-mid]] [-o]
     if (std::string (argv[1]) == "-rfg")
     {
+        CMIDIHandler::RandomFunkGrooveOptions options;
+        bool bBulk = false;
+        bool bValid = true;
+        for (size_t i = 3; bValid && i < vArgs.size(); i++)
+        {
+            int32_t nVal = 0;
+            if (vArgs[i] == "-o")
+                continue;
+            else if (vArgs[i] == "-mid")
+                options.bRenderMIDI = true;
+            else if (i + 1 >= vArgs.size())
+                bValid = false;
+            else if (vArgs[i] == "-seed")
+                i++;
+            else if (vArgs[i] == "-count")
+            {
+                bValid = akl::VerifyTextInteger (vArgs[++i], nVal, 1, 1000000);
+                options.nGrooves = nVal;
+                bBulk = true;
+            }
+            else if (vArgs[i] == "-t")
+            {
+                bValid = akl::VerifyTextInteger (vArgs[++i], nVal, 1, 256);
+                options.nThreads = nVal;
+            }
+            else
+                bValid = false;
+        }
+
+        if (!bValid || (!bBulk && (options.bRenderMIDI || options.nThreads)))
+        {
+            std::ostringstream ss;
+            ss << "Command specified incorrectly. The Random Funk Groove command\n"
+                << "should be something like:\n\n"
+                << "    SMFFTI.exe -rfg groove.txt\n\n"
+                << "or, for 100 grooves (groove_1.txt ...), each rendered to a MIDI file:\n\n"
+                << "    SMFFTI.exe -rfg groove.txt -count 100 -mid\n";
+            PrintError (ss.str());
+            return;
+        }
+
         std::string sOutFile (argv[2]);
         CMIDIHandler midiH ("");
-        if (midiH.CreateRandomFunkGrooveMIDICommandFile (sOutFile, bOverwriteOutFile) != CMIDIHandler::StatusCode::Success)
+        if (bSeed)
+            midiH.SetSeed (nSeed);
+
+        CMIDIHandler::StatusCode nRes = bBulk
+            ? midiH.CreateRandomFunkGrooves (sOutFile, bOverwriteOutFile, options)
+            : midiH.CreateRandomFunkGrooveMIDICommandFile (sOutFile, bOverwriteOutFile);
+        if (nRes != CMIDIHandler::StatusCode::Success)
         {
             PrintError (midiH.GetStatusMessage());
         }
         return;
     }
 
+    // Batch mode (-b): render every entry of a manifest in one process.
+    if (std::string (argv[1]) == "-b")
+    {
+        DoBatch (vArgs, bOverwriteOutFile, pCache.get());
+        return;
+    }
+
+    // Watch mode (-watch): render again whenever the command file is saved.
+    if (std::string (argv[1]) == "-watch")
+    {
+        DoWatch (vArgs, bOverwriteOutFile, bSeed ? &nSeed : nullptr);
+        return;
+    }
+
     int8_t iInFile = 1, iOutFile = 2;
 
     // Auto Rhythm: Create modified version of command file
@@ -210,15 +326,33 @@ void DoStuff (int argc, char* argv[])
     }
 
     // T2O4GU MIDI To SMFFTI (mode -m)
+    // SMFFTI.exe -m <infile> <outfile> [-track <n>] [-channel <n>] [-o]
     bool bMIDIToSMFFTI = false;
+    CMIDIHandler::MIDIImportOptions importOptions;
     if (std::string(argv[1]) == "-m")
     {
-        if (argc < 4)
+        bool bValid = (argc >= 4);
+        for (size_t i = 4; bValid && i < vArgs.size(); i++)
+        {
+            if (vArgs[i] == "-o")
+                continue;
+
+            if (vArgs[i] == "-track" && i + 1 < vArgs.size())
+                bValid = akl::VerifyTextInteger (vArgs[++i], importOptions.nTrack, 1, 65535);
+            else if (vArgs[i] == "-channel" && i + 1 < vArgs.size())
+                bValid = akl::VerifyTextInteger (vArgs[++i], importOptions.nChannel, 1, 16);
+            else
+                bValid = false;
+        }
+
+        if (!bValid)
         {
             std::ostringstream ss;
             ss << "Command specified incorrectly. The MIDI-To-SMFFTI command should be\n"
                 << "something like:\n\n"
-                << "    SMFFTI.exe -m mymidi.mid mymidi.txt\n";
+                << "    SMFFTI.exe -m mymidi.mid mymidi.txt\n\n"
+                << "or, to convert only track 2, channel 1:\n\n"
+                << "    SMFFTI.exe -m mymidi.mid mymidi.txt -track 2 -channel 1\n";
             PrintError (ss.str());
             return;
         }
@@ -231,20 +365,77 @@ void DoStuff (int argc, char* argv[])
 
     // Generic Randomized Melodies (-grm)
     // (No input file required.)
+    // SMFFTI.exe -grm <outfile> [-count <n>] [-notes <n>] [-scale <i,i,...>] [-t <threads>] [-shards <n>] [-o]
     if (std::string (argv[1]) == "-grm")
     {
-        if (argc < 3)
+        CMIDIHandler::RandMelodyOptions options;
+        bool bValid = (argc >= 3);
+        for (size_t i = 3; bValid && i < vArgs.size(); i++)
+        {
+            if (vArgs[i] == "-o")
+                continue;
+
+            if (i + 1 >= vArgs.size())
+            {
+                bValid = false;
+                break;
+            }
+
+            const std::string& sOption = vArgs[i];
+            const std::string& sValue = vArgs[++i];
+            int32_t nVal = 0;
+            if (sOption == "-seed")
+                continue;
+            else if (sOption == "-count")
+            {
+                bValid = akl::VerifyTextInteger (sValue, nVal, 1, 2000000000);
+                options.nMelodies = nVal;
+            }
+            else if (sOption == "-notes")
+            {
+                bValid = akl::VerifyTextInteger (sValue, nVal, 1, 4096);
+                options.nNotes = nVal;
+            }
+            else if (sOption == "-t")
+            {
+                bValid = akl::VerifyTextInteger (sValue, nVal, 1, 256);
+                options.nThreads = nVal;
+            }
+            else if (sOption == "-shards")
+            {
+                bValid = akl::VerifyTextInteger (sValue, nVal, 1, 1000);
+                options.nShards = nVal;
+            }
+            else if (sOption == "-scale")
+            {
+                options.vScale.clear();
+                for (const auto& sNote : akl::Explode (sValue, ","))
+                {
+                    bValid = bValid && akl::VerifyTextInteger (sNote, nVal, 0, 24);
+                    options.vScale.push_back (static_cast<uint8_t>(nVal));
+                }
+                bValid = bValid && !options.vScale.empty();
+            }
+            else
+                bValid = false;
+        }
+
+        if (!bValid)
         {
             std::ostringstream ss;
             ss << "Command specified incorrectly. The Generic Random Melodies\n"
                 << "command should be something like:\n\n"
-                << "    SMFFTI.exe -grm generic_rand_melodies.txt\n";
+                << "    SMFFTI.exe -grm generic_rand_melodies.txt\n\n"
+                << "or, for a million 32-note melodies across 4 files:\n\n"
+                << "    SMFFTI.exe -grm generic_rand_melodies.txt -count 1000000 -notes 32 -shards 4\n";
             PrintError (ss.str());
             return;
         }
 
         CMIDIHandler midiH ("");
-        if (midiH.GenRandMelodies (argv[iOutFile], bOverwriteOutFile) != CMIDIHandler::StatusCode::Success)
+        if (bSeed)
+            midiH.SetSeed (nSeed);
+        if (midiH.GenRandMelodies (argv[iOutFile], bOverwriteOutFile, options) != CMIDIHandler::StatusCode::Success)
             PrintError (midiH.GetStatusMessage());
         return;
     }
@@ -267,6 +458,9 @@ void DoStuff (int argc, char* argv[])
     if (bAutoChords)
         midiH.UsingAutoChords();
 
+    if (bSeed)
+        midiH.SetSeed (nSeed);
+
     // Safety
     if (sInFile == sOutFile)
     {
@@ -274,10 +468,18 @@ void DoStuff (int argc, char* argv[])
         return;
     }
 
+    if (pCache && !bAutoRhythm && !bAutoChords && !bMIDIToSMFFTI)
+    {
+        std::string sStatusMessage;
+        if (pCache->Render (sInFile, sOutFile, bOverwriteOutFile, sStatusMessage) != CMIDIHandler::StatusCode::Success)
+            PrintError (sStatusMessage);
+        return;
+    }
+
     // T2O4GU MIDI-To-SMFFTI
     if (bMIDIToSMFFTI)
     {
-        if (midiH.ConvertMIDIToSMFFTI (sInFile, sOutFile, bOverwriteOutFile) != CMIDIHandler::StatusCode::Success)
+        if (midiH.ConvertMIDIToSMFFTI (sInFile, sOutFile, bOverwriteOutFile, importOptions) != CMIDIHandler::StatusCode::Success)
             PrintError (midiH.GetStatusMessage());
         return;
     }
@@ -310,6 +512,123 @@ void DoStuff (int argc, char* argv[])
     }
 }
 
+void DoBatch (const std::vector<std::string>& vArgs, bool bOverwriteOutFile, CRenderCache* pCache)
+{
+    // SMFFTI.exe -b <manifest> [-t <threads>] [-cache <dir> [-cachemb <n>]] [-o]
+    int32_t nThreads = 0;
+    for (size_t i = 3; i < vArgs.size(); i++)
+    {
+        if (vArgs[i] == "-o")
+            continue;
+
+        // (Already dealt with by DoStuff.)
+        if ((vArgs[i] == "-cache" || vArgs[i] == "-cachemb") && i + 1 < vArgs.size())
+        {
+            i++;
+            continue;
+        }
+
+        if (vArgs[i] == "-t" && i + 1 < vArgs.size()
+            && akl::VerifyTextInteger (vArgs[i + 1], nThreads, 1, 256))
+        {
+            i++;
+            continue;
+        }
+
+        std::ostringstream ss;
+        ss << "Command specified incorrectly. The Batch command should be\n"
+            << "something like:\n\n"
+            << "    SMFFTI.exe -b manifest.txt -t 8 -o\n";
+        PrintError (ss.str());
+        return;
+    }
+
+    CBatchRender batch (nThreads);
+    batch.SetRenderCache (pCache);
+    if (batch.LoadManifest (vArgs[2], bOverwriteOutFile) != CMIDIHandler::StatusCode::Success)
+    {
+        PrintError (batch.GetStatusMessage());
+        return;
+    }
+
+    batch.Run();
+
+    std::ostringstream ss;
+    for (const auto& entry : batch.GetEntries())
+    {
+        if (entry.nStatus == CMIDIHandler::StatusCode::Success)
+            ss << "OK      " << entry.sInFile << " -> " << entry.sOutFile << "\n";
+        else
+            ss << "FAILED  " << entry.sInFile << ": " << entry.sStatusMessage << "\n";
+    }
+    ss << "\n" << batch.GetSummary() << "\n";
+    std::cout << ss.str();
+
+    if (batch.GetSuccessCount() != batch.GetEntries().size())
+        ErrorBeep();
+}
+
+void DoWatch (const std::vector<std::string>& vArgs, bool bOverwriteOutFile, const uint64_t* pSeed)
+{
+    // SMFFTI.exe -watch <infile> <outfile> [-seed <n>] [-o]
+    // (-cache and -cachemb are allowed, as for the other renders, but not used.)
+    bool bValid = (vArgs.size() >= 4);
+    for (size_t i = 4; bValid && i < vArgs.size(); i++)
+    {
+        if (vArgs[i] == "-o")
+            continue;
+
+        bValid = (vArgs[i] == "-seed" || vArgs[i] == "-cache" || vArgs[i] == "-cachemb") && i + 1 < vArgs.size();
+        i++;
+    }
+
+    if (!bValid)
+    {
+        std::ostringstream ss;
+        ss << "Command specified incorrectly. The Watch command should be\n"
+            << "something like:\n\n"
+            << "    SMFFTI.exe -watch mymidi.txt mymidi.mid -o\n";
+        PrintError (ss.str());
+        return;
+    }
+
+    if (vArgs[2] == vArgs[3])
+    {
+        PrintError ("Input and output filenames must not be the same.");
+        return;
+    }
+
+    CWatchRender watch (vArgs[2], vArgs[3], bOverwriteOutFile);
+    if (pSeed)
+        watch.SetSeed (*pSeed);
+    CMIDIHandler::StatusCode nRes = watch.Update();
+    if (nRes == CMIDIHandler::StatusCode::OutputFileAlreadyExists)
+    {
+        PrintError (watch.GetStatusMessage());
+        return;
+    }
+
+    // Otherwise, keep watching, even if the file doesn't verify yet.
+    if (nRes != CMIDIHandler::StatusCode::Success)
+        PrintError (watch.GetStatusMessage());
+    else
+        std::cout << watch.GetSummary() << std::endl;
+
+    std::cout << "Watching " << vArgs[2] << " (Ctrl+C to stop)." << std::endl;
+
+    for (;;)
+    {
+        std::this_thread::sleep_for (std::chrono::milliseconds (50));
+        if (!watch.InputChanged())
+            continue;
+
+        if (watch.Update() != CMIDIHandler::StatusCode::Success)
+            PrintError (watch.GetStatusMessage());
+        else
+            std::cout << watch.GetSummary() << std::endl;
+    }
+}
+
 void PrintUsage()
 {
     std::ostringstream ss;
@@ -321,16 +640,21 @@ void PrintUsage()
 
         "Usage 1 - Create MIDI file from text command file:\n\n"
 
-        "    SMFFTI.exe <infile> <outfile>\n\n"
+        "    SMFFTI.exe <infile> <outfile> [-cache <dir> [-cachemb <n>]]\n\n"
 
         "where <infile> is a SMFFTI command file containing a chord progression and parameters\n"
-        "and <outfile> is the name of the MIDI file (.mid) to create.\n\n"
+        "and <outfile> is the name of the MIDI file (.mid) to create. With -cache, MIDI files\n"
+        "that are seeded (+Seed or -seed) or don't use random numbers are kept in <dir> (up\n"
+        "to <n> MB, default 256), and reused when the same command file is rendered again.\n\n"
 
         "Usage 2 - Generate Random Funk Groove SMFFTI command file:\n\n"
 
-        "    SMFFTI.exe -rfg <outfile>\n\n"
+        "    SMFFTI.exe -rfg <outfile> [-count <n> [-t <threads>] [-mid]]\n\n"
 
-        "where <outfile> is the name of the SMFFTI command file.\n\n"
+        "where <outfile> is the name of the SMFFTI command file. With -count, <n> grooves\n"
+        "are made, by <threads> threads (default: one per CPU core), named after <outfile>,\n"
+        "eg. groove_1.txt, groove_2.txt ...; -mid also renders each to a MIDI file,\n"
+        "eg. groove_1.mid.\n\n"
 
         "Usage 3 - Generate modified SMFFTI command file containing a randomized rhythm pattern:\n\n"
 
@@ -347,14 +671,22 @@ void PrintUsage()
 
         "Usage 5 - Generate text file to contain generic random melodies:\n\n"
 
-        "    SMFFTI.exe -grm <outfile>\n\n"
+        "    SMFFTI.exe -grm <outfile> [-count <n>] [-notes <n>] [-scale <i,i,...>]\n"
+        "                              [-t <threads>] [-shards <n>]\n\n"
+
+        "where -count is the number of melodies (default 1000), -notes the number of notes\n"
+        "in each (default 64) and -scale the intervals to choose from (0 - 24, default\n"
+        "0,2,4,7,9). The melodies are generated by <threads> threads (default: one per CPU\n"
+        "core), and with -shards are split across <n> files, eg. <outfile>_1.txt.\n\n"
 
         "Usage 6 - Generate SMFFTI-format chord progression data from a MIDI file:\n\n"
 
-        "    SMFFTI.exe -m <infile> <outfile>\n\n"
+        "    SMFFTI.exe -m <infile> <outfile> [-track <n>] [-channel <n>]\n\n"
 
         "where <infile> is a MIDI file and <outfile> is an existing SMFFTI command file\n"
-        "to be updated, or a plain text file.\n\n"
+        "to be updated, or a plain text file. By default the notes of all tracks and\n"
+        "channels are merged; -track and -channel convert only the given track (1 = first)\n"
+        "and/or MIDI channel (1 - 16).\n\n"
 
         "Usage 7 - Set a parameter in a SMFFTI command file:\n\n"
 
@@ -364,6 +696,24 @@ void PrintUsage()
 
         "    SMFFTI.exe -w\n\n"
 
+        "Usage 9 - Create MIDI files for every entry in a batch manifest:\n\n"
+
+        "    SMFFTI.exe -b <manifest> [-t <threads>] [-cache <dir> [-cachemb <n>]] [-o]\n\n"
+
+        "where each line of <manifest> is \"<infile> <outfile> [-o]\". The files are\n"
+        "rendered by <threads> worker threads (default: one per CPU core). -cache is as\n"
+        "for Usage 1.\n\n"
+
+        "Usage 10 - Create a MIDI file, and update it whenever the command file is saved:\n\n"
+
+        "    SMFFTI.exe -watch <infile> <outfile> [-o]\n\n"
+
+        "Only the sections of <infile> (a ruler line, up to the next) that were edited\n"
+        "are regenerated. Press Ctrl+C to stop. -cache isn't used in watch mode.\n\n"
+
+        "Add -seed <n> to usages 1 - 5 and 10 to make the same random choices every time\n"
+        "(as the +Seed parameter).\n\n"
+
         "Consult the manual for more information on all the above operations.\n\n"
         ;
 
@@ -372,6 +722,13 @@ void PrintUsage()
 
 void PrintError (std::string sMsg)
 {
-    MessageBeep (MB_ICONERROR);
+    ErrorBeep();
     std::cout << "\nERROR! " << sMsg << "\n\n";
 }
+
+void ErrorBeep()
+{
+#ifndef SMFFTI_NO_MFC
+    MessageBeep (MB_ICONERROR);
+#endif
+}
@@ -6,6 +6,121 @@ SMFFTI - Simple MIDI Files From Text Input
 
 See the User Manual for everything you need to know about using it.
 
+v0.46	October 17, 2026
+(1) Core library: CMIDIHandler, CChordBank, CAutoRhythm and Common no longer
+depend on MFC or Win32, and build with CMake as the smffti_core library (see
+CMakeLists.txt). The Windows exe is just a front-end on top of it.
+CMIDIHandler::Render() verifies a command file and creates the MIDI file in
+one in-process call.
+(2) CMIDIHandler::CreateMIDIBuffer() renders the Standard MIDI File into a
+memory buffer; CreateMIDIFile() is now a thin wrapper that writes that buffer
+(and the Auto-Melody text) to disk. A Render() overload takes the command file
+lines and returns the MIDI bytes without touching the file system.
+(3) Batch mode (-b): renders every entry of a manifest file in one process,
+across a configurable number of threads (-t), with per-entry status and a
+files/sec summary. Entries that would write the same file, or read a file that
+another entry writes, are rejected when the manifest is loaded.
+(4) CMIDIHandler is re-entrant: the randomizers of CMIDIHandler, CChordBank and
+CAutoRhythm are per instance, the Auto-Melody pentatonic notes and the in-octave
+chord types used by -m are fixed tables built at start-up (they were added to
+the shared tables on every run), and akl::TimeStamp() no longer returns a static
+buffer. Batch mode renders in parallel.
+(5) Chord names are compiled once, at verify time, into a ChordSpec (root pitch
+class, chord type id, intervals); note event generation uses these instead of
+re-parsing the chord name for every note on/off.
+(6) MIDI-To-SMFFTI (-m): Chords are identified with a single lookup in a 4096-entry
+table of pitch-class sets (relative to the bass note), instead of trying inversions
+and string-matching intervals. Where notes fit more than one chord (sus2/sus4,
+dim7), the root closest above the bass is chosen. Fix: The bass is now always the
+lowest note. Where it was doubled an octave or more higher, the lower copy used to be
+dropped, so eg. C3 D3 G3 C4 was imported as Gsus4; it's now Csus2.
+(7) MIDI-To-SMFFTI: Note Offs are paired with Note Ons as the track is read, and
+notes are grouped into chords in one pass. Chords are stored as bass note plus
+pitch-class set. Note On with zero velocity is treated as Note Off, and times are
+no longer 16-bit (long clips used to wrap around).
+(8) MIDI-To-SMFFTI: New MIDI file reader (CSMFReader). The file is read once into
+a buffer and parsed in place, instead of copying the track data for every value
+read, which made large files very slow. All reads are bounds checked, so a
+corrupt or truncated file gives an error message.
+(9) MIDI-To-SMFFTI: Format 1 and format 2 MIDI files can now be converted, not
+just single-track (format 0) files. By default the notes of all tracks are merged
+(format 2 patterns are placed one after the other); -track <n> and -channel <n>
+convert only the given track and/or MIDI channel, eg.:
+    SMFFTI.exe -m mymidi.mid mymidi.txt -track 2 -channel 1
+Large multi-track files are decoded a track per thread. Files with a time division
+other than 96 ticks per quarter note are now quantized correctly.
+(10) MIDI track data is built by a new track writer (CTrackWriter). Its buffer is
+presized from the number of note events, and each event is encoded and appended in
+one go. Removes the unused debug strings built for every variable length value.
+(11) MIDI files are now written as they are generated (CSMFStreamWriter): the
+track chunk length is patched in at the end, and note events are written out as
+each note position line is done, so memory no longer grows with the length of the
+song. Also, songs of more than 65535 notes/bars no longer overflow.
+(12) New +Parts parameter, eg. "+Parts = Chords, Bass, Melody", renders each part to
+its own track of a format 1 MIDI file, all in one pass. Optional +PartChannels
+(1-16) and +PartTrackNames give each part's channel and track name. The bass part
+is the +BassNote note (the chord root an octave down), which the chords part then
+leaves out; the melody part is the melody line if there is one, else an auto
+melody. +NoteStagger and +Arpeggiator apply to the chords part. The tracks after
+the first are streamed to temporary files next to the output file until the first
+track ends.
+(13) Note events are sorted with a radix sort, and simultaneous events are always
+written Note Off first (with +NoteStagger, a Note On could come before the Note Off
+of the same note). Arpeggiator overlaps are fixed in one pass.
+(14) Random note offset fixing, +NoteStagger and +Arpeggiator are stages that the
+note events pass through on their way to the file, a batch at a time, so renders
+using them are written out as they are generated too.
+(15) Arpeggiator patterns are built once, at start-up, for each arp type and chord
+size. Patterns that had no notes for very small chords (eg. Pinky Up on a single
+note) now play the first note.
+(16) Watch mode (-watch): renders the command file again whenever it is saved. Only
+the sections (a ruler line, up to the next) that were edited are verified and
+regenerated, and only the changed part of the MIDI file is rewritten.
+(17) Render cache (-cache <dir>): MIDI files are kept on disk, keyed by the command
+file with comments and insignificant whitespace removed, and reused when it's
+rendered again. Renders that use random numbers, and RCR files, aren't cached.
+(18) New random number generator, seeded once per run instead of per choice. A
++Seed parameter (or -seed <n> on the command line) makes every random choice the
+same each time the file is rendered; such renders can be cached. Each command
+line draws from its own stream, so changing a chord in watch mode doesn't change
+the random choices made for the other lines.
+(19) Generic Random Melodies (-grm): -count, -notes and -scale set the number of
+melodies, their length and the intervals they're made from. Melodies are generated
+by several threads (-t) straight into text buffers, which are written out in large
+blocks, optionally split across files (-shards). Each melody has its own random
+stream, so with -seed the output doesn't depend on the number of threads.
+(20) Random Funk Groove (-rfg): -count <n> makes <n> grooves (groove_1.txt ...)
+across several threads (-t), and -mid renders each to a MIDI file as it's made.
+Chords are drawn from those allowed at each position (no repeats, no sus chords
+before the last, last not Em7), instead of drawing again until one fits.
+(21) Auto-Rhythm note and gap lengths are drawn only from the lengths that fit,
+and RCR chords only from those that aren't the current chord or in the history,
+instead of drawing again until one fits. A weight of zero for 32nds in
++AutoRhythmNoteLenBias/+AutoRhythmGapLenBias is no longer changed to 1; when no
+length that fits has any weight, the longest one that fits is used.
+RandomGroove note positions (and so -rfg) are built a note at a time, each note
+length drawn with the chance that the rest of the line can still avoid the
+disallowed patterns (eg. more than two 1/8th notes in a row), instead of building
+the whole line again until it has none of them. The chances of each groove are
+the same, but long lines no longer take longer and longer to make.
+(22) Auto-Chords and RCR chords are picked from alias tables (CAliasTable) built
+once per chord bank, instead of from lists of 100 chords and of variations repeated
+by their weights. The weights are exact: eg. +AutoChordsMinorChordBias' "other
+minor" percentage is now split evenly between the two chords, even when odd.
+(23) RCR: the history lines are read once into a set of chords for each position
+in the line, so checking a candidate chord against the history is a single lookup.
+Chord names in the history are only checked once each. Files with long histories
+render much faster.
+(24) Each distinct chord name is compiled once, into a table, and the chord
+progression is kept as a list of 16-bit ids into it. Repeated chords ('#' after a
+gap) are added to the end of the list of note chords as they're read, instead of
+being inserted into the chord list, which made long songs with many repeats slow.
+(25) Note position lines are compiled, when the file is verified, into a list of
+notes (start, length, chord and melody note), and note events are generated from
+that in one pass. "M:" melody lines are checked too: a melody note that isn't a
+number from 0 to 127, or a melody line with fewer notes than its note position
+line, gives an error message (it used to crash or stop with no message).
+
 v0.45	December 5, 2023
 (1) Allow text on same line after comment block start, eg. "(# hello"; similarly 
 allow text before comment block end, eg. "goodbye #)".
@@ -74,11 +189,20 @@ specifying fixed melodies.
 
 
 */
-#include "resource.h"
 #include "CMIDIHandler.h"
+#include "CBatchRender.h"
+#include "CRenderCache.h"
+#include "CWatchRender.h"
+#include "Common.h"
+#ifndef SMFFTI_NO_MFC
+#include "resource.h"
 #include "CMyUI.h"
+#endif
 
 void DoStuff (int argc, char* argv[]);
+void DoBatch (const std::vector<std::string>& vArgs, bool bOverwriteOutFile, CRenderCache* pCache);
+void DoWatch (const std::vector<std::string>& vArgs, bool bOverwriteOutFile, const uint64_t* pSeed);
 
 void PrintUsage();
 void PrintError (std::string sMsg);
+void ErrorBeep();
@@ -8,13 +8,34 @@
 #define PCH_H
 
 // add headers that you want to pre-compile here
+#ifndef SMFFTI_NO_MFC
 #include "framework.h"
+#endif
 
+#include <cstdint>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <iostream>
 #include <fstream>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <tuple>
 #include <random>
 #include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <filesystem>
+#include <charconv>
 
 #endif //PCH_H
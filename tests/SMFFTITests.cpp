@@ -0,0 +1,403 @@
+/*
+17/10/26 Unit tests for the core library (ctest). No test framework: each
+CHECK that fails is reported with its line, and the exit code is the number
+of failures.
+*/
+
+#include "pch.h"
+#include "CAliasTable.h"
+#include "CMIDIHandler.h"
+#include "CRandom.h"
+#include "CRenderCache.h"
+#include "CSMFReader.h"
+#include "CTrackWriter.h"
+
+namespace {
+
+int nFailures = 0;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { std::cerr << __FILE__ << "(" << __LINE__ << "): CHECK failed: " #cond "\n"; nFailures++; } } while (0)
+
+//-----------------------------------------------------------------------------
+// CSMFReader
+
+// A format 0 file with one track: the given track data, with the chunk length
+// given (or the data's own length).
+std::vector<uint8_t> MakeSMF (const std::vector<uint8_t>& vTrack, int64_t nTrackLen = -1)
+{
+	std::vector<uint8_t> v = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96 };
+	v.insert (v.end(), { 'M', 'T', 'r', 'k' });
+	CTrackWriter::Append32 (v, static_cast<uint32_t>(nTrackLen >= 0 ? nTrackLen : vTrack.size()));
+	v.insert (v.end(), vTrack.begin(), vTrack.end());
+	return v;
+}
+
+// Read all of track 0's events; false if the track has an error.
+bool ReadTrack (CSMFReader& smf, std::vector<CSMFReader::Event>& vEvents)
+{
+	vEvents.clear();
+	CSMFReader::TrackReader track = smf.GetTrack (0);
+	CSMFReader::Event ev;
+	while (track.NextEvent (ev))
+		vEvents.push_back (ev);
+	return !track.Error();
+}
+
+void TestSMFReader()
+{
+	CTrackWriter writer;
+	writer.ChannelEvent (0, 0x90, 60, 100);
+	writer.ChannelEvent (0x80, 0x80, 60, 0);
+	writer.EndOfTrack();
+	const std::vector<uint8_t> vTrack = writer.GetData();
+
+	std::vector<CSMFReader::Event> vEvents;
+
+	// Well formed.
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF (vTrack)));
+		CHECK (smf.GetNumTracks() == 1 && smf.GetDivision() == 96);
+		CHECK (ReadTrack (smf, vEvents));
+		CHECK (vEvents.size() == 3);
+		CHECK (vEvents[1].nTime == 0x80 && vEvents[1].GetType() == 0x80 && vEvents[1].nData1 == 60);
+		CHECK (vEvents[2].IsMeta() && vEvents[2].nMetaType == 0x2F);
+	}
+
+	// Truncated: a shorter file doesn't load...
+	const std::vector<uint8_t> vFile = MakeSMF (vTrack);
+	for (size_t nLen = 0; nLen < vFile.size(); nLen++)
+	{
+		CSMFReader smf;
+		CHECK (!smf.Load (std::vector<uint8_t> (vFile.begin(), vFile.begin() + nLen)));
+	}
+
+	// ...and a shorter track chunk has an error, or ends early.
+	for (size_t nLen = 0; nLen < vTrack.size(); nLen++)
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF (std::vector<uint8_t> (vTrack.begin(), vTrack.begin() + nLen))));
+		CHECK (!ReadTrack (smf, vEvents) || vEvents.size() < 3);
+	}
+
+	// A track chunk length past the end of the file.
+	{
+		CSMFReader smf;
+		CHECK (!smf.Load (MakeSMF (vTrack, vTrack.size() + 1)));
+	}
+
+	// Over-long: bytes after the last track are ignored...
+	{
+		std::vector<uint8_t> v = MakeSMF (vTrack);
+		v.insert (v.end(), { 0xFF, 0xFF, 0xFF });
+		CSMFReader smf;
+		CHECK (smf.Load (v));
+		CHECK (ReadTrack (smf, vEvents) && vEvents.size() == 3);
+	}
+
+	// ...but a meta event longer than its track is an error.
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF ({ 0x00, 0xFF, 0x01, 0x10, 'a', 'b' })));
+		CHECK (!ReadTrack (smf, vEvents));
+	}
+
+	// Variable length values: 4 bytes is the most; a 5th is an error, as is
+	// one cut off by the end of the track.
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF ({ 0xFF, 0xFF, 0xFF, 0x7F, 0x90, 60, 100 })));
+		CHECK (ReadTrack (smf, vEvents) && vEvents.size() == 1 && vEvents[0].nTime == 0x0FFFFFFF);
+	}
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF ({ 0x81, 0x80, 0x80, 0x80, 0x00, 0x90, 60, 100 })));
+		CHECK (!ReadTrack (smf, vEvents));
+	}
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF ({ 0x81, 0x80 })));
+		CHECK (!ReadTrack (smf, vEvents));
+	}
+
+	// Running status with no previous status.
+	{
+		CSMFReader smf;
+		CHECK (smf.Load (MakeSMF ({ 0x00, 60, 100 })));
+		CHECK (!ReadTrack (smf, vEvents));
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CTrackWriter
+
+void TestEncodeVariableValue()
+{
+	struct Case
+	{
+		uint32_t n;
+		std::vector<uint8_t> vBytes;
+	};
+	const Case aCases[] = {
+		{ 0x00, { 0x00 } },
+		{ 0x7F, { 0x7F } },
+		{ 0x80, { 0x81, 0x00 } },
+		{ 0x3FFF, { 0xFF, 0x7F } },
+		{ 0x4000, { 0x81, 0x80, 0x00 } },
+		{ 0x1FFFFF, { 0xFF, 0xFF, 0x7F } },
+		{ 0x200000, { 0x81, 0x80, 0x80, 0x00 } },
+		{ 0x0FFFFFFF, { 0xFF, 0xFF, 0xFF, 0x7F } },
+	};
+
+	for (const Case& c : aCases)
+	{
+		uint8_t buf[4] = {};
+		size_t nLen = CTrackWriter::EncodeVariableValue (c.n, buf);
+		CHECK (std::vector<uint8_t> (buf, buf + nLen) == c.vBytes);
+
+		// And back.
+		CSMFReader smf;
+		std::vector<uint8_t> vTrack (buf, buf + nLen);
+		vTrack.insert (vTrack.end(), { 0x90, 60, 100 });
+		CHECK (smf.Load (MakeSMF (vTrack)));
+		std::vector<CSMFReader::Event> vEvents;
+		CHECK (ReadTrack (smf, vEvents) && vEvents.size() == 1 && vEvents[0].nTime == c.n);
+	}
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// CMIDIHandler::SortNoteEvents (a friend of CMIDIHandler)
+
+struct SortNoteEventsTest
+{
+	static void Run()
+	{
+		typedef CMIDIHandler::MIDINote MIDINote;
+		auto SortKey = [](const MIDINote& note)
+		{
+			return std::make_tuple (note.nTime, (note.nEvent & 0xF0) == (uint8_t)EventName::NoteOn, note.nKey);
+		};
+		auto Same = [](const MIDINote& m1, const MIDINote& m2)
+		{
+			return m1.nSeq == m2.nSeq && m1.nTime == m2.nTime && m1.nEvent == m2.nEvent
+				&& m1.nKey == m2.nKey && m1.nVel == m2.nVel;
+		};
+
+		CMIDIHandler midiH ("");
+		CRandom rng (1);
+
+		// Either side of the radix sort cutoff (64), and larger; times with
+		// few and many distinct values (so that some radix passes are skipped).
+		for (size_t nSize : { 0, 1, 2, 63, 64, 65, 1000, 20000 })
+		{
+			for (uint32_t nMaxTime : { 4u, 1000u, 0x7FFFFFFFu })
+			{
+				std::vector<MIDINote> vEvents;
+				for (size_t i = 0; i < nSize; i++)
+				{
+					uint8_t nEvent = static_cast<uint8_t>((uint8_t)(rng.Below (2) ? EventName::NoteOn : EventName::NoteOff) | rng.Below (16));
+					vEvents.push_back (MIDINote (static_cast<uint32_t>(i), rng.Below (nMaxTime),
+						nEvent, static_cast<uint8_t>(rng.Below (128)), static_cast<uint8_t>(rng.Below (128))));
+				}
+
+				std::vector<MIDINote> vExpected = vEvents;
+				std::stable_sort (vExpected.begin(), vExpected.end(),
+					[&](const MIDINote& m1, const MIDINote& m2) { return SortKey (m1) < SortKey (m2); });
+
+				midiH.SortNoteEvents (vEvents);
+				CHECK (std::equal (vEvents.begin(), vEvents.end(), vExpected.begin(), vExpected.end(), Same));
+			}
+		}
+
+		// Note Off before Note On at the same tick, whatever the key or order.
+		for (size_t nSize : { 2, 100 })
+		{
+			std::vector<MIDINote> vEvents;
+			for (size_t i = 0; i < nSize; i++)
+			{
+				uint8_t nEvent = static_cast<uint8_t>(i % 2 ? EventName::NoteOff : EventName::NoteOn);
+				vEvents.push_back (MIDINote (static_cast<uint32_t>(i), 96, nEvent, static_cast<uint8_t>(127 - i), 100));
+			}
+
+			midiH.SortNoteEvents (vEvents);
+			for (size_t i = 0; i < nSize; i++)
+				CHECK ((vEvents[i].nEvent == (uint8_t)EventName::NoteOff) == (i < nSize / 2));
+		}
+	}
+};
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// CAliasTable
+
+struct AliasTableProbe : CAliasTable
+{
+	using CAliasTable::CAliasTable;
+
+	// How many of the (bucket, threshold draw) pairs pick each index: exactly
+	// GetSize() * weight, if the chances are exact.
+	std::vector<uint64_t> CountPicks() const
+	{
+		std::vector<uint64_t> vCounts (_vThreshold.size());
+		for (size_t i = 0; i < _vThreshold.size(); i++)
+		{
+			CHECK (_vThreshold[i] <= _nTotal);
+			CHECK (_vAlias[i] < _vThreshold.size());
+			vCounts[i] += _vThreshold[i];
+			vCounts[_vAlias[i]] += _nTotal - _vThreshold[i];
+		}
+		return vCounts;
+	}
+};
+
+void TestAliasTable()
+{
+	const std::vector<std::vector<uint32_t>> vvWeights = {
+		{ 1 },
+		{ 6, 3, 1 },
+		{ 0, 5, 0, 5 },
+		{ 1, 1, 1, 1, 1, 1, 1 },
+		{ 1000000, 1, 999, 0, 12345 },
+		{ 0xFFFFFFF0u, 15 },
+	};
+
+	for (const auto& vWeights : vvWeights)
+	{
+		AliasTableProbe table (vWeights);
+		CHECK (table.GetSize() == vWeights.size());
+
+		std::vector<uint64_t> vCounts = table.CountPicks();
+		for (size_t i = 0; i < vWeights.size(); i++)
+			CHECK (vCounts[i] == vWeights.size() * uint64_t (vWeights[i]));
+
+		// Indexes with no weight are never picked.
+		CRandom rng (7);
+		for (int i = 0; i < 10000; i++)
+		{
+			uint32_t n = table.Pick (rng);
+			CHECK (n < vWeights.size() && vWeights[n] > 0);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CRandom
+
+void TestRandom()
+{
+	const uint64_t aSeeds[] = { 0, 1, 42, 0xFFFFFFFFFFFFFFFFull };
+	const uint64_t aStreams[] = { 0, 1, 2, 1000000 };
+
+	std::vector<std::vector<uint64_t>> vvSeqs;
+	for (uint64_t nSeed : aSeeds)
+	{
+		for (uint64_t nStream : aStreams)
+		{
+			CRandom rng1 (nSeed, nStream);
+			std::vector<uint64_t> vSeq;
+			for (int i = 0; i < 100; i++)
+				vSeq.push_back (rng1());
+
+			// The same seed and stream, however they're reached, gives the
+			// same numbers.
+			CRandom rng2 (nSeed, nStream + 1);
+			for (int i = 0; i < 10; i++)
+				rng2();
+			rng2.SetStream (nStream);
+			CRandom rng3;
+			rng3.Seed (nSeed, nStream);
+
+			bool bSame = true;
+			for (int i = 0; i < 100; i++)
+			{
+				uint64_t n2 = rng2(), n3 = rng3();
+				bSame = bSame && n2 == vSeq[i] && n3 == vSeq[i];
+			}
+			CHECK (bSame);
+			CHECK (rng1.GetSeed() == nSeed && rng1.GetDrawCount() == 100);
+
+			vvSeqs.push_back (vSeq);
+		}
+	}
+
+	// Each seed/stream pair has its own numbers.
+	std::sort (vvSeqs.begin(), vvSeqs.end());
+	CHECK (std::adjacent_find (vvSeqs.begin(), vvSeqs.end()) == vvSeqs.end());
+
+	// Seeded renders must not change between versions.
+	CRandom rng (42, 1);
+	CHECK (rng() == 0x584870A53E6DDCDFull);
+	CHECK (rng.Below (1000) == 142);
+}
+
+//-----------------------------------------------------------------------------
+// CRenderCache
+
+void TestRenderCacheKey()
+{
+	CRenderCache cache ((std::filesystem::temp_directory_path() / "smffti_tests_no_cache").string());
+
+	const std::vector<std::string> vFile = {
+		"+TrackName=My Song",
+		"+Velocity=90",
+		"$ . . . | . . . | . . . | . . .",
+		"+###  ##  ##+###+#######  #####",
+		"C, Am, F",
+	};
+	const std::vector<std::string> vCommented = {
+		"# A comment",
+		"",
+		"  +TrackName =  My Song  ",
+		"(# A comment block",
+		"+Velocity=60",
+		"#)",
+		"\t+Velocity = 90",
+		"",
+		"$ . . . | . . . | . . . | . . .   ",
+		"+###  ##  ##+###+#######  #####\t",
+		"   # Another comment",
+		"C,Am,  F ",
+	};
+
+	std::string sKey1, sKey2;
+	CHECK (cache.MakeKey (vFile, sKey1));
+	CHECK (cache.MakeKey (vCommented, sKey2));
+	CHECK (sKey1 == sKey2);
+
+	// Spaces inside note positions and parameter values do count.
+	std::vector<std::string> vChanged = vFile;
+	vChanged[3] = "+### ##  ##+###+#######  #####";
+	CHECK (cache.MakeKey (vChanged, sKey2) && sKey1 != sKey2);
+	vChanged = vFile;
+	vChanged[0] = "+TrackName=MySong";
+	CHECK (cache.MakeKey (vChanged, sKey2) && sKey1 != sKey2);
+
+	// So does the seed.
+	cache.SetSeed (1);
+	CHECK (cache.MakeKey (vFile, sKey2) && sKey1 != sKey2);
+
+	// Files that write back to themselves aren't cached.
+	vChanged = vFile;
+	vChanged.push_back ("+RandomChordReplacementKey=1");
+	CHECK (!cache.MakeKey (vChanged, sKey2));
+}
+
+} // namespace
+
+int main()
+{
+	TestSMFReader();
+	TestEncodeVariableValue();
+	SortNoteEventsTest::Run();
+	TestAliasTable();
+	TestRandom();
+	TestRenderCacheKey();
+
+	if (nFailures == 0)
+		std::cout << "All tests passed.\n";
+	return nFailures;
+}